@@ -0,0 +1,157 @@
+/*
+ * CAN bus driver for Microchip 251x CAN Controller - bit-banged variant
+ *
+ * shared definitions of the driver core and its SPI transports
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ */
+
+#ifndef _MCP2515_BANGED_H_
+#define _MCP2515_BANGED_H_
+
+#include <linux/can/dev.h>
+#include <linux/irq_work.h>
+#include <linux/mutex.h>
+#include <linux/netdevice.h>
+#include <linux/spi/spi.h>
+#include <linux/workqueue.h>
+
+/*
+ * Buffer size required for the largest SPI transfer (i.e., reading a
+ * frame)
+ */
+#define CAN_FRAME_MAX_DATA_LEN	8
+#define SPI_TRANSFER_BUF_LEN	(6 + CAN_FRAME_MAX_DATA_LEN)
+/* READ RX BUFFER: instruction, SIDH, SIDL, EID8, EID0 and DLC */
+#define SPI_RXBUF_HEADER_LEN	6
+
+#define DEVICE_NAME "mcp2515-banged"
+
+/* TXB0..TXB2 */
+#define TXB_NUM	3
+
+#define GPIO_MISO	0
+#define GPIO_MOSI	1
+#define GPIO_CLK	2
+#define GPIO_CS		3
+#define GPIO_INT	4
+
+extern int gpios[];
+
+/*
+ * bus thread mode: single producer/single consumer rings between the bus
+ * thread and NAPI (RX) and between xmit and the bus thread (TX)
+ */
+#define MCP2515_RING_SIZE	64	/* power of 2 */
+/* READ RX BUFFER without the instruction: SIDH..DLC and 8 data bytes */
+#define MCP2515_RX_REC_LEN	(SPI_TRANSFER_BUF_LEN - 1)
+
+struct mcp2515_rx_ring {
+	u8 rec[MCP2515_RING_SIZE][MCP2515_RX_REC_LEN];
+	unsigned int head;	/* bus thread */
+	unsigned int tail;	/* NAPI */
+};
+
+struct mcp2515_tx_ring {
+	struct sk_buff *skb[MCP2515_RING_SIZE];
+	unsigned int head;	/* xmit */
+	unsigned int tail;	/* bus thread */
+};
+
+struct mcp2515_priv;
+
+/*
+ * the way the MCP2515 SPI gets driven - the CAN logic in the core
+ * only uses these operations
+ */
+struct mcp2515_transport {
+	const char *name;
+	/* the transfers may sleep - irq and tx get handled by threads */
+	bool sleeps;
+	/* claim pins/devices - called at probe before the first transfer */
+	int (*init)(struct mcp2515_priv *priv);
+	void (*exit)(struct mcp2515_priv *priv);
+	/* full duplex transfer of len bytes from spi_tx_buf to spi_rx_buf */
+	int (*trans)(struct mcp2515_priv *priv, int len);
+	/*
+	 * READ RX BUFFER instruction in spi_tx_buf[0] - transports may
+	 * stop after the data bytes (see mcp2515_rxbuf_len) and return
+	 * the number of bytes clocked
+	 */
+	int (*rxbuf)(struct mcp2515_priv *priv);
+};
+
+extern const struct mcp2515_transport mcp2515_mmio_transport;
+extern const struct mcp2515_transport mcp2515_gpio_transport;
+extern const struct mcp2515_transport mcp2515_spi_transport;
+
+enum mcp2515_model {
+	CAN_MCP251X_MCP2515	= 0x2515,
+};
+
+struct mcp2515_priv {
+	struct can_priv	   can;
+	struct net_device *net;
+	struct spi_device *spi;
+	enum mcp2515_model model;
+	const struct mcp2515_transport *xport;
+
+	struct mutex mcp_lock; /* SPI device lock */
+
+	u8 *spi_tx_buf;
+	u8 *spi_rx_buf;
+	int irq;
+
+	/*
+	 * per TX buffer: the skb waiting to be loaded, the length of the
+	 * loaded frame (0 = none), its TXP and the TXP in TXBnCTRL
+	 */
+	struct sk_buff *tx_skb[TXB_NUM];
+	int tx_len[TXB_NUM];
+	u8 tx_prio[TXB_NUM];
+	u8 tx_ctrl[TXB_NUM];
+	/* buffers in use - bit n = TXBn, cleared from the irq */
+	unsigned long tx_busy;
+	/* loaded buffers waiting for the RTS */
+	u8 tx_rts;
+
+	struct work_struct tx_work;
+	struct work_struct restart_work;
+
+	int force_quit;
+	int after_suspend;
+#define AFTER_SUSPEND_UP 1
+#define AFTER_SUSPEND_DOWN 2
+#define AFTER_SUSPEND_POWER 4
+#define AFTER_SUSPEND_RESTART 8
+	int restart_tx;
+	struct clk *clk;
+
+	/* bus thread mode - the thread owns the SPI, no mcp_lock */
+	struct task_struct *bus_task;
+	unsigned long bus_events;
+#define BUS_EV_IRQ 0
+#define BUS_EV_TX  1
+	struct napi_struct napi;
+	struct irq_work napi_kick;
+	int napi_cpu;
+	struct mcp2515_rx_ring rx_ring;
+	struct mcp2515_tx_ring tx_ring;
+	atomic_t rx_ring_drops;
+
+	/* SPI bytes - in total and spent in the irq loop */
+	u64 spi_bytes;
+	u64 irq_spi_bytes;
+	u64 irq_rx_frames;
+};
+
+/* bytes of a READ RX BUFFER transfer up to the last data byte */
+int mcp2515_rxbuf_len(const u8 *buf);
+
+/* MISO, MOSI, CLK and CS for the bit-bang transports */
+int mcp2515_request_spi_gpios(void);
+void mcp2515_free_spi_gpios(void);
+
+#endif /* _MCP2515_BANGED_H_ */
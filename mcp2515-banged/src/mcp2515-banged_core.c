@@ -61,14 +61,20 @@
 #include <linux/freezer.h>
 #include <linux/interrupt.h>
 #include <linux/io.h>
+#include <linux/irq_work.h>
 #include <linux/kernel.h>
+#include <linux/kthread.h>
 #include <linux/module.h>
 #include <linux/netdevice.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
 #include <linux/gpio.h>
+#include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/types.h>
+#endif
 
-
+#include "mcp2515-banged.h"
 
 /* SPI interface instruction set */
 #define INSTRUCTION_WRITE	0x02
@@ -77,11 +83,25 @@
 #define INSTRUCTION_LOAD_TXB(n)	(0x40 + 2 * (n))
 #define INSTRUCTION_READ_RXB(n)	(((n) == 0) ? 0x90 : 0x94)
 #define INSTRUCTION_RESET	0xC0
+#define INSTRUCTION_READ_STATUS	0xA0
+#define INSTRUCTION_RX_STATUS	0xB0
 #define RTS_TXB0		0x01
 #define RTS_TXB1		0x02
 #define RTS_TXB2		0x04
 #define INSTRUCTION_RTS(n)	(0x80 | ((n) & 0x07))
 
+/* READ STATUS response */
+#define READ_STATUS_RX0IF	0x01
+#define READ_STATUS_RX1IF	0x02
+#define READ_STATUS_TX0REQ	0x04
+#define READ_STATUS_TX0IF	0x08
+#define READ_STATUS_TX1REQ	0x10
+#define READ_STATUS_TX1IF	0x20
+#define READ_STATUS_TX2REQ	0x40
+#define READ_STATUS_TX2IF	0x80
+#define READ_STATUS_RX (READ_STATUS_RX0IF | READ_STATUS_RX1IF)
+#define READ_STATUS_TX (READ_STATUS_TX0IF | READ_STATUS_TX1IF | READ_STATUS_TX2IF)
+
 
 /* MPC251x registers */
 #define CANSTAT	      0x0e
@@ -141,6 +161,7 @@
 #  define TXBCTRL_MLOA	0x20
 #  define TXBCTRL_TXERR 0x10
 #  define TXBCTRL_TXREQ 0x08
+#  define TXBCTRL_TXP_MASK 0x03
 #define TXBSIDH(n)  (((n) * 0x10) + 0x30 + TXBSIDH_OFF)
 #  define SIDH_SHIFT    3
 #define TXBSIDL(n)  (((n) * 0x10) + 0x30 + TXBSIDL_OFF)
@@ -197,68 +218,39 @@
 #define SET_BYTE(val, byte)			\
 	(((val) & 0xff) << ((byte) * 8))
 
-/*
- * Buffer size required for the largest SPI transfer (i.e., reading a
- * frame)
- */
-#define CAN_FRAME_MAX_DATA_LEN	8
-#define SPI_TRANSFER_BUF_LEN	(6 + CAN_FRAME_MAX_DATA_LEN)
 #define CAN_FRAME_MAX_BITS	128
 
-#define TX_ECHO_SKB_MAX	1
+#define TX_ECHO_SKB_MAX	TXB_NUM
 
 #define MCP251X_OST_DELAY_MS	(5)
 
-#define DEVICE_NAME "mcp2515-banged"
-
-#define GPIO_MISO	0
-#define GPIO_MOSI	1
-#define GPIO_CLK	2
-#define GPIO_CS		3
-#define GPIO_INT	4
-
-#ifdef MT7688
-#define GPIO_START_ADDR	0x10000600
-#define GPIO_SIZE	0xB0
-#define GPIO_OFFS_READ	0x20
-#define GPIO_OFFS_SET	0x30
-#define GPIO_OFFS_CLEAR	0x40
-#endif
-
-#ifdef RT305X
-#define GPIO_START_ADDR	0x10000600
-#define GPIO_SIZE	0x40
-#define GPIO_OFFS_READ	0x20
-#define GPIO_OFFS_SET	0x2C
-#define GPIO_OFFS_CLEAR	0x30
-#endif
-
-
-void __iomem *gpio_addr = NULL;
-void __iomem *gpio_readdata_addr = NULL;
-void __iomem *gpio_setdataout_addr = NULL;
-void __iomem *gpio_cleardataout_addr = NULL;
-
 /* static int gpios [] = {20, 19, 18, 7, 6}; */
-static int gpios [] = {6, 5, 4, 3, 14};
+int gpios [] = {6, 5, 4, 3, 14};
 static int gpio_count;
 module_param_array(gpios, int, &gpio_count, 0);
 MODULE_PARM_DESC(gpios, "used GPIOS for MISO, MOSI, CLK, CS and INT");
 
-void gpio_set(int gpio, int value) {
-	if (value)
-		*(volatile unsigned long *)gpio_setdataout_addr = 1 << gpio;
-	else
-		*(volatile unsigned long *)gpio_cleardataout_addr = 1 << gpio;
-}
+static char *transport = "mmio";
+module_param(transport, charp, 0444);
+MODULE_PARM_DESC(transport, "SPI transport: mmio (raw GPIO registers), gpio (gpiolib) or spi (spi_sync)");
 
-uint8_t gpio_get(int gpio) {
-	uint32_t val;
-	val = __raw_readl(gpio_readdata_addr);
-	if (val & ( 1 << gpio))
-		return 1;
-	return 0;
-}
+static int bus_cpu = -1;
+module_param(bus_cpu, int, 0444);
+MODULE_PARM_DESC(bus_cpu, "do the SPI transfers in a SCHED_FIFO thread pinned to this CPU (-1 = in the irq handler)");
+
+static int bus_prio = 50;
+module_param(bus_prio, int, 0444);
+MODULE_PARM_DESC(bus_prio, "SCHED_FIFO priority of the bus thread (kernel < 5.9)");
+
+static int napi_cpu = -1;
+module_param(napi_cpu, int, 0444);
+MODULE_PARM_DESC(napi_cpu, "CPU for the NAPI poll in bus thread mode (-1 = any other online CPU)");
+
+static const struct mcp2515_transport *mcp2515_transports[] = {
+	&mcp2515_mmio_transport,
+	&mcp2515_gpio_transport,
+	&mcp2515_spi_transport,
+};
 
 static const struct can_bittiming_const mcp2515_bittiming_const = {
 	.name = DEVICE_NAME,
@@ -272,134 +264,94 @@ static const struct can_bittiming_const mcp2515_bittiming_const = {
 	.brp_inc = 1,
 };
 
-enum mcp2515_model {
-	CAN_MCP251X_MCP2515	= 0x2515,
-};
-
-struct mcp2515_priv {
-	struct can_priv	   can;
-	struct net_device *net;
-	struct spi_device *spi;
-	enum mcp2515_model model;
-
-	struct mutex mcp_lock; /* SPI device lock */
-
-	u8 *spi_tx_buf;
-	u8 *spi_rx_buf;
-	int irq;
-
-	struct sk_buff *tx_skb;
-	int tx_len;
-
-	struct work_struct tx_work;
-	struct work_struct restart_work;
-
-	int force_quit;
-	int after_suspend;
-#define AFTER_SUSPEND_UP 1
-#define AFTER_SUSPEND_DOWN 2
-#define AFTER_SUSPEND_POWER 4
-#define AFTER_SUSPEND_RESTART 8
-	int restart_tx;
-	struct clk *clk;
-};
-
 static void mcp2515_clean(struct net_device *net)
 {
 	struct mcp2515_priv *priv = netdev_priv(net);
+	int i;
+
+	for (i = 0; i < TXB_NUM; i++) {
+		if (priv->tx_skb[i] || priv->tx_len[i])
+			net->stats.tx_errors++;
+		if (priv->tx_skb[i])
+			dev_kfree_skb(priv->tx_skb[i]);
+		if (priv->tx_len[i])
+			can_free_echo_skb(priv->net, i);
+		priv->tx_skb[i] = NULL;
+		priv->tx_len[i] = 0;
+	}
+	priv->tx_rts = 0;
+	priv->tx_busy = 0;
+}
 
-	if (priv->tx_skb || priv->tx_len)
-		net->stats.tx_errors++;
-	if (priv->tx_skb)
-		dev_kfree_skb(priv->tx_skb);
-	if (priv->tx_len)
-		can_free_echo_skb(priv->net, 0);
-	priv->tx_skb = NULL;
-	priv->tx_len = 0;
+static inline int mcp2515_spi_trans(struct mcp2515_priv *priv, int len) {
+	priv->spi_bytes += len;
+	return priv->xport->trans(priv, len);
 }
 
-static int mcp2515_spi_trans(struct mcp2515_priv *priv, int len) {
+static inline int mcp2515_spi_rxbuf(struct mcp2515_priv *priv) {
 	int ret;
-	int i, j;
-	uint8_t data_in, data_out;
-	ret = 0;
-
-	gpio_set(gpios[GPIO_CS], 0);
-
-	/* MSB first */
-	for (i = 0; i < len; i++) {
-		data_out = priv->spi_tx_buf[i];
-		data_in = 0;
-		for (j = 0; j < 8; j++) {
-			data_in  <<= 1;
-			/* master data is valid on the rising edge */
-			if (data_out & 0x80)
-				gpio_set(gpios[GPIO_MOSI],1);
-			else
-				gpio_set(gpios[GPIO_MOSI],0);
-
-			gpio_set(gpios[GPIO_CLK], 1);
-			data_out <<= 1;
-			/* slave data seems to be valid here */
-			if (gpio_get(gpios[GPIO_MISO]))
-				data_in |= 0x01;
-
-			gpio_set(gpios[GPIO_CLK], 0);
-		}
-		priv->spi_rx_buf[i] = data_in;
-	}
-	/* udelay(1); */
-	gpio_set(gpios[GPIO_CS], 1);
+
+	ret = priv->xport->rxbuf(priv);
+	if (ret > 0)
+		priv->spi_bytes += ret;
+
 	return ret;
 }
 
-static int mcp2515_spi_rxbuf(struct mcp2515_priv *priv) {
+int mcp2515_rxbuf_len(const u8 *buf) {
+	return RXBDAT_OFF + min(buf[RXBDLC_OFF] & RXBDLC_LEN_MASK,
+				CAN_FRAME_MAX_DATA_LEN);
+}
+
+int mcp2515_request_spi_gpios(void) {
 	int ret;
-	int i, j, dlc = 8;
-	uint8_t data_in, data_out;
-	ret = 0;
-
-	data_out = priv->spi_tx_buf[0];
-
-	gpio_set(gpios[GPIO_CS], 0);
-	for (i = 0; i < SPI_TRANSFER_BUF_LEN; i++) {
-		data_in = 0;
-		for (j = 0; j < 8; j++) {
-			/* only first byte to send */
-			if ( i < 1 ) {
-				/* master data is valid on the rising edge */
-				if (data_out & 0x80)
-					gpio_set(gpios[GPIO_MOSI],1);
-				else
-					gpio_set(gpios[GPIO_MOSI],0);
-				data_out <<= 1;
-			}
 
-			data_in <<= 1;
-			gpio_set(gpios[GPIO_CLK], 1);
-			/* slave data ssems to be valid here */
-			if (gpio_get(gpios[GPIO_MISO]))
-				data_in |= 0x01;
+	ret = gpio_request_one(gpios[GPIO_MISO], GPIOF_IN, "MCP2515 MISO");
+	if (ret) {
+		printk(KERN_ERR "can't get MISO pin GPIO%d\n", gpios[GPIO_MISO]);
+		return ret;
+	}
+	printk(KERN_INFO "requested GPIO%d for MISO\n", gpios[GPIO_MISO]);
 
-			gpio_set(gpios[GPIO_CLK], 0);
-		}
-		priv->spi_rx_buf[i] = data_in;
-		/* read DLC */
-		if (i==5)
-			dlc = data_in & 0x0f;
-		/* exit loop if we reached the DLC value */
-		if ((i - 5) >= dlc)
-			break;
+	ret = gpio_request_one(gpios[GPIO_MOSI], GPIOF_OUT_INIT_HIGH, "MCP2515 MOSI");
+	if (ret) {
+		printk(KERN_ERR "can't get MOSI pin GPIO%d\n", gpios[GPIO_MOSI]);
+		goto out_mosi;
 	}
+	printk(KERN_INFO "requested GPIO%d for MOSI\n", gpios[GPIO_MOSI]);
 
-	/* udelay(1); */
-	gpio_set(gpios[GPIO_CS], 1);
-	return ret;
-}
+	ret = gpio_request_one(gpios[GPIO_CLK], GPIOF_OUT_INIT_LOW, "MCP2515 CLK");
+	if (ret) {
+		printk(KERN_ERR "can't get CLK pin GPIO%d\n", gpios[GPIO_CLK]);
+		goto out_clk;
+	}
+
+	ret = gpio_request_one(gpios[GPIO_CS], GPIOF_OUT_INIT_HIGH, "MCP2515 CS");
+	if (ret) {
+		printk(KERN_ERR "can't get CS pin GPIO%d\n", gpios[GPIO_CS]);
+		goto out_cs;
+	}
+
+	return 0;
 
+out_cs:
+	gpio_free(gpios[GPIO_CLK]);
 
+out_clk:
+	gpio_free(gpios[GPIO_MOSI]);
 
+out_mosi:
+	gpio_free(gpios[GPIO_MISO]);
 
+	return ret;
+}
+
+void mcp2515_free_spi_gpios(void) {
+	gpio_free(gpios[GPIO_CS]);
+	gpio_free(gpios[GPIO_CLK]);
+	gpio_free(gpios[GPIO_MOSI]);
+	gpio_free(gpios[GPIO_MISO]);
+}
 
 static u8 mcp2515_read_reg(struct mcp2515_priv *priv, uint8_t reg) {
 	u8 val = 0;
@@ -425,6 +377,17 @@ static void mcp2515_read_2regs(struct mcp2515_priv *priv, uint8_t reg, uint8_t *
 	*v2 = priv->spi_rx_buf[3];
 }
 
+/* RXnIF, TXnIF and TXREQ in a single 2 byte transfer */
+static u8 mcp2515_read_status(struct mcp2515_priv *priv) {
+
+	priv->spi_tx_buf[0] = INSTRUCTION_READ_STATUS;
+	priv->spi_tx_buf[1] = 0;
+
+	mcp2515_spi_trans(priv, 2);
+
+	return priv->spi_rx_buf[1];
+}
+
 static void mcp2515_write_reg(struct mcp2515_priv *priv, u8 reg, uint8_t val) {
 
 	priv->spi_tx_buf[0] = INSTRUCTION_WRITE;
@@ -453,6 +416,12 @@ static void mcp2515_hw_tx(struct mcp2515_priv *priv, struct can_frame *frame, in
 	u32 sid, eid, exide, rtr;
 	u8 buf[SPI_TRANSFER_BUF_LEN];
 
+	/* LOAD TX BUFFER starts at SIDH - TXP needs a write of its own */
+	if (priv->tx_ctrl[tx_buf_idx] != priv->tx_prio[tx_buf_idx]) {
+		priv->tx_ctrl[tx_buf_idx] = priv->tx_prio[tx_buf_idx];
+		mcp2515_write_reg(priv, TXBCTRL(tx_buf_idx), priv->tx_ctrl[tx_buf_idx]);
+	}
+
 	exide = (frame->can_id & CAN_EFF_FLAG) ? 1 : 0; /* Extended ID Enable */
 	if (exide)
 		sid = (frame->can_id & CAN_EFF_MASK) >> 18;
@@ -471,32 +440,20 @@ static void mcp2515_hw_tx(struct mcp2515_priv *priv, struct can_frame *frame, in
 	buf[TXBDLC_OFF] = (rtr << DLC_RTR_SHIFT) | frame->can_dlc;
 	memcpy(buf + TXBDAT_OFF, frame->data, frame->can_dlc);
 	mcp2515_hw_tx_frame(priv, buf, frame->can_dlc, tx_buf_idx);
-
-	/* use INSTRUCTION_RTS, to avoid "repeated frame problem" */
-	priv->spi_tx_buf[0] = INSTRUCTION_RTS(1 << tx_buf_idx);
-	mcp2515_spi_trans(priv, 1);
 }
 
-static void mcp2515_hw_rx(struct mcp2515_priv *priv, int buf_idx) {
+/* skb from the bytes of a READ RX BUFFER transfer */
+static struct sk_buff *mcp2515_rx_skb(struct mcp2515_priv *priv, const u8 *buf) {
 	struct sk_buff *skb;
 	struct can_frame *frame;
-	u8 buf[SPI_TRANSFER_BUF_LEN];
 
 	skb = alloc_can_skb(priv->net, &frame);
 	if (!skb) {
 		/* dev_err(&spi->dev, "cannot allocate RX skb\n"); */
 		priv->net->stats.rx_dropped++;
-		return;
+		return NULL;
 	}
 
-	memset(priv->spi_tx_buf, 0, SPI_TRANSFER_BUF_LEN);
-
-	priv->spi_tx_buf[RXBCTRL_OFF] = INSTRUCTION_READ_RXB(buf_idx);
-	/* mcp2515_spi_trans(priv, SPI_TRANSFER_BUF_LEN); */
-	/* read only DLC data length */
-	mcp2515_spi_rxbuf(priv);
-	memcpy(buf, priv->spi_rx_buf, SPI_TRANSFER_BUF_LEN);
-
 	if (buf[RXBSIDL_OFF] & RXBSIDL_IDE) {
 		/* Extended ID format */
 		frame->can_id = CAN_EFF_FLAG;
@@ -526,7 +483,41 @@ static void mcp2515_hw_rx(struct mcp2515_priv *priv, int buf_idx) {
 	priv->net->stats.rx_packets++;
 	priv->net->stats.rx_bytes += frame->can_dlc;
 
-	netif_rx_ni(skb);
+	return skb;
+}
+
+/* bus thread mode: the raw bytes go to NAPI */
+static void mcp2515_rx_ring_push(struct mcp2515_priv *priv) {
+	struct mcp2515_rx_ring *ring = &priv->rx_ring;
+	unsigned int head = ring->head;
+
+	if (head - smp_load_acquire(&ring->tail) >= MCP2515_RING_SIZE) {
+		atomic_inc(&priv->rx_ring_drops);
+		return;
+	}
+	memcpy(ring->rec[head & (MCP2515_RING_SIZE - 1)],
+	       priv->spi_rx_buf + RXBSIDH_OFF, MCP2515_RX_REC_LEN);
+	smp_store_release(&ring->head, head + 1);
+}
+
+static void mcp2515_hw_rx(struct mcp2515_priv *priv, int buf_idx) {
+	struct sk_buff *skb;
+
+	memset(priv->spi_tx_buf, 0, SPI_TRANSFER_BUF_LEN);
+
+	priv->spi_tx_buf[RXBCTRL_OFF] = INSTRUCTION_READ_RXB(buf_idx);
+	/* mcp2515_spi_trans(priv, SPI_TRANSFER_BUF_LEN); */
+	/* read only DLC data length - this also clears RXnIF */
+	mcp2515_spi_rxbuf(priv);
+
+	if (priv->bus_task) {
+		mcp2515_rx_ring_push(priv);
+		return;
+	}
+
+	skb = mcp2515_rx_skb(priv, priv->spi_rx_buf);
+	if (skb)
+		netif_rx_ni(skb);
 }
 
 static void mcp2515_hw_sleep(struct mcp2515_priv *priv)
@@ -534,40 +525,177 @@ static void mcp2515_hw_sleep(struct mcp2515_priv *priv)
 	mcp2515_write_reg(priv, CANCTRL, CANCTRL_REQOP_SLEEP);
 }
 
+/*
+ * load the waiting skbs - with rts all loaded buffers are started
+ * with a single RTS
+ */
+static void __mcp2515_tx_skb(struct mcp2515_priv *priv, bool rts)
+{
+	struct net_device *net = priv->net;
+	struct can_frame *frame;
+	int i;
+
+	for (i = 0; i < TXB_NUM; i++) {
+		if (!priv->tx_skb[i])
+			continue;
+		if (priv->can.state == CAN_STATE_BUS_OFF) {
+			mcp2515_clean(net);
+			break;
+		}
+		frame = (struct can_frame *)priv->tx_skb[i]->data;
+
+		if (frame->can_dlc > CAN_FRAME_MAX_DATA_LEN)
+			frame->can_dlc = CAN_FRAME_MAX_DATA_LEN;
+		mcp2515_hw_tx(priv, frame, i);
+		priv->tx_len[i] = 1 + frame->can_dlc;
+		can_put_echo_skb(priv->tx_skb[i], net, i);
+		priv->tx_skb[i] = NULL;
+		priv->tx_rts |= 1 << i;
+	}
+	if (rts && priv->tx_rts) {
+		/* use INSTRUCTION_RTS, to avoid "repeated frame problem" */
+		priv->spi_tx_buf[0] = INSTRUCTION_RTS(priv->tx_rts);
+		mcp2515_spi_trans(priv, 1);
+		priv->tx_rts = 0;
+	}
+}
+
+static void mcp2515_tx_skb(struct mcp2515_priv *priv, bool rts)
+{
+	mutex_lock(&priv->mcp_lock);
+	__mcp2515_tx_skb(priv, rts);
+	mutex_unlock(&priv->mcp_lock);
+}
+
+/* transports that sleep can't transfer from the xmit path */
+static void mcp2515_tx_work_handler(struct work_struct *ws)
+{
+	struct mcp2515_priv *priv = container_of(ws, struct mcp2515_priv,
+						 tx_work);
+
+	mcp2515_tx_skb(priv, true);
+}
+
+/* hand the reserved buffers to the hardware - more: another frame follows */
+static void mcp2515_tx_kick(struct mcp2515_priv *priv, bool more)
+{
+	if (priv->xport->sleeps) {
+		if (!more)
+			schedule_work(&priv->tx_work);
+	} else {
+		mcp2515_tx_skb(priv, !more);
+	}
+}
+
+/* TXP from the CAN ID - the lower the ID the higher the priority */
+static u8 mcp2515_tx_prio(canid_t can_id)
+{
+	if (can_id & CAN_EFF_FLAG)
+		return TXBCTRL_TXP_MASK - ((can_id & CAN_EFF_MASK) >> 27);
+
+	return TXBCTRL_TXP_MASK - ((can_id & CAN_SFF_MASK) >> 9);
+}
+
+/*
+ * the MCP2515 sends the buffer with the highest TXP first, on equal TXP
+ * the one with the highest number. A frame must not overtake a frame of
+ * the same TXP, so it gets the highest free buffer below all of them.
+ */
+static int mcp2515_tx_find_buf(struct mcp2515_priv *priv, u8 prio)
+{
+	int i, idx = -1;
+
+	for (i = TXB_NUM - 1; i >= 0; i--) {
+		if (!test_bit(i, &priv->tx_busy)) {
+			if (idx < 0)
+				idx = i;
+		} else if (priv->tx_prio[i] == prio) {
+			idx = -1;
+		}
+	}
+
+	return idx;
+}
+
+static void mcp2515_bus_kick(struct mcp2515_priv *priv, int event)
+{
+	set_bit(event, &priv->bus_events);
+	wake_up_process(priv->bus_task);
+}
+
+/* bus thread mode: the bus thread picks the TX buffer */
+static netdev_tx_t mcp2515_bus_xmit(struct sk_buff *skb, struct net_device *net)
+{
+	struct mcp2515_priv *priv = netdev_priv(net);
+	struct mcp2515_tx_ring *ring = &priv->tx_ring;
+	unsigned int head = ring->head;
+
+	ring->skb[head & (MCP2515_RING_SIZE - 1)] = skb;
+	smp_store_release(&ring->head, ++head);
+
+	if (head - smp_load_acquire(&ring->tail) >= MCP2515_RING_SIZE) {
+		netif_stop_queue(net);
+		/* the bus thread may have made room in the meantime */
+		if (head - smp_load_acquire(&ring->tail) < MCP2515_RING_SIZE)
+			netif_wake_queue(net);
+	}
+
+	mcp2515_bus_kick(priv, BUS_EV_TX);
+
+	return NETDEV_TX_OK;
+}
+
 static netdev_tx_t mcp2515_hard_start_xmit(struct sk_buff *skb, struct net_device *net)
 {
 	struct mcp2515_priv *priv = netdev_priv(net);
 	struct can_frame *frame;
+	bool more;
+	u8 prio;
+	int idx;
+
+	if (can_dropped_invalid_skb(net, skb)) {
+		/* the RTS of an xmit_more batch may still be pending */
+		if (!priv->bus_task)
+			mcp2515_tx_kick(priv, false);
+		return NETDEV_TX_OK;
+	}
+
+	if (priv->bus_task)
+		return mcp2515_bus_xmit(skb, net);
 
-	/* printk(KERN_INFO "%s\n", __func__); */
-	if (priv->tx_skb || priv->tx_len) {
-		/* dev_warn(&spi->dev, "hard_xmit called while tx busy\n"); */
-		printk(KERN_INFO "%s: hard_xmit called while tx busy\n", __func__);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+	more = netdev_xmit_more();
+#else
+	more = skb->xmit_more;
+#endif
+	frame = (struct can_frame *)skb->data;
+	prio = mcp2515_tx_prio(frame->can_id);
+
+	idx = mcp2515_tx_find_buf(priv, prio);
+	if (idx < 0) {
+		/* only buffers a frame of this priority can't use are free */
+		mcp2515_tx_kick(priv, false);
+		netif_stop_queue(net);
+		if (mcp2515_tx_find_buf(priv, prio) >= 0)
+			netif_wake_queue(net);
 		return NETDEV_TX_BUSY;
 	}
 
-	if (can_dropped_invalid_skb(net, skb))
-		return NETDEV_TX_OK;
-
-	netif_stop_queue(net);
-	priv->tx_skb = skb;
+	priv->tx_prio[idx] = prio;
+	priv->tx_skb[idx] = skb;
+	set_bit(idx, &priv->tx_busy);
 
-	mutex_lock(&priv->mcp_lock);
-	if (priv->tx_skb) {
-		if (priv->can.state == CAN_STATE_BUS_OFF) {
-			mcp2515_clean(net);
-		} else {
-			frame = (struct can_frame *)priv->tx_skb->data;
-
-			if (frame->can_dlc > CAN_FRAME_MAX_DATA_LEN)
-				frame->can_dlc = CAN_FRAME_MAX_DATA_LEN;
-			mcp2515_hw_tx(priv, frame, 0);
-			priv->tx_len = 1 + frame->can_dlc;
-			can_put_echo_skb(priv->tx_skb, net, 0);
-			priv->tx_skb = NULL;
-		}
+	/* keep the queue running while any buffer is free */
+	if (find_first_zero_bit(&priv->tx_busy, TXB_NUM) >= TXB_NUM) {
+		netif_stop_queue(net);
+		/* the irq may have freed one in the meantime */
+		if (find_first_zero_bit(&priv->tx_busy, TXB_NUM) < TXB_NUM)
+			netif_wake_queue(net);
+		else
+			more = false;
 	}
-	mutex_unlock(&priv->mcp_lock);
+
+	mcp2515_tx_kick(priv, more);
 
 	return NETDEV_TX_OK;
 }
@@ -670,10 +798,11 @@ static int mcp2515_hw_reset(struct mcp2515_priv *priv) {
 
 	/* Wait for oscillator startup timer after reset */
 	mdelay(MCP251X_OST_DELAY_MS);
-	
-	gpio_set(gpios[GPIO_CS], 0);
+
+	/* TXBnCTRL are 0 after reset */
+	memset(priv->tx_ctrl, 0, sizeof(priv->tx_ctrl));
+
 	reg = mcp2515_read_reg(priv, CANSTAT);
-	gpio_set(gpios[GPIO_CS], 1);
 	printk(KERN_INFO "%s: CANSTAT 0x%02x\n", __func__, reg);
 	if ((reg & CANCTRL_REQOP_MASK) != CANCTRL_REQOP_CONF)
 		return -ENODEV;
@@ -711,8 +840,11 @@ static void mcp2515_open_clean(struct net_device *net) {
 	close_candev(net);
 }
 
+static void mcp2515_bus_stop(struct mcp2515_priv *priv);
+
 static int mcp2515_stop(struct net_device *net) {
 	struct mcp2515_priv *priv = netdev_priv(net);
+	int i;
 
 	printk(KERN_INFO "%s\n", __func__);
 	close_candev(net);
@@ -720,6 +852,8 @@ static int mcp2515_stop(struct net_device *net) {
 	priv->force_quit = 1;
 
 	free_irq(priv->irq, priv);
+	mcp2515_bus_stop(priv);
+	cancel_work_sync(&priv->tx_work);
 
 	mutex_lock(&priv->mcp_lock);
 
@@ -727,7 +861,8 @@ static int mcp2515_stop(struct net_device *net) {
 	mcp2515_write_reg(priv, CANINTE, 0x00);
 	mcp2515_write_reg(priv, CANINTF, 0x00);
 
-	mcp2515_write_reg(priv, TXBCTRL(0), 0);
+	for (i = 0; i < TXB_NUM; i++)
+		mcp2515_write_reg(priv, TXBCTRL(i), 0);
 	mcp2515_clean(net);
 
 	priv->can.state = CAN_STATE_STOPPED;
@@ -751,34 +886,6 @@ static void mcp2515_error_skb(struct net_device *net, int can_id, int data1) {
 	}
 }
 
-#if 0
-static void mcp2515_tx_work_handler(struct work_struct *ws)
-{
-	struct mcp2515_priv *priv = container_of(ws, struct mcp2515_priv,
-						 tx_work);
-	/* struct spi_device *spi = priv->spi; */
-	struct net_device *net = priv->net;
-	struct can_frame *frame;
-
-	mutex_lock(&priv->mcp_lock);
-	if (priv->tx_skb) {
-		if (priv->can.state == CAN_STATE_BUS_OFF) {
-			mcp2515_clean(net);
-		} else {
-			frame = (struct can_frame *)priv->tx_skb->data;
-
-			if (frame->can_dlc > CAN_FRAME_MAX_DATA_LEN)
-				frame->can_dlc = CAN_FRAME_MAX_DATA_LEN;
-			mcp2515_hw_tx(priv, frame, 0);
-			priv->tx_len = 1 + frame->can_dlc;
-			can_put_echo_skb(priv->tx_skb, net, 0);
-			priv->tx_skb = NULL;
-		}
-	}
-	mutex_unlock(&priv->mcp_lock);
-}
-#endif
-
 #if 0
 
 static void mcp2515_restart_work_handler(struct work_struct *ws)
@@ -787,6 +894,7 @@ static void mcp2515_restart_work_handler(struct work_struct *ws)
 						 restart_work);
 	struct spi_device *spi = priv->spi;
 	struct net_device *net = priv->net;
+	int i;
 
 	mutex_lock(&priv->mcp_lock);
 	if (priv->after_suspend) {
@@ -808,7 +916,8 @@ static void mcp2515_restart_work_handler(struct work_struct *ws)
 
 	if (priv->restart_tx) {
 		priv->restart_tx = 0;
-		mcp2515_write_reg(priv, TXBCTRL(0), 0);
+		for (i = 0; i < TXB_NUM; i++)
+			mcp2515_write_reg(priv, TXBCTRL(i), 0);
 		mcp2515_clean(net);
 		netif_wake_queue(net);
 		mcp2515_error_skb(net, CAN_ERR_RESTARTED, 0);
@@ -817,41 +926,91 @@ static void mcp2515_restart_work_handler(struct work_struct *ws)
 }
 #endif
 
-static irqreturn_t mcp2515_can_ist(int irq, void *dev_id) {
-	struct mcp2515_priv *priv = dev_id;
+/*
+ * map the TXnIF bits of READ STATUS to CANINTF
+ */
+static inline u8 mcp2515_status_to_txif(u8 status) {
+	u8 intf = 0;
+
+	if (status & READ_STATUS_TX0IF)
+		intf |= CANINTF_TX0IF;
+	if (status & READ_STATUS_TX1IF)
+		intf |= CANINTF_TX1IF;
+	if (status & READ_STATUS_TX2IF)
+		intf |= CANINTF_TX2IF;
+
+	return intf;
+}
+
+/*
+ * the irq loop is driven by READ STATUS (2 bytes) instead of reading
+ * CANINTF and EFLG (4 bytes). READ RX BUFFER clears RXnIF itself, so only
+ * TXnIF needs a BIT MODIFY. ERRIF is not part of READ STATUS - CANINTF and
+ * EFLG are read only if INT is still asserted without any rx or tx flag,
+ * or while the controller is not error active to follow the error state
+ * back down. The INT line is edge triggered, so the loop only ends after
+ * all flags are cleared.
+ */
+static void mcp2515_irq_loop(struct mcp2515_priv *priv) {
 	struct net_device *net = priv->net;
+	u64 spi_bytes;
 
-	mutex_lock(&priv->mcp_lock);
+	spi_bytes = priv->spi_bytes;
 	while (!priv->force_quit) {
 		enum can_state new_state;
-		u8 intf, eflag;
-		u8 clear_intf = 0;
+		u8 status, intf, eflag;
 		int can_id = 0, data1 = 0;
+		int i;
 
-		mcp2515_read_2regs(priv, CANINTF, &intf, &eflag);
+		status = mcp2515_read_status(priv);
 
-		/* mask out flags we don't care about */
-		intf &= CANINTF_RX | CANINTF_TX | CANINTF_ERR;
-
-		/* receive buffer 0 */
-		if (intf & CANINTF_RX0IF) {
-			/*
-			 * Free one buffer ASAP
-			 * (The MCP2515 does this automatically.)
-			 */
+		/* receive buffer 0 - free one buffer ASAP */
+		if (status & READ_STATUS_RX0IF) {
 			mcp2515_hw_rx(priv, 0);
+			priv->irq_rx_frames++;
 		}
 
 		/* receive buffer 1 */
-		if (intf & CANINTF_RX1IF) {
+		if (status & READ_STATUS_RX1IF) {
 			mcp2515_hw_rx(priv, 1);
+			priv->irq_rx_frames++;
 		}
 
-		/* any error or tx interrupt we need to clear? */
-		if (intf & (CANINTF_ERR | CANINTF_TX))
-			clear_intf |= intf & (CANINTF_ERR | CANINTF_TX);
-		if (clear_intf)
-			mcp2515_write_bits(priv, CANINTF, clear_intf, 0x00);
+		intf = mcp2515_status_to_txif(status);
+		if (intf) {
+			mcp2515_write_bits(priv, CANINTF, intf, 0x00);
+
+			for (i = 0; i < TXB_NUM; i++) {
+				if (!(intf & (CANINTF_TX0IF << i)))
+					continue;
+				net->stats.tx_packets++;
+				if (priv->tx_len[i]) {
+					net->stats.tx_bytes += priv->tx_len[i] - 1;
+					can_get_echo_skb(net, i);
+					priv->tx_len[i] = 0;
+				}
+				clear_bit(i, &priv->tx_busy);
+			}
+			/* the bus thread wakes the queue from its TX ring */
+			if (!priv->bus_task)
+				netif_wake_queue(net);
+		}
+
+		if (status & (READ_STATUS_RX | READ_STATUS_TX))
+			continue;
+
+		/* nothing left in READ STATUS - only errors may be pending */
+		if (gpio_get_value(gpios[GPIO_INT]) &&
+		    priv->can.state == CAN_STATE_ERROR_ACTIVE)
+			break;
+
+		mcp2515_read_2regs(priv, CANINTF, &intf, &eflag);
+
+		/* mask out flags we don't care about */
+		intf &= CANINTF_ERR;
+
+		if (intf)
+			mcp2515_write_bits(priv, CANINTF, intf, 0x00);
 
 		if (eflag)
 			mcp2515_write_bits(priv, EFLG, eflag, 0x00);
@@ -924,20 +1083,205 @@ static irqreturn_t mcp2515_can_ist(int irq, void *dev_id) {
 
 		if (intf == 0)
 			break;
+	}
+	priv->irq_spi_bytes += priv->spi_bytes - spi_bytes;
+}
+
+static irqreturn_t mcp2515_can_ist(int irq, void *dev_id) {
+	struct mcp2515_priv *priv = dev_id;
+
+	mutex_lock(&priv->mcp_lock);
+	mcp2515_irq_loop(priv);
+	mutex_unlock(&priv->mcp_lock);
+	return IRQ_HANDLED;
+}
+
+/*
+ * bus thread mode
+ *
+ * a SCHED_FIFO thread pinned to bus_cpu owns the SPI: it runs the irq
+ * loop and loads the TX buffers without taking mcp_lock. Received frames
+ * are passed as raw READ RX BUFFER bytes through rx_ring to NAPI on
+ * napi_cpu, TX frames come from xmit through tx_ring.
+ */
+static irqreturn_t mcp2515_bus_irq(int irq, void *dev_id) {
+	struct mcp2515_priv *priv = dev_id;
+	struct task_struct *task = READ_ONCE(priv->bus_task);
+
+	/* events before the thread runs are handled at its start */
+	set_bit(BUS_EV_IRQ, &priv->bus_events);
+	if (task)
+		wake_up_process(task);
+
+	return IRQ_HANDLED;
+}
+
+/* move TX frames from the ring to free TX buffers */
+static void mcp2515_bus_tx(struct mcp2515_priv *priv) {
+	struct mcp2515_tx_ring *ring = &priv->tx_ring;
+	unsigned int head, tail = ring->tail;
+	struct sk_buff *skb;
+	u8 prio;
+	int idx;
+
+	head = smp_load_acquire(&ring->head);
+	while (tail != head) {
+		skb = ring->skb[tail & (MCP2515_RING_SIZE - 1)];
+		prio = mcp2515_tx_prio(((struct can_frame *)skb->data)->can_id);
+		/* next try after the TX interrupt */
+		idx = mcp2515_tx_find_buf(priv, prio);
+		if (idx < 0)
+			break;
+		priv->tx_prio[idx] = prio;
+		priv->tx_skb[idx] = skb;
+		set_bit(idx, &priv->tx_busy);
+		smp_store_release(&ring->tail, ++tail);
+	}
+	__mcp2515_tx_skb(priv, true);
+
+	if (netif_queue_stopped(priv->net) &&
+	    head - tail < MCP2515_RING_SIZE)
+		netif_wake_queue(priv->net);
+}
+
+static void mcp2515_napi_kick(struct irq_work *work) {
+	struct mcp2515_priv *priv = container_of(work, struct mcp2515_priv,
+						 napi_kick);
+
+	napi_schedule(&priv->napi);
+}
 
-		if (intf & CANINTF_TX) {
-			net->stats.tx_packets++;
-			net->stats.tx_bytes += priv->tx_len - 1;
-			if (priv->tx_len) {
-				can_get_echo_skb(net, 0);
-				priv->tx_len = 0;
+static int mcp2515_bus_thread(void *data) {
+	struct mcp2515_priv *priv = data;
+	unsigned long events;
+	unsigned int head;
+
+	while (!kthread_should_stop()) {
+		set_current_state(TASK_INTERRUPTIBLE);
+		events = xchg(&priv->bus_events, 0);
+		if (!events) {
+			schedule();
+			continue;
+		}
+		__set_current_state(TASK_RUNNING);
+
+		head = priv->rx_ring.head;
+		if (events & BIT(BUS_EV_IRQ))
+			mcp2515_irq_loop(priv);
+		mcp2515_bus_tx(priv);
+
+		if (priv->rx_ring.head != head) {
+#ifdef CONFIG_SMP
+			if (priv->napi_cpu != smp_processor_id()) {
+				irq_work_queue_on(&priv->napi_kick, priv->napi_cpu);
+				continue;
 			}
-			netif_wake_queue(net);
+#endif
+			irq_work_queue(&priv->napi_kick);
 		}
+	}
+	__set_current_state(TASK_RUNNING);
+
+	return 0;
+}
+
+static int mcp2515_napi_poll(struct napi_struct *napi, int budget) {
+	struct mcp2515_priv *priv = container_of(napi, struct mcp2515_priv,
+						 napi);
+	struct mcp2515_rx_ring *ring = &priv->rx_ring;
+	unsigned int head, tail = ring->tail;
+	u8 buf[SPI_TRANSFER_BUF_LEN];
+	struct sk_buff *skb;
+	int work_done = 0;
 
+	priv->net->stats.rx_dropped += atomic_xchg(&priv->rx_ring_drops, 0);
+
+	head = smp_load_acquire(&ring->head);
+	while (work_done < budget && tail != head) {
+		memcpy(buf + RXBSIDH_OFF, ring->rec[tail & (MCP2515_RING_SIZE - 1)],
+		       MCP2515_RX_REC_LEN);
+		smp_store_release(&ring->tail, ++tail);
+
+		skb = mcp2515_rx_skb(priv, buf);
+		if (skb)
+			netif_receive_skb(skb);
+		work_done++;
+	}
+
+	if (work_done < budget) {
+		napi_complete_done(napi, work_done);
+		/* the bus thread may have pushed after the last look */
+		if (smp_load_acquire(&ring->head) != tail)
+			napi_schedule(napi);
+	}
+
+	return work_done;
+}
+
+static int mcp2515_bus_start(struct mcp2515_priv *priv) {
+	struct sched_param __maybe_unused param = { .sched_priority = bus_prio };
+	struct task_struct *task;
+
+	if (bus_cpu >= nr_cpu_ids || !cpu_online(bus_cpu)) {
+		printk(KERN_ERR "bus_cpu %d is not online\n", bus_cpu);
+		return -EINVAL;
+	}
+	if (napi_cpu >= 0) {
+		priv->napi_cpu = napi_cpu;
+	} else {
+		priv->napi_cpu = cpumask_any_but(cpu_online_mask, bus_cpu);
+		/* single core */
+		if (priv->napi_cpu >= nr_cpu_ids)
+			priv->napi_cpu = bus_cpu;
+	}
+	if (priv->napi_cpu >= nr_cpu_ids || !cpu_online(priv->napi_cpu)) {
+		printk(KERN_ERR "napi_cpu %d is not online\n", priv->napi_cpu);
+		return -EINVAL;
+	}
+
+	priv->rx_ring.head = 0;
+	priv->rx_ring.tail = 0;
+	priv->tx_ring.head = 0;
+	priv->tx_ring.tail = 0;
+	atomic_set(&priv->rx_ring_drops, 0);
+
+	task = kthread_create(mcp2515_bus_thread, priv, "%s-bus", priv->net->name);
+	if (IS_ERR(task))
+		return PTR_ERR(task);
+	kthread_bind(task, bus_cpu);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 9, 0)
+	sched_set_fifo(task);
+#else
+	sched_setscheduler_nocheck(task, SCHED_FIFO, &param);
+#endif
+	printk(KERN_INFO "bus thread on CPU%d, NAPI on CPU%d\n", bus_cpu, priv->napi_cpu);
+
+	napi_enable(&priv->napi);
+	/* an INT edge during the setup may be lost */
+	set_bit(BUS_EV_IRQ, &priv->bus_events);
+	WRITE_ONCE(priv->bus_task, task);
+	wake_up_process(task);
+
+	return 0;
+}
+
+static void mcp2515_bus_stop(struct mcp2515_priv *priv) {
+	struct mcp2515_tx_ring *ring = &priv->tx_ring;
+
+	if (!priv->bus_task)
+		return;
+
+	kthread_stop(priv->bus_task);
+	priv->bus_task = NULL;
+	irq_work_sync(&priv->napi_kick);
+	napi_disable(&priv->napi);
+
+	/* frames the bus thread didn't take anymore */
+	while (ring->tail != ring->head) {
+		dev_kfree_skb(ring->skb[ring->tail & (MCP2515_RING_SIZE - 1)]);
+		priv->net->stats.tx_errors++;
+		ring->tail++;
 	}
-	mutex_unlock(&priv->mcp_lock);
-	return IRQ_HANDLED;
 }
 
 static int mcp2515_open(struct net_device *net) {
@@ -958,10 +1302,19 @@ static int mcp2515_open(struct net_device *net) {
 	mutex_lock(&priv->mcp_lock);
 
 	priv->force_quit = 0;
-	priv->tx_skb = NULL;
-	priv->tx_len = 0;
-
-	ret = request_irq(priv->irq, mcp2515_can_ist, flags, DEVICE_NAME, priv);
+	memset(priv->tx_skb, 0, sizeof(priv->tx_skb));
+	memset(priv->tx_len, 0, sizeof(priv->tx_len));
+	priv->tx_busy = 0;
+	priv->tx_rts = 0;
+
+	/* the hard irq does the transfers unless the transport sleeps */
+	if (bus_cpu >= 0)
+		ret = request_irq(priv->irq, mcp2515_bus_irq, flags, DEVICE_NAME, priv);
+	else if (priv->xport->sleeps)
+		ret = request_threaded_irq(priv->irq, NULL, mcp2515_can_ist,
+					   flags | IRQF_ONESHOT, DEVICE_NAME, priv);
+	else
+		ret = request_irq(priv->irq, mcp2515_can_ist, flags, DEVICE_NAME, priv);
 	if (ret) {
 		/* TODO */
 		/* dev_err(&spi->dev, "failed to acquire irq %d\n", spi->irq); */
@@ -984,6 +1337,13 @@ static int mcp2515_open(struct net_device *net) {
 		mcp2515_open_clean(net);
 		goto open_unlock;
 	}
+	if (bus_cpu >= 0) {
+		ret = mcp2515_bus_start(priv);
+		if (ret) {
+			mcp2515_open_clean(net);
+			goto open_unlock;
+		}
+	}
 
 	netif_wake_queue(net);
 
@@ -999,12 +1359,39 @@ static const struct net_device_ops mcp2515_netdev_ops = {
 	.ndo_change_mtu = can_change_mtu,
 };
 
+static ssize_t spi_stats_show(struct device *dev,
+			      struct device_attribute *attr, char *buf) {
+	struct mcp2515_priv *priv = netdev_priv(to_net_dev(dev));
+	u64 bytes, irq_bytes, rx_frames;
+
+	mutex_lock(&priv->mcp_lock);
+	bytes = priv->spi_bytes;
+	irq_bytes = priv->irq_spi_bytes;
+	rx_frames = priv->irq_rx_frames;
+	mutex_unlock(&priv->mcp_lock);
+
+	return sprintf(buf, "spi_bytes %llu\nirq_spi_bytes %llu\nirq_rx_frames %llu\n"
+		       "irq_spi_bytes_per_rx_frame %llu\n",
+		       bytes, irq_bytes, rx_frames,
+		       rx_frames ? div64_u64(irq_bytes, rx_frames) : 0);
+}
+static DEVICE_ATTR_RO(spi_stats);
+
+static struct attribute *mcp2515_attrs[] = {
+	&dev_attr_spi_stats.attr,
+	NULL,
+};
+
+static const struct attribute_group mcp2515_attr_group = {
+	.attrs = mcp2515_attrs,
+};
+
 static int mcp2515_can_probe(struct platform_device *pdev) {
 	struct mcp2515_priv *priv;
 
 	struct net_device *net;
 	struct clk *clk;
-	int freq, ret;
+	int freq, ret, i;
 
 	freq = 16000000;
 	printk(KERN_INFO "%s: started\n", __func__);
@@ -1015,6 +1402,7 @@ static int mcp2515_can_probe(struct platform_device *pdev) {
 		return -ENOMEM;
 
 	net->netdev_ops = &mcp2515_netdev_ops;
+	net->sysfs_groups[0] = &mcp2515_attr_group;
 	/* net->flags |= IFF_ECHO; */
 
 	priv = netdev_priv(net);
@@ -1028,42 +1416,30 @@ static int mcp2515_can_probe(struct platform_device *pdev) {
 
 	mutex_init(&priv->mcp_lock);
 
-	/* GPIO stuff */
-	ret = gpio_request_one(gpios[GPIO_MISO], GPIOF_IN, "MCP2515 MISO");
-        if (ret) {
-		printk(KERN_ERR "can't get MISO pin GPIO%d\n", gpios[GPIO_MISO]);
-                goto out_clock;
-	}
-	printk(KERN_INFO "requested GPIO%d for MISO\n", gpios[GPIO_MISO]);
-
-	ret = gpio_request_one(gpios[GPIO_MOSI], GPIOF_OUT_INIT_HIGH, "MCP2515 MOSI");
-        if (ret) {
-		printk(KERN_ERR "can't get MOSI pin GPIO%d\n", gpios[GPIO_MOSI]);
-                goto out_mosi;
-	}
-	printk(KERN_INFO "requested GPIO%d for MOSI\n", gpios[GPIO_MOSI]);
-
-	ret = gpio_request_one(gpios[GPIO_CLK], GPIOF_OUT_INIT_LOW, "MCP2515 CLK");
-        if (ret) {
-		printk(KERN_ERR "can't get CLK pin GPIO%d\n", gpios[GPIO_CLK]);
-                goto out_clk;
-	}
-
-	ret = gpio_request_one(gpios[GPIO_CS], GPIOF_OUT_INIT_HIGH, "MCP2515 CS");
-        if (ret) {
-		printk(KERN_ERR "can't get CS pin GPIO%d\n", gpios[GPIO_CS]);
-                goto out_cs;
+	/* the way to talk to the MCP2515 */
+	for (i = 0; i < ARRAY_SIZE(mcp2515_transports); i++)
+		if (!strcmp(transport, mcp2515_transports[i]->name))
+			priv->xport = mcp2515_transports[i];
+	if (!priv->xport) {
+		printk(KERN_ERR "unknown transport %s\n", transport);
+		ret = -EINVAL;
+		goto out_clock;
 	}
+	INIT_WORK(&priv->tx_work, mcp2515_tx_work_handler);
+	netif_napi_add(net, &priv->napi, mcp2515_napi_poll, NAPI_POLL_WEIGHT);
+	init_irq_work(&priv->napi_kick, mcp2515_napi_kick);
 
+	/* GPIO stuff */
 	ret = gpio_request_one(gpios[GPIO_INT], GPIOF_IN, "MCP2515 INT");
-        if (ret) {
+	if (ret) {
 		printk(KERN_ERR "can't get INT pin GPIO%d\n", gpios[GPIO_INT]);
-                goto out_int;
+		goto out_clock;
 	}
 
 	priv->irq=gpio_to_irq(gpios[GPIO_INT]);
 	if (priv->irq<0) {
 		printk(KERN_ERR "can't map GPIO %d to IRQ : error %d\n", gpios[GPIO_INT],  priv->irq);
+		ret = priv->irq;
 		goto out_int_irq;
 	}
 
@@ -1073,50 +1449,39 @@ static int mcp2515_can_probe(struct platform_device *pdev) {
 	/* Here is OK to not lock the MCP, no one knows about it yet */
 
 	priv->spi_tx_buf = kzalloc(SPI_TRANSFER_BUF_LEN, GFP_KERNEL);
-	if (!priv->spi_tx_buf) {
-		ret = -ENOMEM;
-		goto out_gpios;
-	}
 	priv->spi_rx_buf = kzalloc(SPI_TRANSFER_BUF_LEN, GFP_KERNEL);
-	if (!priv->spi_rx_buf) {
+	if (!priv->spi_tx_buf || !priv->spi_rx_buf) {
 		ret = -ENOMEM;
-		goto out_gpios;
+		goto out_bufs;
 	}
-	gpio_addr = ioremap(GPIO_START_ADDR, GPIO_SIZE);
-	gpio_readdata_addr     = gpio_addr + GPIO_OFFS_READ;
-	gpio_setdataout_addr   = gpio_addr + GPIO_OFFS_SET;
-	gpio_cleardataout_addr = gpio_addr + GPIO_OFFS_CLEAR;
 
-	printk(KERN_INFO "%s: mcp2515_hw_probe\n", __func__);
+	ret = priv->xport->init(priv);
+	if (ret)
+		goto out_bufs;
+
+	printk(KERN_INFO "%s: mcp2515_hw_probe via %s\n", __func__, priv->xport->name);
 	ret = mcp2515_hw_probe(priv);
 	if (ret)
-		goto out_gpios;
+		goto out_xport;
 
 	ret = register_candev(net);
 	if (ret)
-		goto out_gpios;
+		goto out_xport;
 
 	printk(KERN_INFO "%s: registered CAN device\n", __func__);
 
 	return 0;
 
-out_gpios:
+out_xport:
+	priv->xport->exit(priv);
+
+out_bufs:
+	kfree(priv->spi_rx_buf);
+	kfree(priv->spi_tx_buf);
 
 out_int_irq:
 	gpio_free(gpios[GPIO_INT]);
 
-out_int:
-	gpio_free(gpios[GPIO_CS]);
-
-out_cs:
-	gpio_free(gpios[GPIO_CLK]);
-
-out_clk:
-	gpio_free(gpios[GPIO_MOSI]);
-
-out_mosi:
-	gpio_free(gpios[GPIO_MISO]);
-
 out_clock:
 	free_candev(net);
 
@@ -1126,14 +1491,15 @@ out_clock:
 /* static int mcp2515_can_remove(struct spi_device *spi) */
 static int mcp2515_can_remove(struct platform_device *pdev)
 {
-	int i;
 	struct net_device *net_dev = platform_get_drvdata(pdev);
 	struct mcp2515_priv *priv = netdev_priv(net_dev);
 
 	printk(KERN_INFO "%s\n", __func__);
 	unregister_candev(net_dev);
-	for (i = 0; i < 5; i++)
-		gpio_free(gpios[i]);
+	priv->xport->exit(priv);
+	gpio_free(gpios[GPIO_INT]);
+	kfree(priv->spi_rx_buf);
+	kfree(priv->spi_tx_buf);
 
 	if (!IS_ERR(priv->clk))
 		clk_disable_unprepare(priv->clk);
@@ -0,0 +1,192 @@
+/*
+ * CAN bus driver for Microchip 251x CAN Controller - bit-banged variant
+ *
+ * SPI transport: bit-bang via the raw GPIO registers of MT7688 and RT305x
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ */
+
+#include <linux/delay.h>
+#include <linux/io.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+
+#include "mcp2515-banged.h"
+
+#ifdef MT7688
+#define GPIO_START_ADDR	0x10000600
+#define GPIO_SIZE	0xB0
+#define GPIO_OFFS_READ	0x20
+#define GPIO_OFFS_SET	0x30
+#define GPIO_OFFS_CLEAR	0x40
+#else /* RT305X */
+#define GPIO_START_ADDR	0x10000600
+#define GPIO_SIZE	0x40
+#define GPIO_OFFS_READ	0x20
+#define GPIO_OFFS_SET	0x2C
+#define GPIO_OFFS_CLEAR	0x30
+#endif
+
+static void __iomem *gpio_addr = NULL;
+static void __iomem *gpio_readdata_addr = NULL;
+static void __iomem *gpio_setdataout_addr = NULL;
+static void __iomem *gpio_cleardataout_addr = NULL;
+
+static unsigned int bit_period_ns;
+module_param(bit_period_ns, uint, 0644);
+MODULE_PARM_DESC(bit_period_ns, "SPI clock period in ns (0 = as fast as possible)");
+
+/*
+ * bit-bang engine
+ *
+ * the pin masks are computed once at probe time. MOSI is changed
+ * together with the falling CLK edge (the MCP2515 samples on the
+ * rising edge), so a bit costs:
+ * - one SET write for the rising edge
+ * - one read of MISO
+ * - one CLEAR write for the falling edge, which also clears MOSI
+ *   if the next bit is 0
+ * - one SET write for MOSI only if the next bit changes from 0 to 1
+ * The falling edge writes are looked up by (current bit << 1 | next bit).
+ */
+static struct {
+	u32 miso;
+	u32 mosi;
+	u32 clk;
+	u32 cs;
+	u32 fall_clear[4];
+	u32 fall_set[4];
+} bang;
+
+static void mcp2515_bang_init(void) {
+	int i;
+
+	bang.miso = 1 << gpios[GPIO_MISO];
+	bang.mosi = 1 << gpios[GPIO_MOSI];
+	bang.clk  = 1 << gpios[GPIO_CLK];
+	bang.cs   = 1 << gpios[GPIO_CS];
+
+	for (i = 0; i < 4; i++) {
+		/* next bit 0: clear MOSI with the clock */
+		bang.fall_clear[i] = bang.clk | ((i & 1) ? 0 : bang.mosi);
+		/* 0 -> 1: MOSI needs an extra write */
+		bang.fall_set[i] = (i == 1) ? bang.mosi : 0;
+	}
+}
+
+/* one clock cycle - idx selects the falling edge writes */
+static __always_inline u8 mcp2515_bang_bit(u8 in, u32 idx, unsigned int half) {
+	__raw_writel(bang.clk, gpio_setdataout_addr);
+	if (half)
+		ndelay(half);
+	in = (in << 1) | !!(__raw_readl(gpio_readdata_addr) & bang.miso);
+	__raw_writel(bang.fall_clear[idx], gpio_cleardataout_addr);
+	if (bang.fall_set[idx])
+		__raw_writel(bang.fall_set[idx], gpio_setdataout_addr);
+	if (half)
+		ndelay(half);
+
+	return in;
+}
+
+/* clock out one byte - MOSI already holds bit 7 of out */
+static __always_inline u8 mcp2515_bang_byte(u8 out, u8 next, unsigned int half) {
+	u32 window = (out << 8) | next;
+	u8 in = 0;
+
+	in = mcp2515_bang_bit(in, (window >> 14) & 3, half);
+	in = mcp2515_bang_bit(in, (window >> 13) & 3, half);
+	in = mcp2515_bang_bit(in, (window >> 12) & 3, half);
+	in = mcp2515_bang_bit(in, (window >> 11) & 3, half);
+	in = mcp2515_bang_bit(in, (window >> 10) & 3, half);
+	in = mcp2515_bang_bit(in, (window >>  9) & 3, half);
+	in = mcp2515_bang_bit(in, (window >>  8) & 3, half);
+	in = mcp2515_bang_bit(in, (window >>  7) & 3, half);
+
+	return in;
+}
+
+/* assert CS and set MOSI for the first bit */
+static __always_inline void mcp2515_bang_start(u8 first) {
+	if (first & 0x80) {
+		__raw_writel(bang.cs, gpio_cleardataout_addr);
+		__raw_writel(bang.mosi, gpio_setdataout_addr);
+	} else {
+		__raw_writel(bang.cs | bang.mosi, gpio_cleardataout_addr);
+	}
+}
+
+static __always_inline void mcp2515_bang_end(void) {
+	__raw_writel(bang.cs, gpio_setdataout_addr);
+}
+
+static int mcp2515_mmio_trans(struct mcp2515_priv *priv, int len) {
+	unsigned int half = bit_period_ns / 2;
+	u8 *tx = priv->spi_tx_buf;
+	u8 *rx = priv->spi_rx_buf;
+	int i;
+
+	/* MSB first */
+	mcp2515_bang_start(tx[0]);
+	for (i = 0; i < len - 1; i++)
+		rx[i] = mcp2515_bang_byte(tx[i], tx[i + 1], half);
+	rx[i] = mcp2515_bang_byte(tx[i], 0, half);
+	mcp2515_bang_end();
+
+	return 0;
+}
+
+static int mcp2515_mmio_rxbuf(struct mcp2515_priv *priv) {
+	unsigned int half = bit_period_ns / 2;
+	u8 *rx = priv->spi_rx_buf;
+	int i, len = SPI_TRANSFER_BUF_LEN;
+
+	/* only the first byte to send - then clock out zeros */
+	mcp2515_bang_start(priv->spi_tx_buf[0]);
+	rx[0] = mcp2515_bang_byte(priv->spi_tx_buf[0], 0, half);
+	for (i = 1; i < len; i++) {
+		rx[i] = mcp2515_bang_byte(0, 0, half);
+		/* stop after the data bytes once the DLC is known */
+		if (i == SPI_RXBUF_HEADER_LEN - 1)
+			len = mcp2515_rxbuf_len(rx);
+	}
+	mcp2515_bang_end();
+
+	return len;
+}
+
+static int mcp2515_mmio_init(struct mcp2515_priv *priv) {
+	int ret;
+
+	ret = mcp2515_request_spi_gpios();
+	if (ret)
+		return ret;
+
+	gpio_addr = ioremap(GPIO_START_ADDR, GPIO_SIZE);
+	if (!gpio_addr) {
+		mcp2515_free_spi_gpios();
+		return -ENOMEM;
+	}
+	gpio_readdata_addr     = gpio_addr + GPIO_OFFS_READ;
+	gpio_setdataout_addr   = gpio_addr + GPIO_OFFS_SET;
+	gpio_cleardataout_addr = gpio_addr + GPIO_OFFS_CLEAR;
+	mcp2515_bang_init();
+
+	return 0;
+}
+
+static void mcp2515_mmio_exit(struct mcp2515_priv *priv) {
+	iounmap(gpio_addr);
+	gpio_addr = NULL;
+	mcp2515_free_spi_gpios();
+}
+
+const struct mcp2515_transport mcp2515_mmio_transport = {
+	.name = "mmio",
+	.init = mcp2515_mmio_init,
+	.exit = mcp2515_mmio_exit,
+	.trans = mcp2515_mmio_trans,
+	.rxbuf = mcp2515_mmio_rxbuf,
+};
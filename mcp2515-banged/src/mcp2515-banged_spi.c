@@ -0,0 +1,88 @@
+/*
+ * CAN bus driver for Microchip 251x CAN Controller - bit-banged variant
+ *
+ * SPI transport: a real SPI master via spi_sync - the transfers sleep,
+ * so the core uses a threaded irq and a tx work in this case
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the version 2 of the GNU General Public License
+ * as published by the Free Software Foundation
+ */
+
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/spi/spi.h>
+
+#include "mcp2515-banged.h"
+
+static int spi_bus;
+module_param(spi_bus, int, 0444);
+MODULE_PARM_DESC(spi_bus, "SPI bus number for transport=spi");
+
+static int spi_cs;
+module_param(spi_cs, int, 0444);
+MODULE_PARM_DESC(spi_cs, "SPI chip select for transport=spi");
+
+static int spi_speed_hz = 10000000;
+module_param(spi_speed_hz, int, 0444);
+MODULE_PARM_DESC(spi_speed_hz, "SPI clock for transport=spi (MCP2515 max 10MHz)");
+
+static int mcp2515_spi_xfer(struct mcp2515_priv *priv, int len) {
+	struct spi_transfer t = {
+		.tx_buf = priv->spi_tx_buf,
+		.rx_buf = priv->spi_rx_buf,
+		.len = len,
+	};
+
+	return spi_sync_transfer(priv->spi, &t, 1);
+}
+
+/* the DLC is unknown until the transfer is done - always read all 8 bytes */
+static int mcp2515_spi_rxbuf(struct mcp2515_priv *priv) {
+	int ret;
+
+	ret = mcp2515_spi_xfer(priv, SPI_TRANSFER_BUF_LEN);
+
+	return ret ? ret : SPI_TRANSFER_BUF_LEN;
+}
+
+static int mcp2515_spi_init(struct mcp2515_priv *priv) {
+	struct spi_board_info info = {
+		.modalias = DEVICE_NAME,
+		.max_speed_hz = spi_speed_hz,
+		.bus_num = spi_bus,
+		.chip_select = spi_cs,
+		.mode = SPI_MODE_0,
+	};
+	struct spi_master *master;
+
+	master = spi_busnum_to_master(spi_bus);
+	if (!master) {
+		printk(KERN_ERR "can't find SPI bus %d\n", spi_bus);
+		return -ENODEV;
+	}
+
+	priv->spi = spi_new_device(master, &info);
+	put_device(&master->dev);
+	if (!priv->spi) {
+		printk(KERN_ERR "can't add SPI device %d.%d\n", spi_bus, spi_cs);
+		return -ENODEV;
+	}
+	printk(KERN_INFO "using SPI device %d.%d\n", spi_bus, spi_cs);
+
+	return 0;
+}
+
+static void mcp2515_spi_exit(struct mcp2515_priv *priv) {
+	spi_unregister_device(priv->spi);
+	priv->spi = NULL;
+}
+
+const struct mcp2515_transport mcp2515_spi_transport = {
+	.name = "spi",
+	.sleeps = true,
+	.init = mcp2515_spi_init,
+	.exit = mcp2515_spi_exit,
+	.trans = mcp2515_spi_xfer,
+	.rxbuf = mcp2515_spi_rxbuf,
+};
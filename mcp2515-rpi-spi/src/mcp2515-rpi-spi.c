@@ -46,6 +46,7 @@
 #include <linux/slab.h>
 #include <linux/gpio.h>
 #include <linux/spi/spi.h>
+#include <linux/version.h>
 
 /* SPI interface instruction set */
 #define INSTRUCTION_WRITE	0x02
@@ -54,11 +55,25 @@
 #define INSTRUCTION_LOAD_TXB(n)	(0x40 + 2 * (n))
 #define INSTRUCTION_READ_RXB(n)	(((n) == 0) ? 0x90 : 0x94)
 #define INSTRUCTION_RESET	0xC0
+#define INSTRUCTION_READ_STATUS	0xA0
+#define INSTRUCTION_RX_STATUS	0xB0
 #define RTS_TXB0		0x01
 #define RTS_TXB1		0x02
 #define RTS_TXB2		0x04
 #define INSTRUCTION_RTS(n)	(0x80 | ((n) & 0x07))
 
+/* READ STATUS response */
+#define READ_STATUS_RX0IF	0x01
+#define READ_STATUS_RX1IF	0x02
+#define READ_STATUS_TX0REQ	0x04
+#define READ_STATUS_TX0IF	0x08
+#define READ_STATUS_TX1REQ	0x10
+#define READ_STATUS_TX1IF	0x20
+#define READ_STATUS_TX2REQ	0x40
+#define READ_STATUS_TX2IF	0x80
+#define READ_STATUS_RX (READ_STATUS_RX0IF | READ_STATUS_RX1IF)
+#define READ_STATUS_TX (READ_STATUS_TX0IF | READ_STATUS_TX1IF | READ_STATUS_TX2IF)
+
 /* MPC251x registers */
 #define CANSTAT	      0x0e
 #define CANCTRL	      0x0f
@@ -117,6 +132,7 @@
 #define TXBCTRL_MLOA	0x20
 #define TXBCTRL_TXERR 0x10
 #define TXBCTRL_TXREQ 0x08
+#define TXBCTRL_TXP_MASK 0x03
 #define TXBSIDH(n)  (((n) * 0x10) + 0x30 + TXBSIDH_OFF)
 #define SIDH_SHIFT    3
 #define TXBSIDL(n)  (((n) * 0x10) + 0x30 + TXBSIDL_OFF)
@@ -181,7 +197,9 @@
 #define SPI_TRANSFER_BUF_LEN	(6 + CAN_FRAME_MAX_DATA_LEN)
 #define CAN_FRAME_MAX_BITS	128
 
-#define TX_ECHO_SKB_MAX	1
+/* TXB0..TXB2 */
+#define TXB_NUM	3
+#define TX_ECHO_SKB_MAX	TXB_NUM
 
 #define MCP251X_OST_DELAY_MS	(5)
 
@@ -640,8 +658,18 @@ struct mcp2515_priv {
     u8 *spi_rx_buf;
     int irq;
 
-    struct sk_buff *tx_skb;
-    int tx_len;
+    /*
+     * per TX buffer: the skb waiting to be loaded, the length of the
+     * loaded frame (0 = none), its TXP and the TXP in TXBnCTRL
+     */
+    struct sk_buff *tx_skb[TXB_NUM];
+    int tx_len[TXB_NUM];
+    u8 tx_prio[TXB_NUM];
+    u8 tx_ctrl[TXB_NUM];
+    /* buffers in use - bit n = TXBn, cleared from the irq */
+    unsigned long tx_busy;
+    /* loaded buffers waiting for the RTS */
+    u8 tx_rts;
 
     struct work_struct tx_work;
     struct work_struct restart_work;
@@ -654,19 +682,29 @@ struct mcp2515_priv {
 #define AFTER_SUSPEND_RESTART 8
     int restart_tx;
     struct clk *clk;
+
+    /* SPI bytes - in total and spent in the irq loop */
+    u64 spi_bytes;
+    u64 irq_spi_bytes;
+    u64 irq_rx_frames;
 };
 
 static void mcp2515_clean(struct net_device *net) {
     struct mcp2515_priv *priv = netdev_priv(net);
+    int i;
 
-    if (priv->tx_skb || priv->tx_len)
-	net->stats.tx_errors++;
-    if (priv->tx_skb)
-	dev_kfree_skb(priv->tx_skb);
-    if (priv->tx_len)
-	can_free_echo_skb(priv->net, 0);
-    priv->tx_skb = NULL;
-    priv->tx_len = 0;
+    for (i = 0; i < TXB_NUM; i++) {
+	if (priv->tx_skb[i] || priv->tx_len[i])
+	    net->stats.tx_errors++;
+	if (priv->tx_skb[i])
+	    dev_kfree_skb(priv->tx_skb[i]);
+	if (priv->tx_len[i])
+	    can_free_echo_skb(priv->net, i);
+	priv->tx_skb[i] = NULL;
+	priv->tx_len[i] = 0;
+    }
+    priv->tx_rts = 0;
+    priv->tx_busy = 0;
 }
 
 static int mcp2515_spi_trans(struct mcp2515_priv *priv, int len) {
@@ -674,6 +712,7 @@ static int mcp2515_spi_trans(struct mcp2515_priv *priv, int len) {
     int i, j;
     uint8_t data_in, data_out;
     ret = 0;
+    priv->spi_bytes += len;
 
     gpio_set(gpios[GPIO_CS], 0);
 
@@ -742,6 +781,7 @@ static int mcp2515_spi_rxbuf(struct mcp2515_priv *priv) {
 	if ((i - 5) >= dlc)
 	    break;
     }
+    priv->spi_bytes += min(i + 1, SPI_TRANSFER_BUF_LEN);
 
     /* udelay(1); */
     gpio_set(gpios[GPIO_CS], 1);
@@ -772,6 +812,17 @@ static void mcp2515_read_2regs(struct mcp2515_priv *priv, uint8_t reg, uint8_t *
     *v2 = priv->spi_rx_buf[3];
 }
 
+/* RXnIF, TXnIF and TXREQ in a single 2 byte transfer */
+static u8 mcp2515_read_status(struct mcp2515_priv *priv) {
+
+    priv->spi_tx_buf[0] = INSTRUCTION_READ_STATUS;
+    priv->spi_tx_buf[1] = 0;
+
+    mcp2515_spi_trans(priv, 2);
+
+    return priv->spi_rx_buf[1];
+}
+
 static void mcp2515_write_reg(struct mcp2515_priv *priv, u8 reg, uint8_t val) {
 
     priv->spi_tx_buf[0] = INSTRUCTION_WRITE;
@@ -800,6 +851,12 @@ static void mcp2515_hw_tx(struct mcp2515_priv *priv, struct can_frame *frame, in
     u32 sid, eid, exide, rtr;
     u8 buf[SPI_TRANSFER_BUF_LEN];
 
+    /* LOAD TX BUFFER starts at SIDH - TXP needs a write of its own */
+    if (priv->tx_ctrl[tx_buf_idx] != priv->tx_prio[tx_buf_idx]) {
+	priv->tx_ctrl[tx_buf_idx] = priv->tx_prio[tx_buf_idx];
+	mcp2515_write_reg(priv, TXBCTRL(tx_buf_idx), priv->tx_ctrl[tx_buf_idx]);
+    }
+
     exide = (frame->can_id & CAN_EFF_FLAG) ? 1 : 0;	/* Extended ID Enable */
     if (exide)
 	sid = (frame->can_id & CAN_EFF_MASK) >> 18;
@@ -817,10 +874,6 @@ static void mcp2515_hw_tx(struct mcp2515_priv *priv, struct can_frame *frame, in
     buf[TXBDLC_OFF] = (rtr << DLC_RTR_SHIFT) | frame->can_dlc;
     memcpy(buf + TXBDAT_OFF, frame->data, frame->can_dlc);
     mcp2515_hw_tx_frame(priv, buf, frame->can_dlc, tx_buf_idx);
-
-    /* use INSTRUCTION_RTS, to avoid "repeated frame problem" */
-    priv->spi_tx_buf[0] = INSTRUCTION_RTS(1 << tx_buf_idx);
-    mcp2515_spi_trans(priv, 1);
 }
 
 static void mcp2515_hw_rx(struct mcp2515_priv *priv, int buf_idx) {
@@ -832,6 +885,8 @@ static void mcp2515_hw_rx(struct mcp2515_priv *priv, int buf_idx) {
     if (!skb) {
 	/* dev_err(&spi->dev, "cannot allocate RX skb\n"); */
 	priv->net->stats.rx_dropped++;
+	/* drop the frame - nobody else clears RXnIF */
+	mcp2515_write_bits(priv, CANINTF, buf_idx ? CANINTF_RX1IF : CANINTF_RX0IF, 0x00);
 	return;
     }
 
@@ -875,39 +930,117 @@ static void mcp2515_hw_sleep(struct mcp2515_priv *priv) {
     mcp2515_write_reg(priv, CANCTRL, CANCTRL_REQOP_SLEEP);
 }
 
+/*
+ * load the waiting skbs - with rts all loaded buffers are started
+ * with a single RTS
+ */
+static void mcp2515_tx_skb(struct mcp2515_priv *priv, bool rts) {
+    struct net_device *net = priv->net;
+    struct can_frame *frame;
+    int i;
+
+    mutex_lock(&priv->mcp_lock);
+    for (i = 0; i < TXB_NUM; i++) {
+	if (!priv->tx_skb[i])
+	    continue;
+	if (priv->can.state == CAN_STATE_BUS_OFF) {
+	    mcp2515_clean(net);
+	    break;
+	}
+	frame = (struct can_frame *)priv->tx_skb[i]->data;
+
+	if (frame->can_dlc > CAN_FRAME_MAX_DATA_LEN)
+	    frame->can_dlc = CAN_FRAME_MAX_DATA_LEN;
+	mcp2515_hw_tx(priv, frame, i);
+	priv->tx_len[i] = 1 + frame->can_dlc;
+	can_put_echo_skb(priv->tx_skb[i], net, i);
+	priv->tx_skb[i] = NULL;
+	priv->tx_rts |= 1 << i;
+    }
+    if (rts && priv->tx_rts) {
+	/* use INSTRUCTION_RTS, to avoid "repeated frame problem" */
+	priv->spi_tx_buf[0] = INSTRUCTION_RTS(priv->tx_rts);
+	mcp2515_spi_trans(priv, 1);
+	priv->tx_rts = 0;
+    }
+    mutex_unlock(&priv->mcp_lock);
+}
+
+/* TXP from the CAN ID - the lower the ID the higher the priority */
+static u8 mcp2515_tx_prio(canid_t can_id) {
+    if (can_id & CAN_EFF_FLAG)
+	return TXBCTRL_TXP_MASK - ((can_id & CAN_EFF_MASK) >> 27);
+
+    return TXBCTRL_TXP_MASK - ((can_id & CAN_SFF_MASK) >> 9);
+}
+
+/*
+ * the MCP2515 sends the buffer with the highest TXP first, on equal TXP
+ * the one with the highest number. A frame must not overtake a frame of
+ * the same TXP, so it gets the highest free buffer below all of them.
+ */
+static int mcp2515_tx_find_buf(struct mcp2515_priv *priv, u8 prio) {
+    int i, idx = -1;
+
+    for (i = TXB_NUM - 1; i >= 0; i--) {
+	if (!test_bit(i, &priv->tx_busy)) {
+	    if (idx < 0)
+		idx = i;
+	} else if (priv->tx_prio[i] == prio) {
+	    idx = -1;
+	}
+    }
+
+    return idx;
+}
+
 static netdev_tx_t mcp2515_hard_start_xmit(struct sk_buff *skb, struct net_device *net) {
     struct mcp2515_priv *priv = netdev_priv(net);
     struct can_frame *frame;
+    bool more;
+    u8 prio;
+    int idx;
 
-    /* printk(KERN_INFO "%s\n", __func__); */
-    if (priv->tx_skb || priv->tx_len) {
-	/* dev_warn(&spi->dev, "hard_xmit called while tx busy\n"); */
-	printk(KERN_INFO "%s: hard_xmit called while tx busy\n", __func__);
-	return NETDEV_TX_BUSY;
+    if (can_dropped_invalid_skb(net, skb)) {
+	/* the RTS of an xmit_more batch may still be pending */
+	mcp2515_tx_skb(priv, true);
+	return NETDEV_TX_OK;
     }
 
-    if (can_dropped_invalid_skb(net, skb))
-	return NETDEV_TX_OK;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+    more = netdev_xmit_more();
+#else
+    more = skb->xmit_more;
+#endif
+    frame = (struct can_frame *)skb->data;
+    prio = mcp2515_tx_prio(frame->can_id);
+
+    idx = mcp2515_tx_find_buf(priv, prio);
+    if (idx < 0) {
+	/* only buffers a frame of this priority can't use are free */
+	mcp2515_tx_skb(priv, true);
+	netif_stop_queue(net);
+	if (mcp2515_tx_find_buf(priv, prio) >= 0)
+	    netif_wake_queue(net);
+	return NETDEV_TX_BUSY;
+    }
 
-    netif_stop_queue(net);
-    priv->tx_skb = skb;
+    priv->tx_prio[idx] = prio;
+    priv->tx_skb[idx] = skb;
+    set_bit(idx, &priv->tx_busy);
 
-    mutex_lock(&priv->mcp_lock);
-    if (priv->tx_skb) {
-	if (priv->can.state == CAN_STATE_BUS_OFF) {
-	    mcp2515_clean(net);
-	} else {
-	    frame = (struct can_frame *)priv->tx_skb->data;
-
-	    if (frame->can_dlc > CAN_FRAME_MAX_DATA_LEN)
-		frame->can_dlc = CAN_FRAME_MAX_DATA_LEN;
-	    mcp2515_hw_tx(priv, frame, 0);
-	    priv->tx_len = 1 + frame->can_dlc;
-	    can_put_echo_skb(priv->tx_skb, net, 0);
-	    priv->tx_skb = NULL;
-	}
+    /* keep the queue running while any buffer is free */
+    if (find_first_zero_bit(&priv->tx_busy, TXB_NUM) >= TXB_NUM) {
+	netif_stop_queue(net);
+	/* the irq may have freed one in the meantime */
+	if (find_first_zero_bit(&priv->tx_busy, TXB_NUM) < TXB_NUM)
+	    netif_wake_queue(net);
+	else
+	    more = false;
     }
-    mutex_unlock(&priv->mcp_lock);
+
+    /* the RTS waits for the next frame if the stack has one */
+    mcp2515_tx_skb(priv, !more);
 
     return NETDEV_TX_OK;
 }
@@ -1007,6 +1140,9 @@ static int mcp2515_hw_reset(struct mcp2515_priv *priv) {
     /* Wait for oscillator startup timer after reset */
     mdelay(MCP251X_OST_DELAY_MS);
 
+    /* TXBnCTRL are 0 after reset */
+    memset(priv->tx_ctrl, 0, sizeof(priv->tx_ctrl));
+
     gpio_set(gpios[GPIO_CS], 0);
     reg = mcp2515_read_reg(priv, CANSTAT);
     gpio_set(gpios[GPIO_CS], 1);
@@ -1049,6 +1185,7 @@ static void mcp2515_open_clean(struct net_device *net) {
 
 static int mcp2515_stop(struct net_device *net) {
     struct mcp2515_priv *priv = netdev_priv(net);
+    int i;
 
     printk(KERN_INFO "%s\n", __func__);
     close_candev(net);
@@ -1063,7 +1200,8 @@ static int mcp2515_stop(struct net_device *net) {
     mcp2515_write_reg(priv, CANINTE, 0x00);
     mcp2515_write_reg(priv, CANINTF, 0x00);
 
-    mcp2515_write_reg(priv, TXBCTRL(0), 0);
+    for (i = 0; i < TXB_NUM; i++)
+	mcp2515_write_reg(priv, TXBCTRL(i), 0);
     mcp2515_clean(net);
 
     priv->can.state = CAN_STATE_STOPPED;
@@ -1087,41 +1225,90 @@ static void mcp2515_error_skb(struct net_device *net, int can_id, int data1) {
     }
 }
 
+/*
+ * map the TXnIF bits of READ STATUS to CANINTF
+ */
+static inline u8 mcp2515_status_to_txif(u8 status) {
+    u8 intf = 0;
+
+    if (status & READ_STATUS_TX0IF)
+	intf |= CANINTF_TX0IF;
+    if (status & READ_STATUS_TX1IF)
+	intf |= CANINTF_TX1IF;
+    if (status & READ_STATUS_TX2IF)
+	intf |= CANINTF_TX2IF;
+
+    return intf;
+}
+
+/*
+ * the irq loop is driven by READ STATUS (2 bytes) instead of reading
+ * CANINTF and EFLG (4 bytes). READ RX BUFFER clears RXnIF itself, so only
+ * TXnIF needs a BIT MODIFY. ERRIF is not part of READ STATUS - CANINTF and
+ * EFLG are read only if INT is still asserted without any rx or tx flag,
+ * or while the controller is not error active to follow the error state
+ * back down. The INT line is edge triggered, so the loop only ends after
+ * all flags are cleared.
+ */
 static irqreturn_t mcp2515_can_ist(int irq, void *dev_id) {
     struct mcp2515_priv *priv = dev_id;
     struct net_device *net = priv->net;
+    u64 spi_bytes;
 
     mutex_lock(&priv->mcp_lock);
+    spi_bytes = priv->spi_bytes;
     while (!priv->force_quit) {
 	enum can_state new_state;
-	u8 intf, eflag;
-	u8 clear_intf = 0;
+	u8 status, intf, eflag;
 	int can_id = 0, data1 = 0;
+	int i;
 
-	mcp2515_read_2regs(priv, CANINTF, &intf, &eflag);
+	status = mcp2515_read_status(priv);
 
-	/* mask out flags we don't care about */
-	intf &= CANINTF_RX | CANINTF_TX | CANINTF_ERR;
-
-	/* receive buffer 0 */
-	if (intf & CANINTF_RX0IF) {
-	    /*
-	     * Free one buffer ASAP
-	     * (The MCP2515 does this automatically.)
-	     */
+	/* receive buffer 0 - free one buffer ASAP */
+	if (status & READ_STATUS_RX0IF) {
 	    mcp2515_hw_rx(priv, 0);
+	    priv->irq_rx_frames++;
 	}
 
 	/* receive buffer 1 */
-	if (intf & CANINTF_RX1IF) {
+	if (status & READ_STATUS_RX1IF) {
 	    mcp2515_hw_rx(priv, 1);
+	    priv->irq_rx_frames++;
 	}
 
-	/* any error or tx interrupt we need to clear? */
-	if (intf & (CANINTF_ERR | CANINTF_TX))
-	    clear_intf |= intf & (CANINTF_ERR | CANINTF_TX);
-	if (clear_intf)
-	    mcp2515_write_bits(priv, CANINTF, clear_intf, 0x00);
+	intf = mcp2515_status_to_txif(status);
+	if (intf) {
+	    mcp2515_write_bits(priv, CANINTF, intf, 0x00);
+
+	    for (i = 0; i < TXB_NUM; i++) {
+		if (!(intf & (CANINTF_TX0IF << i)))
+		    continue;
+		net->stats.tx_packets++;
+		if (priv->tx_len[i]) {
+		    net->stats.tx_bytes += priv->tx_len[i] - 1;
+		    can_get_echo_skb(net, i);
+		    priv->tx_len[i] = 0;
+		}
+		clear_bit(i, &priv->tx_busy);
+	    }
+	    netif_wake_queue(net);
+	}
+
+	if (status & (READ_STATUS_RX | READ_STATUS_TX))
+	    continue;
+
+	/* nothing left in READ STATUS - only errors may be pending */
+	if (gpio_get(gpios[GPIO_INT]) && priv->can.state == CAN_STATE_ERROR_ACTIVE)
+	    break;
+
+	mcp2515_read_2regs(priv, CANINTF, &intf, &eflag);
+
+	/* mask out flags we don't care about */
+	intf &= CANINTF_ERR;
+
+	if (intf)
+	    mcp2515_write_bits(priv, CANINTF, intf, 0x00);
 
 	if (eflag)
 	    mcp2515_write_bits(priv, EFLG, eflag, 0x00);
@@ -1192,18 +1379,8 @@ static irqreturn_t mcp2515_can_ist(int irq, void *dev_id) {
 
 	if (intf == 0)
 	    break;
-
-	if (intf & CANINTF_TX) {
-	    net->stats.tx_packets++;
-	    net->stats.tx_bytes += priv->tx_len - 1;
-	    if (priv->tx_len) {
-		can_get_echo_skb(net, 0);
-		priv->tx_len = 0;
-	    }
-	    netif_wake_queue(net);
-	}
-
     }
+    priv->irq_spi_bytes += priv->spi_bytes - spi_bytes;
     mutex_unlock(&priv->mcp_lock);
     return IRQ_HANDLED;
 }
@@ -1226,8 +1403,10 @@ static int mcp2515_open(struct net_device *net) {
     mutex_lock(&priv->mcp_lock);
 
     priv->force_quit = 0;
-    priv->tx_skb = NULL;
-    priv->tx_len = 0;
+    memset(priv->tx_skb, 0, sizeof(priv->tx_skb));
+    memset(priv->tx_len, 0, sizeof(priv->tx_len));
+    priv->tx_busy = 0;
+    priv->tx_rts = 0;
 
     ret = request_irq(priv->irq, mcp2515_can_ist, flags, DEVICE_NAME, priv);
     if (ret) {
@@ -1267,6 +1446,31 @@ static const struct net_device_ops mcp2515_netdev_ops = {
     .ndo_change_mtu = can_change_mtu,
 };
 
+static ssize_t spi_stats_show(struct device *dev, struct device_attribute *attr, char *buf) {
+    struct mcp2515_priv *priv = netdev_priv(to_net_dev(dev));
+    u64 bytes, irq_bytes, rx_frames;
+
+    mutex_lock(&priv->mcp_lock);
+    bytes = priv->spi_bytes;
+    irq_bytes = priv->irq_spi_bytes;
+    rx_frames = priv->irq_rx_frames;
+    mutex_unlock(&priv->mcp_lock);
+
+    return sprintf(buf, "spi_bytes %llu\nirq_spi_bytes %llu\nirq_rx_frames %llu\n"
+	"irq_spi_bytes_per_rx_frame %llu\n",
+	bytes, irq_bytes, rx_frames, rx_frames ? div64_u64(irq_bytes, rx_frames) : 0);
+}
+static DEVICE_ATTR_RO(spi_stats);
+
+static struct attribute *mcp2515_attrs[] = {
+    &dev_attr_spi_stats.attr,
+    NULL,
+};
+
+static const struct attribute_group mcp2515_attr_group = {
+    .attrs = mcp2515_attrs,
+};
+
 static int mcp2515_can_probe(struct platform_device *pdev) {
     struct mcp2515_priv *priv;
 
@@ -1283,6 +1487,7 @@ static int mcp2515_can_probe(struct platform_device *pdev) {
 	return -ENOMEM;
 
     net->netdev_ops = &mcp2515_netdev_ops;
+    net->sysfs_groups[0] = &mcp2515_attr_group;
     /* net->flags |= IFF_ECHO; */
 
     priv = netdev_priv(net);
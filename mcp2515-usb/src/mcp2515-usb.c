@@ -34,6 +34,18 @@
 #define MAX_RX_URBS			20
 #define MAX_TX_URBS			20
 #define RX_BUFFER_SIZE			64
+#define RX_BULK_BUFFER_SIZE		1024
+#define RX_URBS_LIMIT			64
+
+static unsigned int rx_urbs = MAX_RX_URBS;
+module_param(rx_urbs, uint, 0444);
+MODULE_PARM_DESC(rx_urbs, "number of RX URBs (1.." __stringify(RX_URBS_LIMIT) ")");
+
+static unsigned int rx_buffer_size;
+module_param(rx_buffer_size, uint, 0444);
+MODULE_PARM_DESC(rx_buffer_size, "RX URB buffer size in bytes (0 = "
+		 __stringify(RX_BUFFER_SIZE) " for interrupt, "
+		 __stringify(RX_BULK_BUFFER_SIZE) " for bulk endpoints)");
 
 /* vendor and product id */
 #define MCP2515DM_BM_VENDOR_ID		0x04d8
@@ -261,9 +273,23 @@ struct mcp2515dm_bm_priv {
 	atomic_t active_tx_urbs;
 	struct usb_anchor tx_submitted;
 	struct mcp2515dm_bm_tx_urb_context tx_contexts[MAX_TX_URBS];
+	/* TX URBs and their buffers - allocated at open, one per context */
+	struct urb *tx_urbs[MAX_TX_URBS];
 
 	struct usb_anchor rx_submitted;
 
+	/* RX endpoint: bulk if the firmware offers it, interrupt otherwise */
+	bool rx_bulk;
+	int rx_interval;
+	unsigned int rx_urbs;
+	unsigned int rx_buf_size;
+	void *rx_buf[RX_URBS_LIMIT];
+	dma_addr_t rx_dma[RX_URBS_LIMIT];
+
+	/* the RX callback queues the frames of an URB, NAPI delivers them */
+	struct napi_struct napi;
+	struct sk_buff_head rx_queue;
+
 	struct can_berr_counter bec;
 
 	u8 *usb_msg_buffer;
@@ -608,7 +634,7 @@ static void mcp2515dm_bm_rx_err_msg(struct mcp2515dm_bm_priv *priv,
 	priv->bec.txerr = txerr;
 	priv->bec.rxerr = rxerr;
 
-	netif_rx(skb);
+	skb_queue_tail(&priv->rx_queue, skb);
 
 	stats->rx_packets++;
 	stats->rx_bytes += cf->can_dlc;
@@ -641,7 +667,7 @@ static void mcp2515dm_bm_rx_can_msg(struct mcp2515dm_bm_priv *priv,
 		else
 			memcpy(cf->data, msg->data, cf->can_dlc);
 
-		netif_rx(skb);
+		skb_queue_tail(&priv->rx_queue, skb);
 
 		stats->rx_packets++;
 		stats->rx_bytes += cf->can_dlc;
@@ -653,9 +679,35 @@ static void mcp2515dm_bm_rx_can_msg(struct mcp2515dm_bm_priv *priv,
 
 }
 
+static int mcp2515dm_bm_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct mcp2515dm_bm_priv *priv = container_of(napi,
+						      struct mcp2515dm_bm_priv,
+						      napi);
+	struct sk_buff *skb;
+	int work_done = 0;
+
+	while (work_done < budget) {
+		skb = skb_dequeue(&priv->rx_queue);
+		if (!skb)
+			break;
+		netif_receive_skb(skb);
+		work_done++;
+	}
+
+	if (work_done < budget)
+		napi_complete_done(napi, work_done);
+
+	return work_done;
+}
+
+static void mcp2515dm_bm_fill_rx_urb(struct mcp2515dm_bm_priv *priv,
+				     struct urb *urb, void *buf);
+
 /* Callback for reading data from device
  *
- * Check urb status, call read function and resubmit urb read operation.
+ * Check urb status, queue all messages of the URB for NAPI and resubmit
+ * urb read operation.
  */
 static void mcp2515dm_bm_read_int_callback(struct urb *urb)
 {
@@ -696,12 +748,11 @@ static void mcp2515dm_bm_read_int_callback(struct urb *urb)
 		pos += sizeof(struct mcp2515dm_bm_rx_msg);
 	}
 
-resubmit_urb:
-	usb_fill_int_urb(urb, priv->udev,
-			  usb_rcvintpipe(priv->udev, MCP2515DM_BM_ENDP_RX),
-			  urb->transfer_buffer, RX_BUFFER_SIZE,
-			  mcp2515dm_bm_read_int_callback, priv, 0);
+	/* one NAPI run for the whole batch */
+	if (pos)
+		napi_schedule(&priv->napi);
 
+resubmit_urb:
 	retval = usb_submit_urb(urb, GFP_ATOMIC);
 
 	if (retval == -ENODEV)
@@ -713,8 +764,8 @@ resubmit_urb:
 
 /* Callback handler for write operations
  *
- * Free allocated buffers, check transmit status and
- * calculate statistic.
+ * Check transmit status, calculate statistic and give the URB back
+ * to the pool.
  */
 static void mcp2515dm_bm_write_int_callback(struct urb *urb)
 {
@@ -727,10 +778,6 @@ static void mcp2515dm_bm_write_int_callback(struct urb *urb)
 	priv = context->priv;
 	netdev = priv->netdev;
 
-	/* free up our allocated buffer */
-	usb_free_coherent(urb->dev, urb->transfer_buffer_length,
-			  urb->transfer_buffer, urb->transfer_dma);
-
 	atomic_dec(&priv->active_tx_urbs);
 
 	if (!netif_device_present(netdev))
@@ -762,30 +809,31 @@ static netdev_tx_t mcp2515dm_bm_start_xmit(struct sk_buff *skb,
 	struct mcp2515dm_bm_tx_msg *msg;
 	struct urb *urb;
 	struct mcp2515dm_bm_tx_urb_context *context = NULL;
-	u8 *buf;
 	int i, err;
-	size_t size = sizeof(struct mcp2515dm_bm_tx_msg);
 
 	if (can_dropped_invalid_skb(netdev, skb))
 		return NETDEV_TX_OK;
 
-	/* create a URB, and a buffer for it, and copy the data to the URB */
-	urb = usb_alloc_urb(0, GFP_ATOMIC);
-	if (!urb) {
-		netdev_err(netdev, "No memory left for URBs\n");
-		goto nomem;
+	for (i = 0; i < MAX_TX_URBS; i++) {
+		if (priv->tx_contexts[i].echo_index == MAX_TX_URBS) {
+			context = &priv->tx_contexts[i];
+			break;
+		}
 	}
 
-	buf = usb_alloc_coherent(priv->udev, size, GFP_ATOMIC,
-				 &urb->transfer_dma);
-	if (!buf) {
-		netdev_err(netdev, "No memory left for USB buffer\n");
-		goto nomembuf;
+	/* May never happen! When this happens we'd more URBs in flight as
+	 * allowed (MAX_TX_URBS).
+	 */
+	if (!context) {
+		netdev_warn(netdev, "couldn't find free context");
+		return NETDEV_TX_BUSY;
 	}
 
-	memset(buf, 0, size);
+	/* the URB and its buffer belong to the context */
+	urb = priv->tx_urbs[i];
+	msg = urb->transfer_buffer;
+	memset(msg, 0, sizeof(*msg));
 
-	msg = (struct mcp2515dm_bm_tx_msg *)buf;
 	msg->begin = MCP2515DM_BM_DATA_START;
 	msg->flags = 0x00;
 
@@ -800,27 +848,10 @@ static netdev_tx_t mcp2515dm_bm_start_xmit(struct sk_buff *skb,
 	memcpy(msg->data, cf->data, cf->can_dlc);
 	msg->end = MCP2515DM_BM_DATA_END;
 
-	for (i = 0; i < MAX_TX_URBS; i++) {
-		if (priv->tx_contexts[i].echo_index == MAX_TX_URBS) {
-			context = &priv->tx_contexts[i];
-			break;
-		}
-	}
-
-	/* May never happen! When this happens we'd more URBs in flight as
-	 * allowed (MAX_TX_URBS).
-	 */
-	if (!context)
-		goto nofreecontext;
-
 	context->priv = priv;
 	context->echo_index = i;
 	context->dlc = cf->can_dlc;
 
-	usb_fill_int_urb(urb, priv->udev,
-			  usb_sndintpipe(priv->udev, MCP2515DM_BM_ENDP_TX),
-			  buf, size, mcp2515dm_bm_write_int_callback, context, 0);
-	urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
 	usb_anchor_urb(urb, &priv->tx_submitted);
 
 	can_put_echo_skb(skb, netdev, context->echo_index);
@@ -834,44 +865,82 @@ static netdev_tx_t mcp2515dm_bm_start_xmit(struct sk_buff *skb,
 		/* Slow down tx path */
 		netif_stop_queue(netdev);
 
-	/* Release our reference to this URB, the USB core will eventually free
-	 * it entirely.
-	 */
-	usb_free_urb(urb);
-
 	return NETDEV_TX_OK;
 
-nofreecontext:
-	usb_free_coherent(priv->udev, size, buf, urb->transfer_dma);
-	usb_free_urb(urb);
-
-	netdev_warn(netdev, "couldn't find free context");
-
-	return NETDEV_TX_BUSY;
-
 failed:
 	can_free_echo_skb(netdev, context->echo_index);
 
 	usb_unanchor_urb(urb);
-	usb_free_coherent(priv->udev, size, buf, urb->transfer_dma);
 
 	atomic_dec(&priv->active_tx_urbs);
+	context->echo_index = MAX_TX_URBS;
 
 	if (err == -ENODEV)
 		netif_device_detach(netdev);
 	else
 		netdev_warn(netdev, "failed tx_urb %d\n", err);
 
-nomembuf:
-	usb_free_urb(urb);
-
-nomem:
-	dev_kfree_skb(skb);
 	stats->tx_dropped++;
 
 	return NETDEV_TX_OK;
 }
 
+static void mcp2515dm_bm_free_tx_urbs(struct mcp2515dm_bm_priv *priv)
+{
+	struct urb *urb;
+	int i;
+
+	for (i = 0; i < MAX_TX_URBS; i++) {
+		urb = priv->tx_urbs[i];
+		if (!urb)
+			continue;
+		usb_free_coherent(priv->udev, urb->transfer_buffer_length,
+				  urb->transfer_buffer, urb->transfer_dma);
+		usb_free_urb(urb);
+		priv->tx_urbs[i] = NULL;
+	}
+}
+
+/* One URB with a DMA buffer for each TX context
+ *
+ * The URBs are filled once and only get a new message on xmit.
+ */
+static int mcp2515dm_bm_alloc_tx_urbs(struct mcp2515dm_bm_priv *priv)
+{
+	size_t size = sizeof(struct mcp2515dm_bm_tx_msg);
+	struct urb *urb;
+	u8 *buf;
+	int i;
+
+	for (i = 0; i < MAX_TX_URBS; i++) {
+		urb = usb_alloc_urb(0, GFP_KERNEL);
+		if (!urb)
+			goto nomem;
+
+		buf = usb_alloc_coherent(priv->udev, size, GFP_KERNEL,
+					 &urb->transfer_dma);
+		if (!buf) {
+			usb_free_urb(urb);
+			goto nomem;
+		}
+
+		usb_fill_int_urb(urb, priv->udev,
+				 usb_sndintpipe(priv->udev, MCP2515DM_BM_ENDP_TX),
+				 buf, size, mcp2515dm_bm_write_int_callback,
+				 &priv->tx_contexts[i], 0);
+		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+		priv->tx_urbs[i] = urb;
+	}
+
+	return 0;
+
+nomem:
+	netdev_err(priv->netdev, "No memory left for TX URBs\n");
+	mcp2515dm_bm_free_tx_urbs(priv);
+
+	return -ENOMEM;
+}
+
 static int mcp2515dm_bm_get_berr_counter(const struct net_device *netdev,
 					 struct can_berr_counter *bec)
 {
@@ -883,13 +952,32 @@ static int mcp2515dm_bm_get_berr_counter(const struct net_device *netdev,
 	return 0;
 }
 
+static void mcp2515dm_bm_fill_rx_urb(struct mcp2515dm_bm_priv *priv,
+				     struct urb *urb, void *buf)
+{
+	if (priv->rx_bulk)
+		usb_fill_bulk_urb(urb, priv->udev,
+				  usb_rcvbulkpipe(priv->udev,
+						  MCP2515DM_BM_ENDP_RX),
+				  buf, priv->rx_buf_size,
+				  mcp2515dm_bm_read_int_callback, priv);
+	else
+		usb_fill_int_urb(urb, priv->udev,
+				 usb_rcvintpipe(priv->udev,
+						MCP2515DM_BM_ENDP_RX),
+				 buf, priv->rx_buf_size,
+				 mcp2515dm_bm_read_int_callback, priv,
+				 priv->rx_interval);
+	urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+}
+
 /* Start USB device */
 static int mcp2515dm_bm_start(struct mcp2515dm_bm_priv *priv)
 {
 	struct net_device *netdev = priv->netdev;
 	int err, i;
 
-	for (i = 0; i < MAX_RX_URBS; i++) {
+	for (i = 0; i < priv->rx_urbs; i++) {
 		struct urb *urb = NULL;
 		u8 *buf;
 
@@ -901,8 +989,8 @@ static int mcp2515dm_bm_start(struct mcp2515dm_bm_priv *priv)
 			break;
 		}
 
-		buf = usb_alloc_coherent(priv->udev, RX_BUFFER_SIZE, GFP_KERNEL,
-					 &urb->transfer_dma);
+		buf = usb_alloc_coherent(priv->udev, priv->rx_buf_size,
+					 GFP_KERNEL, &urb->transfer_dma);
 		if (!buf) {
 			netdev_err(netdev, "No memory left for USB buffer\n");
 			usb_free_urb(urb);
@@ -910,23 +998,21 @@ static int mcp2515dm_bm_start(struct mcp2515dm_bm_priv *priv)
 			break;
 		}
 
-		usb_fill_int_urb(urb, priv->udev,
-				  usb_rcvintpipe(priv->udev,
-						  MCP2515DM_BM_ENDP_RX),
-				  buf, RX_BUFFER_SIZE,
-				  mcp2515dm_bm_read_int_callback, priv, 0);
-		urb->transfer_flags |= URB_NO_TRANSFER_DMA_MAP;
+		mcp2515dm_bm_fill_rx_urb(priv, urb, buf);
 		usb_anchor_urb(urb, &priv->rx_submitted);
 
 		err = usb_submit_urb(urb, GFP_KERNEL);
 		if (err) {
 			usb_unanchor_urb(urb);
-			usb_free_coherent(priv->udev, RX_BUFFER_SIZE, buf,
+			usb_free_coherent(priv->udev, priv->rx_buf_size, buf,
 					  urb->transfer_dma);
 			usb_free_urb(urb);
 			break;
 		}
 
+		priv->rx_buf[i] = buf;
+		priv->rx_dma[i] = urb->transfer_dma;
+
 		/* Drop reference, USB core will take care of freeing it */
 		usb_free_urb(urb);
 	}
@@ -938,7 +1024,7 @@ static int mcp2515dm_bm_start(struct mcp2515dm_bm_priv *priv)
 	}
 
 	/* Warn if we've couldn't transmit all the URBs */
-	if (i < MAX_RX_URBS)
+	if (i < priv->rx_urbs)
 		netdev_warn(netdev, "rx performance may be slow\n");
 
 	err = mcp2515dm_bm_cmd_open(priv);
@@ -958,6 +1044,28 @@ failed:
 	return err;
 }
 
+static void unlink_all_urbs(struct mcp2515dm_bm_priv *priv)
+{
+	int i;
+
+	usb_kill_anchored_urbs(&priv->rx_submitted);
+
+	for (i = 0; i < RX_URBS_LIMIT; i++) {
+		if (!priv->rx_buf[i])
+			continue;
+		usb_free_coherent(priv->udev, priv->rx_buf_size,
+				  priv->rx_buf[i], priv->rx_dma[i]);
+		priv->rx_buf[i] = NULL;
+	}
+	skb_queue_purge(&priv->rx_queue);
+
+	usb_kill_anchored_urbs(&priv->tx_submitted);
+	atomic_set(&priv->active_tx_urbs, 0);
+
+	for (i = 0; i < MAX_TX_URBS; i++)
+		priv->tx_contexts[i].echo_index = MAX_TX_URBS;
+}
+
 /* Open USB device */
 static int mcp2515dm_bm_open(struct net_device *netdev)
 {
@@ -971,6 +1079,14 @@ static int mcp2515dm_bm_open(struct net_device *netdev)
 
 	/* can_led_event(netdev, CAN_LED_EVENT_OPEN); */
 
+	err = mcp2515dm_bm_alloc_tx_urbs(priv);
+	if (err) {
+		close_candev(netdev);
+		return err;
+	}
+
+	napi_enable(&priv->napi);
+
 	/* finally start device */
 	err = mcp2515dm_bm_start(priv);
 	if (err) {
@@ -979,6 +1095,9 @@ static int mcp2515dm_bm_open(struct net_device *netdev)
 
 		netdev_warn(netdev, "couldn't start device: %d\n", err);
 
+		unlink_all_urbs(priv);
+		mcp2515dm_bm_free_tx_urbs(priv);
+		napi_disable(&priv->napi);
 		close_candev(netdev);
 
 		return err;
@@ -989,19 +1108,6 @@ static int mcp2515dm_bm_open(struct net_device *netdev)
 	return 0;
 }
 
-static void unlink_all_urbs(struct mcp2515dm_bm_priv *priv)
-{
-	int i;
-
-	usb_kill_anchored_urbs(&priv->rx_submitted);
-
-	usb_kill_anchored_urbs(&priv->tx_submitted);
-	atomic_set(&priv->active_tx_urbs, 0);
-
-	for (i = 0; i < MAX_TX_URBS; i++)
-		priv->tx_contexts[i].echo_index = MAX_TX_URBS;
-}
-
 /* Close USB device */
 static int mcp2515dm_bm_close(struct net_device *netdev)
 {
@@ -1019,6 +1125,8 @@ static int mcp2515dm_bm_close(struct net_device *netdev)
 
 	/* Stop polling */
 	unlink_all_urbs(priv);
+	mcp2515dm_bm_free_tx_urbs(priv);
+	napi_disable(&priv->napi);
 
 	close_candev(netdev);
 
@@ -1061,6 +1169,9 @@ static int mcp2515dm_bm_probe(struct usb_interface *intf,
 	u32 version;
 	char buf[18];
 	struct usb_device *usbdev = interface_to_usbdev(intf);
+	struct usb_host_interface *iface_desc = intf->cur_altsetting;
+	struct usb_endpoint_descriptor *ep;
+	unsigned int rx_maxp = RX_BUFFER_SIZE;
 
 	/* product id looks strange, better we also check iProduct string */
 	if (usb_string(usbdev, usbdev->descriptor.iProduct, buf,
@@ -1092,6 +1203,36 @@ static int mcp2515dm_bm_probe(struct usb_interface *intf,
 
 	netdev->flags |= IFF_ECHO;	/* we support local echo */
 
+	/* RX endpoint type - newer firmware may offer bulk */
+	for (i = 0; i < iface_desc->desc.bNumEndpoints; i++) {
+		ep = &iface_desc->endpoint[i].desc;
+		if (usb_endpoint_num(ep) != MCP2515DM_BM_ENDP_RX ||
+		    !usb_endpoint_dir_in(ep))
+			continue;
+		priv->rx_bulk = usb_endpoint_xfer_bulk(ep);
+		priv->rx_interval = ep->bInterval;
+		rx_maxp = usb_endpoint_maxp(ep);
+	}
+
+	priv->rx_urbs = clamp_t(unsigned int, rx_urbs, 1, RX_URBS_LIMIT);
+	if (rx_buffer_size)
+		priv->rx_buf_size = rx_buffer_size;
+	else
+		priv->rx_buf_size = priv->rx_bulk ?
+		    RX_BULK_BUFFER_SIZE : RX_BUFFER_SIZE;
+	priv->rx_buf_size = max_t(unsigned int, priv->rx_buf_size,
+				  sizeof(struct mcp2515dm_bm_rx_msg));
+	/* bulk transfers end on a short packet - avoid babble */
+	if (priv->rx_bulk && rx_maxp)
+		priv->rx_buf_size = roundup(priv->rx_buf_size, rx_maxp);
+	dev_info(&intf->dev, "%s RX endpoint, %u URBs of %u bytes\n",
+		 priv->rx_bulk ? "bulk" : "interrupt", priv->rx_urbs,
+		 priv->rx_buf_size);
+
+	skb_queue_head_init(&priv->rx_queue);
+	netif_napi_add(netdev, &priv->napi, mcp2515dm_bm_napi_poll,
+		       NAPI_POLL_WEIGHT);
+
 	init_usb_anchor(&priv->rx_submitted);
 
 	init_usb_anchor(&priv->tx_submitted);
@@ -1159,9 +1300,9 @@ static void mcp2515dm_bm_disconnect(struct usb_interface *intf)
 		netdev_info(priv->netdev, "device disconnected\n");
 
 		unregister_netdev(priv->netdev);
-		free_candev(priv->netdev);
-
 		unlink_all_urbs(priv);
+
+		free_candev(priv->netdev);
 	}
 
 }
@@ -19,6 +19,7 @@
 #include <linux/delay.h>
 #include <linux/device.h>
 #include <linux/dma-mapping.h>
+#include <linux/ethtool.h>
 #include <linux/freezer.h>
 #include <linux/gpio/driver.h>
 #include <linux/interrupt.h>
@@ -26,15 +27,20 @@
 #include <linux/jiffies.h>
 #include <linux/kernel.h>
 #include <linux/module.h>
+#include <linux/net_tstamp.h>
 #include <linux/netdevice.h>
 #include <linux/of.h>
 #include <linux/of_device.h>
 #include <linux/platform_device.h>
 #include <linux/slab.h>
-#include <linux/sort.h>
 #include <linux/spi/spi.h>
+#include <linux/timecounter.h>
 #include <linux/uaccess.h>
 #include <linux/regulator/consumer.h>
+#include <linux/rtnetlink.h>
+#include <linux/sched/signal.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
 
 #define DEVICE_NAME "mcp25xxfd"
 
@@ -100,8 +106,16 @@
  *   * Can bus speed - lower Speeds increase Duty-cycle
  *   * SPI Clock Rate - higher speeds increase duty-cycle
  *   * CPU speed + SPI implementation - reduces latencies between transfers
+ * * Alternatively (module parameter use_multiqueue) each tx fifo gets
+ *   its own tx queue with the queue index as priority, so that frames
+ *   selected via skb->priority or mqprio bypass bulk traffic inside the
+ *   controller itself - at the cost of not keeping the order between
+ *   queues.
  * * There is a module parameter that allows the modification of the
  *   number of tx_fifos, which is by default 7.
+ *   The fifo layout (tx fifos, rx fifo depth and payload size) can also
+ *   get changed via sysfs while the interface is running, optionally
+ *   driven by an autotuner that watches rx overflows and tx fifo usage.
  * * The driver offers some module parameters that allow to control the use
  *   of some optimizations (prefer reading more data than necessary instead
  *   of multiple SPI transfers - the idea here is that this way we may
@@ -147,6 +161,8 @@
 #define MCP25XXFD_OSC_POLLING_JIFFIES    (HZ / 2)
 
 #define TX_ECHO_SKB_MAX    32
+/* in multiqueue mode each tx fifo gets its own queue */
+#define MCP25XXFD_TX_QUEUES_MAX 30
 
 #define INSTRUCTION_RESET        0x0000
 #define INSTRUCTION_READ        0x3000
@@ -619,6 +635,8 @@
     GENMASK(CAN_FIFOSTA_FIFOCI_SHIFT + CAN_FIFOSTA_FIFOCI_BITS - 1, \
         CAN_FIFOSTA_FIFOCI_SHIFT)
 #define CAN_FIFOUA(x)            CAN_SFR_BASE(0x64 + 12 * (x - 1))
+#define FIFOCON_SPACING (CAN_FIFOCON(1) - CAN_FIFOCON(0))
+#define FIFOCON_SPACINGW (FIFOCON_SPACING / sizeof(u32))
 #define CAN_FLTCON(x)            CAN_SFR_BASE(0x1D0 + (x & 0x1c))
 #  define CAN_FILCON_SHIFT(x)        ((x & 3) * 8)
 #  define CAN_FILCON_BITS(x)        CAN_FILCON_BITS_
@@ -634,7 +652,7 @@
     GENMASK(CAN_FILOBJ_SID_SHIFT + CAN_FILOBJ_SID_BITS - 1, \
         CAN_FILOBJ_SID_SHIFT)
 #  define CAN_FILOBJ_EID_BITS        18
-#  define CAN_FILOBJ_EID_SHIFT        12
+#  define CAN_FILOBJ_EID_SHIFT        11
 #  define CAN_FILOBJ_EID_MASK                    \
     GENMASK(CAN_FILOBJ_EID_SHIFT + CAN_FILOBJ_EID_BITS - 1, \
         CAN_FILOBJ_EID_SHIFT)
@@ -647,7 +665,7 @@
     GENMASK(CAN_FILMASK_MSID_SHIFT + CAN_FILMASK_MSID_BITS - 1, \
         CAN_FILMASK_MSID_SHIFT)
 #  define CAN_FILMASK_MEID_BITS        18
-#  define CAN_FILMASK_MEID_SHIFT    12
+#  define CAN_FILMASK_MEID_SHIFT    11
 #  define CAN_FILMASK_MEID_MASK                    \
     GENMASK(CAN_FILMASK_MEID_SHIFT + CAN_FILMASK_MEID_BITS - 1, \
         CAN_FILMASK_MEID_SHIFT)
@@ -691,6 +709,12 @@
 
 #define MCP25XXFD_BUFFER_TXRX_SIZE 2048
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
+#define mcp25xxfd_xmit_more(skb) ((skb)->xmit_more)
+#else
+#define mcp25xxfd_xmit_more(skb) netdev_xmit_more()
+#endif
+
 static const char *const mcp25xxfd_mode_names[] = {
 	[CAN_CON_MODE_MIXED] = "can2.0+canfd",
 	[CAN_CON_MODE_SLEEP] = "sleep",
@@ -780,22 +804,124 @@ enum mcp25xxfd_gpio_mode {
 };
 
 struct mcp25xxfd_trigger_tx_message {
-	struct spi_message msg;
 	struct spi_transfer fill_xfer;
-	struct spi_transfer trigger_xfer;
 	int fifo;
 	char fill_cmd[2];
 	char fill_obj[sizeof(struct mcp25xxfd_obj_tx)];
 	char fill_data[64];
+};
+
+/* a spi_message that fills a range of adjacent tx fifos and then
+ * triggers all of them with a single write spanning their FIFOCON
+ */
+struct mcp25xxfd_tx_batch_message {
+	struct spi_message msg;
+	struct spi_transfer fill_xfer[32];
+	struct spi_transfer trigger_xfer[2];
+	u32 fifo_mask;
+	int first_fifo;
+	int count;
 	char trigger_cmd[2];
-	char trigger_data;
+	u32 trigger_data[32 * FIFOCON_SPACINGW];
+};
+
+/* the status block of the mcp25xxfd read at the start of each irq loop */
+struct mcp25xxfd_status {
+	u32 intf;
+	/* ASSERT(CAN_INT + 4 == CAN_RXIF) */
+	u32 rxif;
+	/* ASSERT(CAN_RXIF + 4 == CAN_TXIF) */
+	u32 txif;
+	/* ASSERT(CAN_TXIF + 4 == CAN_RXOVIF) */
+	u32 rxovif;
+	/* ASSERT(CAN_RXOVIF + 4 == CAN_TXATIF) */
+	u32 txatif;
+	/* ASSERT(CAN_TXATIF + 4 == CAN_TXREQ) */
+	u32 txreq;
+	/* ASSERT(CAN_TXREQ + 4 == CAN_TREC) */
+	u32 trec;
+	/* ASSERT(CAN_TREC + 4 == CAN_BDIAG0) */
+	u32 bdiag0;
+	/* ASSERT(CAN_BDIAG0 + 4 == CAN_BDIAG1) */
+	u32 bdiag1;
+};
+
+/* a single spi_message used by the irq handler to read all rx fifos,
+ * release them and read the status for the next loop in one go
+ */
+struct mcp25xxfd_irq_message {
+	struct spi_message msg;
+	/* command + data for each range of adjacent fifos */
+	struct spi_transfer read_xfer[32][2];
+	/* one release per fifo */
+	struct spi_transfer release_xfer[32];
+	/* command + data for the status of the next irq loop */
+	struct spi_transfer status_xfer[2];
+	char read_cmd[32][2];
+	char release_cmd[32][3];
+	char status_cmd[2];
+	struct mcp25xxfd_status status;
+	/* the tx_pending_mask at the time the status was read */
+	u32 tx_pending_mask;
+	bool status_valid;
+
+	/* asyncronous re-enabling of RXIE from napi poll */
+	struct spi_message rxie_msg;
+	struct spi_transfer rxie_xfer;
+	char rxie_cmd[3];
 };
 
+/* the rx and tef objects of one irq loop (up to 31 rx fifos + 32 tef) */
+#define MCP25XXFD_QUEUED_FIFOS_MAX 64
+
 struct mcp25xxfd_read_fifo_info {
-	struct mcp25xxfd_obj_ts *rxb[32];
+	struct mcp25xxfd_obj_ts *rxb[MCP25XXFD_QUEUED_FIFOS_MAX];
 	int rx_count;
+	/* index of the first object of each run in timestamp order */
+	int run_start[MCP25XXFD_QUEUED_FIFOS_MAX];
+	int run_count;
+	/* scratch space for merging the runs */
+	struct mcp25xxfd_obj_ts *merged[MCP25XXFD_QUEUED_FIFOS_MAX];
+};
+
+/* rx filter rule as set via sysfs - can_id/can_mask as in struct can_filter
+ * with fifo_class 0 sharing the rx fifos not dedicated to other classes
+ */
+struct mcp25xxfd_rx_rule {
+	u32 can_id;
+	u32 can_mask;
+	u32 fifo_class;
+};
+
+/* a compiled hardware filter */
+struct mcp25xxfd_rx_filter {
+	u32 obj;
+	u32 mask;
+	u32 fifo;
+};
+
+#define MCP25XXFD_RX_FILTERS 32
+
+/* requested fifo layout - 0 selects the default for the mtu */
+struct mcp25xxfd_fifo_layout {
+	u32 tx_fifos;
+	u32 rx_fifo_depth;
+	u32 payload_size;
+};
+
+/* the stages of the interrupt handler that get timed */
+enum mcp25xxfd_lat_stage {
+	MCP25XXFD_LAT_IRQ,	/* hard irq until the irq thread runs */
+	MCP25XXFD_LAT_STATUS,	/* reading the interrupt status */
+	MCP25XXFD_LAT_FIFO,	/* reading rx, tef and aborted fifos */
+	MCP25XXFD_LAT_RELEASE,	/* releasing the read fifos */
+	MCP25XXFD_LAT_DELIVER,	/* handing the frames to the network stack */
+	MCP25XXFD_LAT_STAGES
 };
 
+/* log2 buckets - bucket n counts values in [2^(n-1), 2^n) */
+#define MCP25XXFD_LAT_BUCKETS 32
+
 struct mcp25xxfd_priv {
 	struct can_priv can;
 	struct net_device *net;
@@ -848,6 +974,9 @@ struct mcp25xxfd_priv {
 		/* address in mcp25xxfd-Fifo RAM of each fifo */
 		u32 fifo_address[32];
 
+		/* FIFOCON value of each fifo without the FRESET/UINC/TXREQ */
+		u32 fifocon[32];
+
 		/* infos on tx-fifos */
 		u32 tx_fifos;
 		u32 tx_fifo_start;
@@ -862,12 +991,50 @@ struct mcp25xxfd_priv {
 		u32 rx_fifo_depth;
 		u32 rx_fifo_start;
 		u32 rx_fifo_mask;	/* bitmask of which fifo is a rx fifo */
+		u32 rx_ovie_mask;	/* rx fifos with overflow interrupt */
 
 		/* memory image of FIFO RAM on mcp25xxfd */
 		u8 fifo_data[MCP25XXFD_BUFFER_TXRX_SIZE];
 
 	} fifos;
 
+	/* rx filter rules and the hardware filters compiled from them */
+	struct {
+		struct mcp25xxfd_rx_rule rules[MCP25XXFD_RX_FILTERS];
+		u32 rule_count;
+		struct mcp25xxfd_rx_filter hw[MCP25XXFD_RX_FILTERS];
+		u32 hw_count;
+	} rx_filter;
+
+	/* fifo layout as requested via sysfs or by the autotuner */
+	struct mcp25xxfd_fifo_layout fifo_layout;
+	/* set while the fifos get reconfigured on a running interface */
+	bool fifo_reconfig;
+
+	/* hardware timestamps - the TBC converted to system time */
+	struct {
+		struct cyclecounter cc;
+		struct timecounter tc;
+		spinlock_t lock;	/* protects tc and cc.mult */
+		struct delayed_work work;
+		u32 prescaler;
+		u32 period_ms;
+		/* TBC as read last by the worker */
+		u32 tbc;
+		/* frequency correction against the system clock */
+		u32 base_mult;
+		s32 adj_ppb;
+	} tstamp;
+
+	/* fifo layout autotuner */
+	struct {
+		bool enabled;
+		struct delayed_work work;
+		/* rx_overflow and usage of the last tx fifo at the last run */
+		u64 rx_overflow;
+		u64 tx_full;
+	} autotune;
+
 	/* structure with active fifos that need to get fed to the system */
 	struct mcp25xxfd_read_fifo_info queued_fifos;
 
@@ -900,6 +1067,21 @@ struct mcp25xxfd_priv {
 		u64 rx_brs_count;
 		u64 tx_brs_count;
 
+		/* number of tx spi_messages and frames submitted by them */
+		u64 tx_batches;
+		u64 tx_batch_frames;
+
+		/* napi polls and number of times RXIE got masked */
+		u64 rx_napi_polls;
+		u64 rx_napi_masked;
+
+		/* number of fifo reconfigurations while running */
+		u64 fifo_reconfigs;
+
+		/* number of times the timestamps were stepped to system time */
+		u64 tstamp_steps;
+		u64 tstamp_slow_reads;
+
 		/* interrupt counter */
 		u64 int_ivm_count;
 		u64 int_wake_count;
@@ -912,6 +1094,7 @@ struct mcp25xxfd_priv {
 		u64 int_tef_count;
 		u64 int_mod_count;
 		u64 int_tbc_count;
+
 		u64 int_rx_count;
 		u64 int_tx_count;
 
@@ -920,26 +1103,48 @@ struct mcp25xxfd_priv {
 		u64 tx_dlc_usage[16];
 	} stats;
 
-	/* the current status of the mcp25xxfd */
+	/* adaptive rx read strategy */
+	struct {
+		/* decaying dlc histogram of the recently received frames */
+		u32 dlc_recent[16];
+		u32 dlc_recent_frames;
+
+		/* estimated cost of the last decision in spi bytes */
+		u32 cost_bulk;
+		u32 cost_fifo;
+
+		/* number of decisions for each read implementation */
+		u64 bulk_count;
+		u64 fifo_count;
+
+		/* reads via the pipelined irq message */
+		u64 pipelined_count;
+		u64 status_prefetch_count;
+	} rx_read;
+
+	/* interrupt handler timing and spi cost per handler run */
 	struct {
-		u32 intf;
-		/* ASSERT(CAN_INT + 4 == CAN_RXIF) */
-		u32 rxif;
-		/* ASSERT(CAN_RXIF + 4 == CAN_TXIF) */
-		u32 txif;
-		/* ASSERT(CAN_TXIF + 4 == CAN_RXOVIF) */
-		u32 rxovif;
-		/* ASSERT(CAN_RXOVIF + 4 == CAN_TXATIF) */
-		u32 txatif;
-		/* ASSERT(CAN_TXATIF + 4 == CAN_TXREQ) */
-		u32 txreq;
-		/* ASSERT(CAN_TXREQ + 4 == CAN_TREC) */
-		u32 trec;
-		/* ASSERT(CAN_TREC + 4 == CAN_BDIAG0) */
-		u32 bdiag0;
-		/* ASSERT(CAN_BDIAG0 + 4 == CAN_BDIAG1) */
-		u32 bdiag1;
-	} status;
+		bool enabled;
+		/* the task running the handler - only its spi is counted */
+		struct task_struct *irq_task;
+		/* time of the hard irq - 0 if the handler got called directly */
+		u64 irq_ns;
+
+		/* accumulated for the current handler run */
+		u64 stage_ns[MCP25XXFD_LAT_STAGES];
+		u32 spi_bytes;
+		u32 spi_xfers;
+
+		/* histograms over all runs */
+		u64 stage_hist[MCP25XXFD_LAT_STAGES][MCP25XXFD_LAT_BUCKETS];
+		u64 spi_bytes_hist[MCP25XXFD_LAT_BUCKETS];
+		u64 spi_xfers_hist[MCP25XXFD_LAT_BUCKETS];
+		u64 spi_bytes_total;
+		u64 spi_xfers_total;
+	} lat;
+
+	/* the current status of the mcp25xxfd */
+	struct mcp25xxfd_status status;
 
 	/* configuration registers */
 	struct {
@@ -989,8 +1194,31 @@ struct mcp25xxfd_priv {
 	u8 spi_tx[MCP25XXFD_BUFFER_TXRX_SIZE];
 	u8 spi_rx[MCP25XXFD_BUFFER_TXRX_SIZE];
 
+	/* one tx queue per tx fifo - decided when opening */
+	bool tx_mq;
+	/* protects the tx masks and the tx batch in multiqueue mode */
+	spinlock_t tx_lock;
+
 	/* structure for transmit fifo spi_messages */
 	struct mcp25xxfd_trigger_tx_message *spi_transmit_fifos;
+	struct mcp25xxfd_tx_batch_message *spi_transmit_batches;
+	/* the batch that is currently collecting frames */
+	struct mcp25xxfd_tx_batch_message *tx_batch;
+
+	/* structure for the pipelined rx spi_message of the irq handler */
+	struct mcp25xxfd_irq_message *irq_message;
+
+	/* napi based delivery of received frames */
+	bool rx_napi;
+	struct napi_struct napi;
+	struct sk_buff_head rx_queue;
+	unsigned long napi_flags;
+#define MCP25XXFD_NAPI_RX_MASKED	0
+#define MCP25XXFD_NAPI_RX_UNMASKING	1
+	/* the IE bits of CAN_INT as enabled - status.intf changes with
+	 * every irq loop, so the RXIE mask/unmask writes use this one
+	 */
+	u32 int_ie;
 };
 
 /* module parameters */
@@ -1002,6 +1230,22 @@ bool use_complete_fdfifo_read;
 module_param(use_complete_fdfifo_read, bool, 0664);
 MODULE_PARM_DESC(use_complete_fdfifo_read,
 		 "Use code that favours longer spi transfers over multiple transfers for fd can");
+bool use_napi;
+module_param(use_napi, bool, 0664);
+MODULE_PARM_DESC(use_napi,
+		 "Deliver received frames via napi instead of netif_rx_ni");
+bool use_multiqueue;
+module_param(use_multiqueue, bool, 0664);
+MODULE_PARM_DESC(use_multiqueue,
+		 "Use one tx queue per tx-fifo selected by skb->priority or mqprio");
+bool use_pipelined_irq;
+module_param(use_pipelined_irq, bool, 0664);
+MODULE_PARM_DESC(use_pipelined_irq,
+		 "Read and release rx fifos plus the next status in a single spi_message");
+unsigned int spi_xfer_cost_bytes = 16;
+module_param(spi_xfer_cost_bytes, uint, 0664);
+MODULE_PARM_DESC(spi_xfer_cost_bytes,
+		 "Overhead of a single spi transfer in bytes - used to choose the fd rx read strategy");
 unsigned int tx_fifos;
 module_param(tx_fifos, uint, 0664);
 MODULE_PARM_DESC(tx_fifos, "Number of tx-fifos to configure\n");
@@ -1009,9 +1253,97 @@ unsigned int bw_sharing_log2bits;
 module_param(bw_sharing_log2bits, uint, 0664);
 MODULE_PARM_DESC(bw_sharing_log2bits,
 		 "Delay between 2 transmissions in number of arbitration bit times\n");
+unsigned int tbc_prescaler;
+module_param(tbc_prescaler, uint, 0664);
+MODULE_PARM_DESC(tbc_prescaler,
+		 "Clock cycles per timestamp tick (1-1024) - 0 selects 1us");
 bool three_shot;
 module_param(three_shot, bool, 0664);
 MODULE_PARM_DESC(three_shot, "Use 3 shots when one-shot is requested");
+bool latency_stats;
+module_param(latency_stats, bool, 0664);
+MODULE_PARM_DESC(latency_stats,
+		 "Record latency and spi cost histograms of the irq handler in debugfs");
+
+/* interrupt handler instrumentation
+ *
+ * when enabled (at open) each run of the irq handler accumulates the
+ * time spent in its stages as well as the spi bytes and transfers
+ * it issued. At the end of the run these get added to log2 histograms.
+ * The release time is part of the fifo read, so it gets subtracted
+ * from the fifo stage. With use_pipelined_irq reads and releases are
+ * a single spi_message, which is accounted as fifo read only.
+ */
+static u64 mcp25xxfd_lat_start(struct mcp25xxfd_priv *priv)
+{
+	return priv->lat.enabled ? ktime_get_ns() : 0;
+}
+
+static void mcp25xxfd_lat_stop(struct mcp25xxfd_priv *priv,
+			       enum mcp25xxfd_lat_stage stage, u64 start)
+{
+	if (priv->lat.enabled)
+		priv->lat.stage_ns[stage] += ktime_get_ns() - start;
+}
+
+static void mcp25xxfd_lat_spi(struct mcp25xxfd_priv *priv,
+			      u32 bytes, u32 xfers)
+{
+	if (priv->lat.enabled && priv->lat.irq_task == current) {
+		priv->lat.spi_bytes += bytes;
+		priv->lat.spi_xfers += xfers;
+	}
+}
+
+static void mcp25xxfd_lat_hist_add(u64 *hist, u64 val)
+{
+	hist[min_t(int, fls64(val), MCP25XXFD_LAT_BUCKETS - 1)]++;
+}
+
+static void mcp25xxfd_lat_run_start(struct mcp25xxfd_priv *priv)
+{
+	if (!priv->lat.enabled)
+		return;
+
+	priv->lat.irq_task = current;
+	memset(priv->lat.stage_ns, 0, sizeof(priv->lat.stage_ns));
+	priv->lat.spi_bytes = 0;
+	priv->lat.spi_xfers = 0;
+
+	if (priv->lat.irq_ns) {
+		priv->lat.stage_ns[MCP25XXFD_LAT_IRQ] =
+		    ktime_get_ns() - priv->lat.irq_ns;
+		priv->lat.irq_ns = 0;
+	}
+}
+
+static void mcp25xxfd_lat_run_end(struct mcp25xxfd_priv *priv)
+{
+	u64 *ns = priv->lat.stage_ns;
+	int i;
+
+	if (!priv->lat.enabled)
+		return;
+
+	priv->lat.irq_task = NULL;
+
+	/* the releases happen inside the fifo reads */
+	ns[MCP25XXFD_LAT_FIFO] -= min(ns[MCP25XXFD_LAT_FIFO],
+				      ns[MCP25XXFD_LAT_RELEASE]);
+
+	/* stages that did not run are not accounted */
+	for (i = 0; i < MCP25XXFD_LAT_STAGES; i++)
+		if (ns[i])
+			mcp25xxfd_lat_hist_add(priv->lat.stage_hist[i],
+					       ns[i]);
+
+	mcp25xxfd_lat_hist_add(priv->lat.spi_bytes_hist,
+			       priv->lat.spi_bytes);
+	mcp25xxfd_lat_hist_add(priv->lat.spi_xfers_hist,
+			       priv->lat.spi_xfers);
+	priv->lat.spi_bytes_total += priv->lat.spi_bytes;
+	priv->lat.spi_xfers_total += priv->lat.spi_xfers;
+}
 
 /* spi sync helper */
 
@@ -1020,10 +1352,15 @@ static int mcp25xxfd_sync_transfer(struct spi_device *spi,
 				   struct spi_transfer *xfer,
 				   unsigned int xfers, int speed_hz)
 {
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	u32 bytes = 0;
 	int i;
 
-	for (i = 0; i < xfers; i++)
+	for (i = 0; i < xfers; i++) {
 		xfer[i].speed_hz = speed_hz;
+		bytes += xfer[i].len;
+	}
+	mcp25xxfd_lat_spi(priv, bytes, xfers);
 
 	return spi_sync_transfer(spi, xfer, xfers);
 }
@@ -1706,7 +2043,7 @@ static void __mcp25xxfd_stop_queue(struct net_device *net, unsigned int id)
 			 priv->tx_queue_status);
 
 	priv->tx_queue_status = id ? id : TX_QUEUE_STATUS_STOPPED;
-	netif_stop_queue(priv->net);
+	netif_tx_stop_all_queues(priv->net);
 }
 
 /* helper to identify who is stopping the queue by line number */
@@ -1723,31 +2060,51 @@ static void mcp25xxfd_wake_queue(struct spi_device *spi)
 	priv->fifos.tx_processed_mask = 0;
 	priv->tx_queue_status = TX_QUEUE_STATUS_RUNNING;
 
-	/* wake queue now */
-	netif_wake_queue(priv->net);
+	/* wake queue now - a fifo reconfiguration does so when done,
+	 * a failed one leaves no tx fifos behind
+	 */
+	if (!priv->fifo_reconfig && priv->spi_transmit_fifos)
+		netif_tx_wake_all_queues(priv->net);
 }
 
 /* CAN transmit related*/
 
+/* tx batching:
+ * frames handed to us while the network stack signals that more frames
+ * are queued (xmit_more) are only filled into their tx fifo buffers.
+ * The last frame of such a burst (or the frame using the last tx fifo)
+ * submits one spi_message with all the fills followed by a single
+ * write that sets UINC + TXREQ for all the fifos of the batch.
+ * The fifos of a batch are always adjacent, as they get assigned in
+ * ascending order - so the FIFOSTA/FIFOUA registers between the
+ * FIFOCON registers are overwritten with 0 (clearing only stale tx
+ * status flags) resp. are read only.
+ * A batch with a single frame is identical to the unbatched case.
+ */
+
 static void mcp25xxfd_mark_tx_pending(void *context)
 {
-	struct mcp25xxfd_trigger_tx_message *txm = context;
-	struct spi_device *spi = txm->msg.spi;
+	struct mcp25xxfd_tx_batch_message *batch = context;
+	struct spi_device *spi = batch->msg.spi;
 	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	unsigned long flags;
 
-	/* only here or in the irq handler this value is changed,
-	 * so there is no race condition and it does not require locking
-	 * serialization happens via spi_pump_message
+	/* in single queue mode only here or in the irq handler this value
+	 * is changed, so there is no race condition and it does not require
+	 * locking - serialization happens via spi_pump_message.
+	 * In multiqueue mode the irq handler releases individual fifos,
+	 * so take the lock.
 	 */
-	priv->fifos.tx_pending_mask |= BIT(txm->fifo);
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	priv->fifos.tx_pending_mask |= batch->fifo_mask;
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
 }
 
 static int mcp25xxfd_fill_spi_transmit_fifos(struct mcp25xxfd_priv *priv)
 {
 	struct mcp25xxfd_trigger_tx_message *txm;
+	struct mcp25xxfd_tx_batch_message *batch;
 	int i, fifo;
-	const u32 trigger = CAN_FIFOCON_TXREQ | CAN_FIFOCON_UINC;
-	const int first_byte = mcp25xxfd_first_byte(trigger);
 	u32 fifo_address;
 
 	priv->spi_transmit_fifos = kcalloc(priv->fifos.tx_fifos,
@@ -1756,37 +2113,144 @@ static int mcp25xxfd_fill_spi_transmit_fifos(struct mcp25xxfd_priv *priv)
 	if (!priv->spi_transmit_fifos)
 		return -ENOMEM;
 
+	/* one batch per fifo, as a batch is identified by its first fifo */
+	priv->spi_transmit_batches =
+		kcalloc(priv->fifos.tx_fifos,
+			sizeof(*priv->spi_transmit_batches),
+			GFP_KERNEL | GFP_DMA);
+	if (!priv->spi_transmit_batches) {
+		kfree(priv->spi_transmit_fifos);
+		priv->spi_transmit_fifos = NULL;
+		return -ENOMEM;
+	}
+	priv->tx_batch = NULL;
+
 	for (i = 0; i < priv->fifos.tx_fifos; i++) {
 		fifo = priv->fifos.tx_fifo_start + i;
 		txm = &priv->spi_transmit_fifos[i];
 		fifo_address = priv->fifos.fifo_address[fifo];
-		/* prepare the message */
-		spi_message_init(&txm->msg);
-		txm->msg.complete = mcp25xxfd_mark_tx_pending;
-		txm->msg.context = txm;
 		txm->fifo = fifo;
 		/* the payload itself */
-		txm->fill_xfer.speed_hz = priv->spi_speed_hz;
 		txm->fill_xfer.tx_buf = txm->fill_cmd;
 		txm->fill_xfer.len = 2;
-		txm->fill_xfer.cs_change = true;
 		mcp25xxfd_calc_cmd_addr(INSTRUCTION_WRITE,
 					FIFO_DATA(fifo_address), txm->fill_cmd);
-		spi_message_add_tail(&txm->fill_xfer, &txm->msg);
-		/* the trigger command */
-		txm->trigger_xfer.speed_hz = priv->spi_speed_hz;
-		txm->trigger_xfer.tx_buf = txm->trigger_cmd;
-		txm->trigger_xfer.len = 3;
-		mcp25xxfd_calc_cmd_addr(INSTRUCTION_WRITE,
-					CAN_FIFOCON(fifo) + first_byte,
-					txm->trigger_cmd);
-		txm->trigger_data = trigger >> (8 * first_byte);
-		spi_message_add_tail(&txm->trigger_xfer, &txm->msg);
+		/* the batch starting with this fifo */
+		batch = &priv->spi_transmit_batches[i];
+		batch->first_fifo = fifo;
 	}
 
 	return 0;
 }
 
+static void mcp25xxfd_free_spi_transmit_fifos(struct mcp25xxfd_priv *priv)
+{
+	kfree(priv->spi_transmit_fifos);
+	priv->spi_transmit_fifos = NULL;
+	kfree(priv->spi_transmit_batches);
+	priv->spi_transmit_batches = NULL;
+	priv->tx_batch = NULL;
+}
+
+static void mcp25xxfd_tx_batch_add(struct mcp25xxfd_priv *priv,
+				   struct mcp25xxfd_trigger_tx_message *txm)
+{
+	struct mcp25xxfd_tx_batch_message *batch = priv->tx_batch;
+	struct spi_transfer *xfer;
+
+	/* start a new batch with this fifo */
+	if (!batch) {
+		batch = &priv->spi_transmit_batches[txm->fifo -
+						    priv->fifos.tx_fifo_start];
+		spi_message_init(&batch->msg);
+		batch->msg.complete = mcp25xxfd_mark_tx_pending;
+		batch->msg.context = batch;
+		batch->fifo_mask = 0;
+		batch->count = 0;
+		memset(batch->trigger_data, 0, sizeof(batch->trigger_data));
+		priv->tx_batch = batch;
+	}
+
+	/* the fill of the fifo */
+	xfer = &batch->fill_xfer[batch->count];
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->tx_buf = txm->fill_xfer.tx_buf;
+	xfer->len = txm->fill_xfer.len;
+	xfer->cs_change = true;
+	xfer->speed_hz = priv->spi_speed_hz;
+	spi_message_add_tail(xfer, &batch->msg);
+
+	/* and the corresponding FIFOCON in the trigger */
+	batch->trigger_data[FIFOCON_SPACINGW * batch->count] =
+		cpu_to_le32(priv->fifos.fifocon[txm->fifo] |
+			    CAN_FIFOCON_TXREQ | CAN_FIFOCON_UINC);
+
+	batch->fifo_mask |= BIT(txm->fifo);
+	batch->count++;
+}
+
+static int mcp25xxfd_tx_batch_submit(struct spi_device *spi)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	struct mcp25xxfd_tx_batch_message *batch = priv->tx_batch;
+	const int first_byte = mcp25xxfd_first_byte(CAN_FIFOCON_TXREQ |
+						    CAN_FIFOCON_UINC);
+	int ret;
+
+	if (!batch)
+		return 0;
+	priv->tx_batch = NULL;
+
+	/* the trigger covering all the FIFOCON of the batch */
+	memset(batch->trigger_xfer, 0, sizeof(batch->trigger_xfer));
+	mcp25xxfd_calc_cmd_addr(INSTRUCTION_WRITE,
+				CAN_FIFOCON(batch->first_fifo) + first_byte,
+				batch->trigger_cmd);
+	batch->trigger_xfer[0].tx_buf = batch->trigger_cmd;
+	batch->trigger_xfer[0].len = 2;
+	batch->trigger_xfer[0].speed_hz = priv->spi_speed_hz;
+	spi_message_add_tail(&batch->trigger_xfer[0], &batch->msg);
+	batch->trigger_xfer[1].tx_buf = (u8 *)batch->trigger_data + first_byte;
+	batch->trigger_xfer[1].len = 1 + (batch->count - 1) * FIFOCON_SPACING;
+	batch->trigger_xfer[1].speed_hz = priv->spi_speed_hz;
+	spi_message_add_tail(&batch->trigger_xfer[1], &batch->msg);
+
+	priv->stats.tx_batches++;
+	priv->stats.tx_batch_frames += batch->count;
+
+	/* and transmit asyncroniously */
+	ret = spi_async(spi, &batch->msg);
+	if (ret) {
+		int fifo;
+
+		/* the frames of this batch are lost */
+		for (fifo = 0; fifo < 32; fifo++) {
+			if (!(batch->fifo_mask & BIT(fifo)))
+				continue;
+			can_free_echo_skb(priv->net, fifo);
+			priv->net->stats.tx_dropped++;
+			/* tx_lock is held already in multiqueue mode */
+			if (priv->tx_mq && !priv->fifo_reconfig)
+				netif_wake_subqueue(priv->net,
+						    fifo - priv->fifos.tx_fifo_start);
+		}
+		priv->fifos.tx_submitted_mask &= ~batch->fifo_mask;
+
+		/* the queue may have been stopped for the last fifo of the
+		 * batch - nothing would wake it again
+		 */
+		if (!priv->tx_mq &&
+		    priv->tx_queue_status >= TX_QUEUE_STATUS_STOPPED &&
+		    priv->can.state != CAN_STATE_BUS_OFF) {
+			priv->tx_queue_status = TX_QUEUE_STATUS_RUNNING;
+			if (!priv->fifo_reconfig)
+				netif_tx_wake_all_queues(priv->net);
+		}
+	}
+
+	return ret;
+}
+
 static int mcp25xxfd_transmit_message_common(struct spi_device *spi,
 					     int fifo,
 					     struct mcp25xxfd_obj_tx *obj,
@@ -1795,7 +2259,6 @@ static int mcp25xxfd_transmit_message_common(struct spi_device *spi,
 	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
 	struct mcp25xxfd_trigger_tx_message *txm =
 	    &priv->spi_transmit_fifos[fifo - priv->fifos.tx_fifo_start];
-	int ret;
 
 	/* add fifo as seq */
 	obj->header.flags |= fifo << CAN_OBJ_FLAGS_SEQ_SHIFT;
@@ -1812,10 +2275,8 @@ static int mcp25xxfd_transmit_message_common(struct spi_device *spi,
 	txm->fill_xfer.len =
 	    2 + sizeof(struct mcp25xxfd_obj_tx) + ALIGN(len, 4);
 
-	/* and transmit asyncroniously */
-	ret = spi_async(spi, &txm->msg);
-	if (ret)
-		return NETDEV_TX_BUSY;
+	/* and add it to the batch - submission happens later */
+	mcp25xxfd_tx_batch_add(priv, txm);
 
 	return NETDEV_TX_OK;
 }
@@ -1882,23 +2343,143 @@ static bool mcp25xxfd_is_last_txfifo(struct spi_device *spi, int fifo)
 	return (fifo == (priv->fifos.tx_fifo_start + priv->fifos.tx_fifos - 1));
 }
 
+/* multiqueue mode:
+ * queue i owns tx fifo tx_fifo_start + i, whose TXPRI is i, so frames
+ * in higher queues win the arbitration inside the controller against
+ * frames in lower queues.
+ * As a fifo holds a single frame the queue gets stopped on each frame
+ * and woken once its TEF entry (or the abort) got processed.
+ * Batching does not apply, as each queue only ever has a single frame.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 2, 0)
+static u16 mcp25xxfd_select_queue(struct net_device *net,
+				  struct sk_buff *skb,
+				  struct net_device *sb_dev)
+#else
+static u16 mcp25xxfd_select_queue(struct net_device *net,
+				  struct sk_buff *skb,
+				  struct net_device *sb_dev,
+				  select_queue_fallback_t fallback)
+#endif
+{
+	int tc;
+
+	/* mqprio maps priority to traffic classes and those to queues */
+	if (netdev_get_num_tc(net)) {
+		tc = netdev_get_prio_tc_map(net, skb->priority);
+		return net->tc_to_txq[tc].offset;
+	}
+
+	return min_t(u32, skb->priority, net->real_num_tx_queues - 1);
+}
+#endif
+
+static void mcp25xxfd_tx_mq_release(struct mcp25xxfd_priv *priv, int fifo)
+{
+	unsigned long flags;
+
+	if (!priv->tx_mq)
+		return;
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	priv->fifos.tx_submitted_mask &= ~BIT(fifo);
+	priv->fifos.tx_pending_mask &= ~BIT(fifo);
+	priv->fifos.tx_processed_mask &= ~BIT(fifo);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+
+	if (!priv->fifo_reconfig)
+		netif_wake_subqueue(priv->net,
+				    fifo - priv->fifos.tx_fifo_start);
+}
+
+static netdev_tx_t mcp25xxfd_start_xmit_mq(struct sk_buff *skb,
+					   struct net_device *net)
+{
+	struct mcp25xxfd_priv *priv = netdev_priv(net);
+	struct spi_device *spi = priv->spi;
+	u16 queue = skb_get_queue_mapping(skb);
+	int fifo = priv->fifos.tx_fifo_start + queue;
+	unsigned long flags;
+	int ret;
+
+	netif_stop_subqueue(net, queue);
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+
+	/* handle error - this should not happen... */
+	if ((priv->fifos.tx_submitted_mask | priv->fifos.tx_pending_mask) &
+	    BIT(fifo)) {
+		spin_unlock_irqrestore(&priv->tx_lock, flags);
+		dev_err(&spi->dev, "tx-fifo %i is still in use\n", fifo);
+		return NETDEV_TX_BUSY;
+	}
+
+	/* mark as submitted */
+	priv->fifos.tx_submitted_mask |= BIT(fifo);
+	priv->stats.fifo_usage[fifo]++;
+
+	/* now process it for real */
+	if (can_is_canfd_skb(skb))
+		ret = mcp25xxfd_transmit_fdmessage(spi, fifo,
+						   (struct canfd_frame *)
+						   skb->data);
+	else
+		ret = mcp25xxfd_transmit_message(spi, fifo, (struct can_frame *)
+						 skb->data);
+
+	/* keep it for reference until the message really got transmitted */
+	if (ret == NETDEV_TX_OK)
+		can_put_echo_skb(skb, priv->net, fifo);
+
+	mcp25xxfd_tx_batch_submit(spi);
+
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+
+	return ret;
+}
+
 static netdev_tx_t mcp25xxfd_start_xmit(struct sk_buff *skb,
 					struct net_device *net)
 {
 	struct mcp25xxfd_priv *priv = netdev_priv(net);
 	struct spi_device *spi = priv->spi;
 	u32 pending_mask;
+	bool last;
 	int fifo;
 	int ret;
 
-	if (can_dropped_invalid_skb(net, skb))
+	if (can_dropped_invalid_skb(net, skb)) {
+		ret = NETDEV_TX_OK;
+		goto out;
+	}
+
+	/* the fifo layout may use a payload size below the mtu */
+	if (can_is_canfd_skb(skb) &&
+	    ((struct canfd_frame *)skb->data)->len >
+	    priv->fifos.payload_size) {
+		net->stats.tx_dropped++;
+		kfree_skb(skb);
+		ret = NETDEV_TX_OK;
+		goto out;
+	}
+
+	/* no tx fifos after a failed reconfiguration */
+	if (!priv->spi_transmit_fifos) {
+		net->stats.tx_dropped++;
+		kfree_skb(skb);
 		return NETDEV_TX_OK;
+	}
 
 	if (priv->can.state == CAN_STATE_BUS_OFF) {
 		mcp25xxfd_stop_queue(priv->net);
-		return NETDEV_TX_BUSY;
+		ret = NETDEV_TX_BUSY;
+		goto out;
 	}
 
+	if (priv->tx_mq)
+		return mcp25xxfd_start_xmit_mq(skb, net);
+
 	/* get effective mask */
 	pending_mask = priv->fifos.tx_pending_mask |
 	    priv->fifos.tx_submitted_mask;
@@ -1913,11 +2494,13 @@ static netdev_tx_t mcp25xxfd_start_xmit(struct sk_buff *skb,
 	if (fifo >= priv->fifos.tx_fifo_start + priv->fifos.tx_fifos) {
 		dev_err(&spi->dev,
 			"reached tx-fifo %i, which is not valid\n", fifo);
-		return NETDEV_TX_BUSY;
+		ret = NETDEV_TX_BUSY;
+		goto out;
 	}
 
 	/* if we are the last one, then stop the queue */
-	if (mcp25xxfd_is_last_txfifo(spi, fifo))
+	last = mcp25xxfd_is_last_txfifo(spi, fifo);
+	if (last)
 		mcp25xxfd_stop_queue(priv->net);
 
 	/* mark as submitted */
@@ -1937,85 +2520,428 @@ static netdev_tx_t mcp25xxfd_start_xmit(struct sk_buff *skb,
 	if (ret == NETDEV_TX_OK)
 		can_put_echo_skb(skb, priv->net, fifo);
 
+	/* submit the batch unless more frames are about to follow */
+	if (!last && mcp25xxfd_xmit_more(skb))
+		return ret;
+
+out:
+	/* the early exits too - a batch left behind would never be sent.
+	 * Multiqueue mode submits every frame under tx_lock, so there is
+	 * nothing to flush and the batch must not be touched unlocked.
+	 */
+	if (!priv->tx_mq)
+		mcp25xxfd_tx_batch_submit(spi);
+
 	return ret;
 }
 
-/* CAN RX Related */
-
-static int mcp25xxfd_can_transform_rx_fd(struct spi_device *spi,
-					 struct mcp25xxfd_obj_rx *rx)
+/* hardware timestamps:
+ * only the lower 24 bits of the TBC are valid in the objects (the
+ * highest byte is not read for the TEF - see addto_queued_fifos), so a
+ * 24 bit cyclecounter is used whose timecounter starts at system time.
+ * A worker reads the TBC at least 4 times per wrap (but at least every
+ * second), keeps the timecounter up to date and corrects phase and
+ * frequency against CLOCK_REALTIME - stepping it if the offset exceeds
+ * MCP25XXFD_TSTAMP_STEP_NS.
+ * The resulting time is stored in skb_hwtstamps of rx and echo frames.
+ */
+#define MCP25XXFD_TSTAMP_BITS 24
+#define MCP25XXFD_TSTAMP_STEP_NS NSEC_PER_MSEC
+#define MCP25XXFD_TSTAMP_MAX_PPB 500000
+/* a TBC read queued behind other spi transfers gives no usable sample */
+#define MCP25XXFD_TSTAMP_READ_NS (50 * NSEC_PER_USEC)
+#define MCP25XXFD_TSTAMP_READ_TRIES 4
+
+static u64 mcp25xxfd_tstamp_cc_read(const struct cyclecounter *cc)
 {
-	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
-	struct canfd_frame *frame;
-	struct sk_buff *skb;
-	u32 flags = rx->header.flags;
-	int dlc;
+	struct mcp25xxfd_priv *priv = container_of(cc, struct mcp25xxfd_priv,
+						   tstamp.cc);
 
-	/* allocate the skb buffer */
-	skb = alloc_canfd_skb(priv->net, &frame);
-	if (!skb) {
-		dev_err(&spi->dev, "cannot allocate RX skb\n");
-		priv->net->stats.rx_dropped++;
-		return -ENOMEM;
-	}
+	return priv->tstamp.tbc;
+}
 
-	mcp25xxfd_mcpid_to_canid(rx->header.id, flags, &frame->can_id);
-	frame->flags |= (flags & CAN_OBJ_FLAGS_BRS) ? CANFD_BRS : 0;
-	frame->flags |= (flags & CAN_OBJ_FLAGS_ESI) ? CANFD_ESI : 0;
+/* ts is the object timestamp already shifted by addto_queued_fifos */
+static void mcp25xxfd_tstamp_set(struct mcp25xxfd_priv *priv,
+				 struct sk_buff *skb, u32 ts)
+{
+	struct skb_shared_hwtstamps *hwts = skb_hwtstamps(skb);
+	unsigned long flags;
+	u64 ns;
 
-	dlc = (flags & CAN_OBJ_FLAGS_DLC_MASK) >> CAN_OBJ_FLAGS_DLC_SHIFT;
-	frame->len = can_dlc2len(dlc);
+	spin_lock_irqsave(&priv->tstamp.lock, flags);
+	ns = timecounter_cyc2time(&priv->tstamp.tc,
+				  ts >> (32 - MCP25XXFD_TSTAMP_BITS));
+	spin_unlock_irqrestore(&priv->tstamp.lock, flags);
 
-	memcpy(frame->data, rx->data, frame->len);
+	memset(hwts, 0, sizeof(*hwts));
+	hwts->hwtstamp = ns_to_ktime(ns);
+}
 
-	priv->stats.rx_fd_count++;
-	priv->net->stats.rx_packets++;
-	priv->net->stats.rx_bytes += frame->len;
-	if (rx->header.flags & CAN_OBJ_FLAGS_BRS)
-		priv->stats.rx_brs_count++;
-	priv->stats.rx_dlc_usage[dlc]++;
+/* the sample of the fastest of some tries - -EAGAIN if even that one
+ * took longer than MCP25XXFD_TSTAMP_READ_NS
+ */
+static int mcp25xxfd_tstamp_read_tbc(struct mcp25xxfd_priv *priv,
+				     u32 *tbc, u64 *sys)
+{
+	u64 before, after, best = U64_MAX;
+	u32 val;
+	int i, ret;
 
-	can_led_event(priv->net, CAN_LED_EVENT_RX);
+	for (i = 0; i < MCP25XXFD_TSTAMP_READ_TRIES; i++) {
+		before = ktime_get_real_ns();
+		ret = mcp25xxfd_cmd_read(priv->spi, CAN_TBC, &val,
+					 priv->spi_speed_hz);
+		after = ktime_get_real_ns();
+		if (ret)
+			return ret;
 
-	netif_rx_ni(skb);
+		/* the system time in the middle of the spi transfer */
+		if (after - before < best) {
+			best = after - before;
+			*tbc = val;
+			*sys = before + best / 2;
+		}
+		if (best <= MCP25XXFD_TSTAMP_READ_NS)
+			return 0;
+	}
 
-	return 0;
+	return -EAGAIN;
 }
 
-static int mcp25xxfd_can_transform_rx_normal(struct spi_device *spi,
-					     struct mcp25xxfd_obj_rx *rx)
+static void mcp25xxfd_tstamp_work(struct work_struct *work)
 {
-	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
-	struct sk_buff *skb;
-	struct can_frame *frame;
-	u32 flags = rx->header.flags;
-	int len;
-	int dlc;
+	struct mcp25xxfd_priv *priv =
+	    container_of(to_delayed_work(work), struct mcp25xxfd_priv,
+			 tstamp.work);
+	u64 period_ns = (u64)priv->tstamp.period_ms * NSEC_PER_MSEC;
+	unsigned long flags;
+	s64 offset, adj;
+	u64 sys;
+	u32 tbc;
+	int ret;
 
-	/* allocate the skb buffer */
-	skb = alloc_can_skb(priv->net, &frame);
-	if (!skb) {
-		dev_err(&spi->dev, "cannot allocate RX skb\n");
-		priv->net->stats.rx_dropped++;
-		return -ENOMEM;
+	ret = mcp25xxfd_tstamp_read_tbc(priv, &tbc, &sys);
+	if (ret) {
+		if (ret == -EAGAIN)
+			priv->stats.tstamp_slow_reads++;
+		goto out;
 	}
 
-	mcp25xxfd_mcpid_to_canid(rx->header.id, flags, &frame->can_id);
+	spin_lock_irqsave(&priv->tstamp.lock, flags);
 
-	dlc = (flags & CAN_OBJ_FLAGS_DLC_MASK) >> CAN_OBJ_FLAGS_DLC_SHIFT;
-	frame->can_dlc = dlc;
+	priv->tstamp.tbc = tbc & priv->tstamp.cc.mask;
+	offset = sys - timecounter_read(&priv->tstamp.tc);
 
-	len = can_dlc2len(frame->can_dlc);
+	if (offset > MCP25XXFD_TSTAMP_STEP_NS ||
+	    offset < -MCP25XXFD_TSTAMP_STEP_NS) {
+		priv->tstamp.adj_ppb = 0;
+		priv->tstamp.cc.mult = priv->tstamp.base_mult;
+		timecounter_init(&priv->tstamp.tc, &priv->tstamp.cc, sys);
+		priv->stats.tstamp_steps++;
+	} else {
+		/* integrate the offset into the frequency correction */
+		adj = priv->tstamp.adj_ppb +
+		    div64_s64(offset * NSEC_PER_SEC, period_ns) / 8;
+		priv->tstamp.adj_ppb = clamp_t(s64, adj,
+					       -MCP25XXFD_TSTAMP_MAX_PPB,
+					       MCP25XXFD_TSTAMP_MAX_PPB);
+		priv->tstamp.cc.mult = priv->tstamp.base_mult +
+		    div_s64((s64)priv->tstamp.base_mult *
+			    priv->tstamp.adj_ppb, NSEC_PER_SEC);
+		/* and slew a quarter of the phase */
+		timecounter_adjtime(&priv->tstamp.tc, offset / 4);
+	}
 
-	memcpy(frame->data, rx->data, len);
+	spin_unlock_irqrestore(&priv->tstamp.lock, flags);
 
-	priv->net->stats.rx_packets++;
-	priv->net->stats.rx_bytes += len;
-	priv->stats.rx_dlc_usage[dlc]++;
+out:
+	schedule_delayed_work(&priv->tstamp.work,
+			      msecs_to_jiffies(priv->tstamp.period_ms));
+}
+
+/* (re)start the timecounter once the TBC is running */
+static int mcp25xxfd_tstamp_start(struct mcp25xxfd_priv *priv)
+{
+	u32 freq = priv->can.clock.freq / priv->tstamp.prescaler;
+	struct cyclecounter *cc = &priv->tstamp.cc;
+	unsigned long flags;
+	u64 sys;
+	u32 tbc;
+	int ret;
+
+	/* a slow sample is good enough to start with - the worker steps */
+	ret = mcp25xxfd_tstamp_read_tbc(priv, &tbc, &sys);
+	if (ret && ret != -EAGAIN)
+		return ret;
+
+	spin_lock_irqsave(&priv->tstamp.lock, flags);
+
+	cc->read = mcp25xxfd_tstamp_cc_read;
+	cc->mask = CYCLECOUNTER_MASK(MCP25XXFD_TSTAMP_BITS);
+	clocks_calc_mult_shift(&cc->mult, &cc->shift, freq, NSEC_PER_SEC,
+			       DIV_ROUND_UP(BIT(MCP25XXFD_TSTAMP_BITS), freq));
+	priv->tstamp.base_mult = cc->mult;
+	priv->tstamp.adj_ppb = 0;
+	priv->tstamp.tbc = tbc & cc->mask;
+	timecounter_init(&priv->tstamp.tc, cc, sys);
+
+	/* at least 4 reads per wrap of the counter */
+	priv->tstamp.period_ms =
+	    clamp_t(u32, div_u64(BIT_ULL(MCP25XXFD_TSTAMP_BITS) * MSEC_PER_SEC,
+				 freq) / 4, 1, MSEC_PER_SEC);
+
+	spin_unlock_irqrestore(&priv->tstamp.lock, flags);
+
+	mod_delayed_work(system_wq, &priv->tstamp.work,
+			 msecs_to_jiffies(priv->tstamp.period_ms));
+
+	return 0;
+}
+
+static int mcp25xxfd_get_ts_info(struct net_device *net,
+				 struct ethtool_ts_info *info)
+{
+	info->so_timestamping = SOF_TIMESTAMPING_TX_SOFTWARE |
+	    SOF_TIMESTAMPING_RX_SOFTWARE |
+	    SOF_TIMESTAMPING_SOFTWARE |
+	    SOF_TIMESTAMPING_RX_HARDWARE |
+	    SOF_TIMESTAMPING_RAW_HARDWARE;
+	info->phc_index = -1;
+	info->tx_types = BIT(HWTSTAMP_TX_OFF);
+	info->rx_filters = BIT(HWTSTAMP_FILTER_ALL);
+
+	return 0;
+}
+
+static const struct ethtool_ops mcp25xxfd_ethtool_ops = {
+	.get_ts_info = mcp25xxfd_get_ts_info,
+};
+
+/* CAN RX Related */
+
+/* napi mode:
+ * all spi transfers need to happen in the threaded irq handler, as
+ * spi_sync may sleep, so the irq handler still reads the fifos, but
+ * instead of calling netif_rx_ni for each frame it queues the skbs
+ * (already in timestamp order) and schedules napi, which delivers them
+ * to the network stack within its budget.
+ * If the backlog grows beyond MCP25XXFD_NAPI_BACKLOG the irq handler
+ * masks RXIE and leaves the frames in the controller fifos until
+ * the poll function has drained the backlog and re-enabled RXIE via
+ * spi_async.
+ */
+#define MCP25XXFD_NAPI_BACKLOG (2 * NAPI_POLL_WEIGHT)
+
+static void mcp25xxfd_rx_skb(struct mcp25xxfd_priv *priv,
+			     struct sk_buff *skb)
+{
+	if (priv->rx_napi)
+		skb_queue_tail(&priv->rx_queue, skb);
+	else
+		netif_rx_ni(skb);
+}
+
+static void mcp25xxfd_rxie_unmasked(void *context)
+{
+	struct mcp25xxfd_priv *priv = context;
+
+	clear_bit(MCP25XXFD_NAPI_RX_MASKED, &priv->napi_flags);
+	clear_bit(MCP25XXFD_NAPI_RX_UNMASKING, &priv->napi_flags);
+}
+
+/* re-enable RXIE - only the IE byte of CAN_INT gets written,
+ * so this does not interfere with flag clearing in the irq handler
+ */
+static void mcp25xxfd_napi_unmask_rx(struct mcp25xxfd_priv *priv)
+{
+	struct mcp25xxfd_irq_message *im = priv->irq_message;
+	const int first_byte = mcp25xxfd_first_byte(CAN_INT_RXIE);
+
+	/* gone after a failed fifo reconfiguration */
+	if (!im)
+		return;
+
+	if (test_and_set_bit(MCP25XXFD_NAPI_RX_UNMASKING, &priv->napi_flags))
+		return;
+
+	spi_message_init(&im->rxie_msg);
+	im->rxie_msg.complete = mcp25xxfd_rxie_unmasked;
+	im->rxie_msg.context = priv;
+	memset(&im->rxie_xfer, 0, sizeof(im->rxie_xfer));
+	mcp25xxfd_calc_cmd_addr(INSTRUCTION_WRITE, CAN_INT + first_byte,
+				im->rxie_cmd);
+	im->rxie_cmd[2] = (priv->int_ie | CAN_INT_RXIE) >> (8 * first_byte);
+	im->rxie_xfer.tx_buf = im->rxie_cmd;
+	im->rxie_xfer.len = 3;
+	im->rxie_xfer.speed_hz = priv->spi_speed_hz;
+	spi_message_add_tail(&im->rxie_xfer, &im->rxie_msg);
+
+	if (spi_async(priv->spi, &im->rxie_msg))
+		clear_bit(MCP25XXFD_NAPI_RX_UNMASKING, &priv->napi_flags);
+}
+
+static int mcp25xxfd_napi_poll(struct napi_struct *napi, int budget)
+{
+	struct mcp25xxfd_priv *priv = container_of(napi,
+						   struct mcp25xxfd_priv,
+						   napi);
+	struct sk_buff *skb;
+	int work_done = 0;
+
+	priv->stats.rx_napi_polls++;
+
+	while (work_done < budget) {
+		skb = skb_dequeue(&priv->rx_queue);
+		if (!skb)
+			break;
+		netif_receive_skb(skb);
+		work_done++;
+	}
+
+	if (work_done < budget) {
+		napi_complete_done(napi, work_done);
+		/* backlog is drained, so let the controller interrupt again */
+		if (test_bit(MCP25XXFD_NAPI_RX_MASKED, &priv->napi_flags))
+			mcp25xxfd_napi_unmask_rx(priv);
+	}
+
+	return work_done;
+}
+
+/* called by the irq handler after each loop */
+static int mcp25xxfd_napi_schedule(struct spi_device *spi)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	const int first_byte = mcp25xxfd_first_byte(CAN_INT_RXIE);
+	int ret = 0;
+
+	if (!priv->rx_napi || skb_queue_empty(&priv->rx_queue))
+		return 0;
+
+	/* mask RXIE if the backlog is too big - unless the fifos are
+	 * drained for a reconfiguration
+	 */
+	if (skb_queue_len(&priv->rx_queue) >= MCP25XXFD_NAPI_BACKLOG &&
+	    !priv->fifo_reconfig &&
+	    !test_and_set_bit(MCP25XXFD_NAPI_RX_MASKED, &priv->napi_flags)) {
+		priv->stats.rx_napi_masked++;
+		ret = mcp25xxfd_cmd_write_mask(spi, CAN_INT,
+					       priv->int_ie & ~CAN_INT_RXIE,
+					       0xff << (8 * first_byte),
+					       priv->spi_speed_hz);
+	}
+
+	/* trigger the softirq right away */
+	local_bh_disable();
+	napi_schedule(&priv->napi);
+	local_bh_enable();
+
+	return ret;
+}
+
+/* the recent dlc histogram gets halved after this many frames */
+#define MCP25XXFD_RX_DLC_DECAY_FRAMES 256
+
+static void mcp25xxfd_rx_dlc_account(struct mcp25xxfd_priv *priv, int dlc)
+{
+	int i;
+
+	priv->stats.rx_dlc_usage[dlc]++;
+	priv->rx_read.dlc_recent[dlc]++;
+
+	/* age the histogram so that it follows the current traffic */
+	if (++priv->rx_read.dlc_recent_frames < MCP25XXFD_RX_DLC_DECAY_FRAMES)
+		return;
+
+	for (i = 0; i < 16; i++)
+		priv->rx_read.dlc_recent[i] >>= 1;
+	priv->rx_read.dlc_recent_frames = 0;
+}
+
+static int mcp25xxfd_can_transform_rx_fd(struct spi_device *spi,
+					 struct mcp25xxfd_obj_rx *rx)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	struct canfd_frame *frame;
+	struct sk_buff *skb;
+	u32 flags = rx->header.flags;
+	int dlc;
+
+	/* allocate the skb buffer */
+	skb = alloc_canfd_skb(priv->net, &frame);
+	if (!skb) {
+		dev_err(&spi->dev, "cannot allocate RX skb\n");
+		priv->net->stats.rx_dropped++;
+		return -ENOMEM;
+	}
+
+	mcp25xxfd_mcpid_to_canid(rx->header.id, flags, &frame->can_id);
+	frame->flags |= (flags & CAN_OBJ_FLAGS_BRS) ? CANFD_BRS : 0;
+	frame->flags |= (flags & CAN_OBJ_FLAGS_ESI) ? CANFD_ESI : 0;
+
+	dlc = (flags & CAN_OBJ_FLAGS_DLC_MASK) >> CAN_OBJ_FLAGS_DLC_SHIFT;
+	frame->len = can_dlc2len(dlc);
+
+	/* the controller only stores payload_size bytes of longer frames */
+	if (frame->len > priv->fifos.payload_size) {
+		kfree_skb(skb);
+		priv->net->stats.rx_length_errors++;
+		priv->net->stats.rx_errors++;
+		return 0;
+	}
+
+	memcpy(frame->data, rx->data, frame->len);
+
+	priv->stats.rx_fd_count++;
+	priv->net->stats.rx_packets++;
+	priv->net->stats.rx_bytes += frame->len;
+	if (rx->header.flags & CAN_OBJ_FLAGS_BRS)
+		priv->stats.rx_brs_count++;
+	mcp25xxfd_rx_dlc_account(priv, dlc);
+	mcp25xxfd_tstamp_set(priv, skb, rx->header.ts);
+
+	can_led_event(priv->net, CAN_LED_EVENT_RX);
+
+	mcp25xxfd_rx_skb(priv, skb);
+
+	return 0;
+}
+
+static int mcp25xxfd_can_transform_rx_normal(struct spi_device *spi,
+					     struct mcp25xxfd_obj_rx *rx)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	struct sk_buff *skb;
+	struct can_frame *frame;
+	u32 flags = rx->header.flags;
+	int len;
+	int dlc;
+
+	/* allocate the skb buffer */
+	skb = alloc_can_skb(priv->net, &frame);
+	if (!skb) {
+		dev_err(&spi->dev, "cannot allocate RX skb\n");
+		priv->net->stats.rx_dropped++;
+		return -ENOMEM;
+	}
+
+	mcp25xxfd_mcpid_to_canid(rx->header.id, flags, &frame->can_id);
+
+	dlc = (flags & CAN_OBJ_FLAGS_DLC_MASK) >> CAN_OBJ_FLAGS_DLC_SHIFT;
+	frame->can_dlc = dlc;
+
+	len = can_dlc2len(frame->can_dlc);
+
+	memcpy(frame->data, rx->data, len);
+
+	priv->net->stats.rx_packets++;
+	priv->net->stats.rx_bytes += len;
+	mcp25xxfd_rx_dlc_account(priv, dlc);
+	mcp25xxfd_tstamp_set(priv, skb, rx->header.ts);
 
 	can_led_event(priv->net, CAN_LED_EVENT_RX);
 
-	netif_rx_ni(skb);
+	mcp25xxfd_rx_skb(priv, skb);
 
 	return 0;
 }
@@ -2078,8 +3004,18 @@ static int mcp25xxfd_normal_release_fifos(struct spi_device *spi,
  * less effcient the optimization - the above case is border line.
  */
 
-#define FIFOCON_SPACING (CAN_FIFOCON(1) - CAN_FIFOCON(0))
-#define FIFOCON_SPACINGW (FIFOCON_SPACING / sizeof(u32))
+/* the FIFOCON value of a rx fifo without FRESET/UINC */
+static u32 mcp25xxfd_rx_fifocon(struct mcp25xxfd_priv *priv, int fifo)
+{
+	return (priv->fifos.payload_mode << CAN_FIFOCON_PLSIZE_SHIFT) |
+	    ((priv->fifos.rx_fifo_depth - 1) << CAN_FIFOCON_FSIZE_SHIFT) |
+	    CAN_FIFOCON_RXTSEN |	/* RX timestamps */
+	    CAN_FIFOCON_TFERFFIE |	/* FIFO Full */
+	    CAN_FIFOCON_TFHRFHIE |	/* FIFO Half Full */
+	    CAN_FIFOCON_TFNRFNIE |	/* FIFO not empty */
+	    ((priv->fifos.rx_ovie_mask & BIT(fifo)) ?
+	     CAN_FIFOCON_RXOVIE : 0);
+}
 
 static int mcp25xxfd_bulk_release_fifos(struct spi_device *spi,
 					int start, int end)
@@ -2095,19 +3031,13 @@ static int mcp25xxfd_bulk_release_fifos(struct spi_device *spi,
 	int len = 1 + (fifos - 1) * FIFOCON_SPACING;
 
 	/* the worsted case buffer */
-	u32 buf[32 * FIFOCON_SPACINGW], base;
-
-	base = (priv->fifos.payload_mode << CAN_FIFOCON_PLSIZE_SHIFT) | ((priv->fifos.rx_fifo_depth - 1) << CAN_FIFOCON_FSIZE_SHIFT) | CAN_FIFOCON_RXTSEN |	/* RX timestamps */
-	    CAN_FIFOCON_UINC | CAN_FIFOCON_TFERFFIE |	/* FIFO Full */
-	    CAN_FIFOCON_TFHRFHIE |	/* FIFO Half Full */
-	    CAN_FIFOCON_TFNRFNIE;	/* FIFO not empty */
+	u32 buf[32 * FIFOCON_SPACINGW];
 
 	memset(buf, 0, sizeof(buf));
-	for (i = 0; i < end - start; i++) {
-		if (i == priv->fifos.rx_fifos - 1)
-			base |= CAN_FIFOCON_RXOVIE;
-		buf[FIFOCON_SPACINGW * i] = cpu_to_le32(base);
-	}
+	for (i = 0; i < end - start; i++)
+		buf[FIFOCON_SPACINGW * i] =
+		    cpu_to_le32(mcp25xxfd_rx_fifocon(priv, start + i) |
+				CAN_FIFOCON_UINC);
 
 	ret = mcp25xxfd_cmd_writen(spi, addr + first_byte,
 				   (u8 *) buf + first_byte,
@@ -2124,8 +3054,16 @@ static void mcp25xxfd_clear_queued_fifos(struct spi_device *spi)
 {
 	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
 
-	/* prepare rfi - mostly used for sorting */
+	/* prepare rfi - mostly used for merging */
 	priv->queued_fifos.rx_count = 0;
+	priv->queued_fifos.run_count = 0;
+}
+
+/* timestamp comparison that handles rollover correctly */
+static bool mcp25xxfd_obj_ts_before(const struct mcp25xxfd_obj_ts *a,
+				    const struct mcp25xxfd_obj_ts *b)
+{
+	return (s32)(a->ts - b->ts) < 0;
 }
 
 static void mcp25xxfd_addto_queued_fifos(struct spi_device *spi,
@@ -2139,11 +3077,46 @@ static void mcp25xxfd_addto_queued_fifos(struct spi_device *spi,
 	 */
 	obj->ts <<= 8;
 
+	if (WARN_ON_ONCE(rfi->rx_count >= MCP25XXFD_QUEUED_FIFOS_MAX))
+		return;
+
+	/* the TEF and each fifo deliver their objects in timestamp order,
+	 * so start a new run only if the order breaks
+	 */
+	if (!rfi->rx_count ||
+	    mcp25xxfd_obj_ts_before(obj, rfi->rxb[rfi->rx_count - 1]))
+		rfi->run_start[rfi->run_count++] = rfi->rx_count;
+
 	/* add pointer to queued array-list */
 	rfi->rxb[rfi->rx_count] = obj;
 	rfi->rx_count++;
 }
 
+/* deliver the echo skb with the TEF timestamp
+ * - in napi mode in order with the rx frames
+ */
+static void mcp25xxfd_tx_echo(struct mcp25xxfd_priv *priv, int fifo, u32 ts)
+{
+	struct sk_buff *skb = priv->can.echo_skb[fifo];
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+	u8 len;
+#endif
+
+	if (skb)
+		mcp25xxfd_tstamp_set(priv, skb, ts);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 20, 0)
+
+	if (priv->rx_napi) {
+		skb = __can_get_echo_skb(priv->net, fifo, &len);
+		if (skb)
+			mcp25xxfd_rx_skb(priv, skb);
+		return;
+	}
+#endif
+	can_get_echo_skb(priv->net, fifo);
+}
+
 static int mcp25xxfd_process_queued_tef(struct spi_device *spi,
 					struct mcp25xxfd_obj_ts *obj)
 {
@@ -2166,45 +3139,75 @@ static int mcp25xxfd_process_queued_tef(struct spi_device *spi,
 	priv->stats.tx_dlc_usage[dlc]++;
 
 	/* release it */
-	can_get_echo_skb(priv->net, fifo);
+	mcp25xxfd_tx_echo(priv, fifo, tef->header.ts);
+	mcp25xxfd_tx_mq_release(priv, fifo);
 
 	can_led_event(priv->net, CAN_LED_EVENT_TX);
 
 	return 0;
 }
 
-static int mcp25xxfd_compare_obj_ts(const void *a, const void *b)
+/* merge the runs of queued objects pairwise until a single run is left
+ * returns the array that contains the objects in timestamp order
+ */
+static struct mcp25xxfd_obj_ts **
+mcp25xxfd_merge_queued_fifos(struct mcp25xxfd_read_fifo_info *rfi)
 {
-	const struct mcp25xxfd_obj_ts *const *rxa = a;
-	const struct mcp25xxfd_obj_ts *const *rxb = b;
-	/* using signed here to handle rollover correctly */
-	s32 ats = (*rxa)->ts;
-	s32 bts = (*rxb)->ts;
+	struct mcp25xxfd_obj_ts **src = rfi->rxb;
+	struct mcp25xxfd_obj_ts **dst = rfi->merged;
+	struct mcp25xxfd_obj_ts **tmp;
+	int *runs = rfi->run_start;
+	int count = rfi->run_count;
+	int r, w, i, a, a_end, b, b_end;
+
+	while (count > 1) {
+		for (r = 0, w = 0; r < count; r += 2, w++) {
+			a = runs[r];
+			a_end = (r + 1 < count) ? runs[r + 1] : rfi->rx_count;
+			b = a_end;
+			b_end = (r + 2 < count) ? runs[r + 2] : rfi->rx_count;
+
+			/* the merged run starts where the first one did */
+			runs[w] = a;
+
+			for (i = a; a < a_end && b < b_end; i++) {
+				if (mcp25xxfd_obj_ts_before(src[b], src[a]))
+					dst[i] = src[b++];
+				else
+					dst[i] = src[a++];
+			}
+			while (a < a_end)
+				dst[i++] = src[a++];
+			while (b < b_end)
+				dst[i++] = src[b++];
+		}
+		count = w;
 
-	if (ats < bts)
-		return -1;
-	if (ats > bts)
-		return 1;
-	return 0;
+		tmp = src;
+		src = dst;
+		dst = tmp;
+	}
+
+	return src;
 }
 
 static int mcp25xxfd_process_queued_fifos(struct spi_device *spi)
 {
 	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
 	struct mcp25xxfd_read_fifo_info *rfi = &priv->queued_fifos;
+	struct mcp25xxfd_obj_ts **objs;
 	int i;
 	int ret;
 
-	/* sort the fifos (rx and TEF) by receive timestamp */
-	sort(rfi->rxb, rfi->rx_count, sizeof(struct mcp25xxfd_obj_ts *),
-	     mcp25xxfd_compare_obj_ts, NULL);
+	/* merge the fifos (rx and TEF) by receive timestamp */
+	objs = mcp25xxfd_merge_queued_fifos(rfi);
 
 	/* process the recived fifos */
 	for (i = 0; i < rfi->rx_count; i++) {
-		if (rfi->rxb[i]->flags & CAN_OBJ_FLAGS_CUSTOM_ISTEF)
-			ret = mcp25xxfd_process_queued_tef(spi, rfi->rxb[i]);
+		if (objs[i]->flags & CAN_OBJ_FLAGS_CUSTOM_ISTEF)
+			ret = mcp25xxfd_process_queued_tef(spi, objs[i]);
 		else
-			ret = mcp25xxfd_process_queued_rx(spi, rfi->rxb[i]);
+			ret = mcp25xxfd_process_queued_rx(spi, objs[i]);
 		if (ret)
 			return ret;
 	}
@@ -2269,9 +3272,9 @@ static int mcp25xxfd_transform_rx(struct spi_device *spi,
  * percentage of canFD frames has a dlc-size > 8.
  * This mode is used for Can2.0 configured busses.
  *
- * For now this option can get forced for CanFD via a module parameter.
- * In the future there may be some heuristics that could trigger a usage
- * of this mode as well in some circumstances.
+ * For CanFD the mode is chosen per interrupt based on the estimated
+ * spi cost (see mcp25xxfd_rx_read_prefer_bulk), but it can still get
+ * forced via a module parameter.
  *
  * Note: there is a second optimization for release fifo as well,
  *       but it is not as efficient as this optimization for the
@@ -2284,13 +3287,13 @@ static int mcp25xxfd_read_fifos(struct spi_device *spi)
 	int fifo_header_size = sizeof(struct mcp25xxfd_obj_rx);
 	int fifo_min_payload_size = 8;
 	int fifo_min_size = fifo_header_size + fifo_min_payload_size;
-	int fifo_max_payload_size =
-	    ((priv->can.ctrlmode & CAN_CTRLMODE_FD) ? 64 : 8);
+	int fifo_max_payload_size = priv->fifos.payload_size;
 	u32 mask = priv->status.rxif;
 	struct mcp25xxfd_obj_rx *rx;
 	int i, len;
 	int ret;
 	u32 fifo_address;
+	u64 start_ns;
 	u8 *data;
 
 	/* read all the "open" segments in big chunks */
@@ -2326,7 +3329,9 @@ static int mcp25xxfd_read_fifos(struct spi_device *spi)
 				return ret;
 		}
 		/* release fifo */
+		start_ns = mcp25xxfd_lat_start(priv);
 		ret = mcp25xxfd_normal_release_fifos(spi, i, i + 1);
+		mcp25xxfd_lat_stop(priv, MCP25XXFD_LAT_RELEASE, start_ns);
 		if (ret)
 			return ret;
 		/* increment fifo_usage */
@@ -2344,6 +3349,7 @@ static int mcp25xxfd_bulk_read_fifo_range(struct spi_device *spi,
 	const int fifo_max_payload_size = priv->fifos.payload_size;
 	const int fifo_max_size = fifo_header_size + fifo_max_payload_size;
 	struct mcp25xxfd_obj_rx *rx;
+	u64 start_ns;
 	int i;
 	int ret;
 
@@ -2358,10 +3364,12 @@ static int mcp25xxfd_bulk_read_fifo_range(struct spi_device *spi,
 		return ret;
 
 	/* clear all the fifos in range */
+	start_ns = mcp25xxfd_lat_start(priv);
 	if (use_bulk_release_fifos)
 		ret = mcp25xxfd_bulk_release_fifos(spi, start, end);
 	else
 		ret = mcp25xxfd_normal_release_fifos(spi, start, end);
+	mcp25xxfd_lat_stop(priv, MCP25XXFD_LAT_RELEASE, start_ns);
 	if (ret)
 		return ret;
 
@@ -2412,21 +3420,229 @@ static int mcp25xxfd_bulk_read_fifos(struct spi_device *spi)
 	return 0;
 }
 
+/* pipelined_read_fifos is a variant of bulk_read_fifos that puts
+ * everything into a single preallocated spi_message:
+ *   * read of each range of adjacent fifos (2 transfers each)
+ *   * release of each fifo (1 transfer each)
+ *   * if only rx interrupts are pending: read of the status block for
+ *     the next loop of the irq handler (2 transfers)
+ * so the steady state rx case costs one spi_sync per irq loop
+ * instead of one per range, one per release plus one for the status.
+ */
+
+static void mcp25xxfd_irq_message_add(struct mcp25xxfd_priv *priv,
+				      struct spi_transfer *xfer,
+				      const void *tx_buf, void *rx_buf,
+				      int len, bool cs_change)
+{
+	memset(xfer, 0, sizeof(*xfer));
+	xfer->tx_buf = tx_buf;
+	xfer->rx_buf = rx_buf;
+	xfer->len = len;
+	xfer->cs_change = cs_change;
+	xfer->speed_hz = priv->spi_speed_hz;
+
+	spi_message_add_tail(xfer, &priv->irq_message->msg);
+}
+
+static bool mcp25xxfd_irq_status_rx_only(struct mcp25xxfd_priv *priv)
+{
+	u32 pending = priv->status.intf & (priv->status.intf >>
+					   CAN_INT_IE_SHIFT);
+
+	return ((pending & ~CAN_INT_RXIF) == 0) &&
+		!priv->status.txatif && !priv->status.rxovif;
+}
+
+static int mcp25xxfd_pipelined_read_fifos(struct spi_device *spi, u32 mask)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	struct mcp25xxfd_irq_message *im = priv->irq_message;
+	const int fifo_first_byte = mcp25xxfd_first_byte(CAN_FIFOCON_UINC);
+	const int fifo_size = sizeof(struct mcp25xxfd_obj_rx) +
+		priv->fifos.payload_size;
+	bool prefetch_status = mcp25xxfd_irq_status_rx_only(priv);
+	struct mcp25xxfd_obj_rx *rx;
+	struct spi_transfer *last = NULL;
+	u32 ranges = mask;
+	int i, start, end, count = 0;
+	int ret;
+
+	spi_message_init(&im->msg);
+
+	/* the reads of each range of adjacent fifos */
+	while (ranges) {
+		start = __ffs(ranges);
+		for (end = start; end < 32 && (ranges & BIT(end)); end++)
+			ranges &= ~BIT(end);
+
+		mcp25xxfd_calc_cmd_addr(INSTRUCTION_READ,
+					FIFO_DATA(priv->fifos.
+						  fifo_address[start]),
+					im->read_cmd[count]);
+		mcp25xxfd_irq_message_add(priv, &im->read_xfer[count][0],
+					  im->read_cmd[count], NULL, 2, false);
+		last = &im->read_xfer[count][1];
+		mcp25xxfd_irq_message_add(priv, last, NULL,
+					  priv->fifos.fifo_data +
+					  priv->fifos.fifo_address[start],
+					  (end - start) * fifo_size, true);
+		count++;
+	}
+
+	/* the release of each fifo */
+	for (i = 0; i < 32; i++) {
+		if (!(mask & BIT(i)))
+			continue;
+		mcp25xxfd_calc_cmd_addr(INSTRUCTION_WRITE,
+					CAN_FIFOCON(i) + fifo_first_byte,
+					im->release_cmd[i]);
+		im->release_cmd[i][2] = CAN_FIFOCON_UINC >>
+			(8 * fifo_first_byte);
+		last = &im->release_xfer[i];
+		mcp25xxfd_irq_message_add(priv, last, im->release_cmd[i],
+					  NULL, 3, true);
+	}
+
+	/* the status for the next loop */
+	if (prefetch_status) {
+		mcp25xxfd_calc_cmd_addr(INSTRUCTION_READ, CAN_INT,
+					im->status_cmd);
+		mcp25xxfd_irq_message_add(priv, &im->status_xfer[0],
+					  im->status_cmd, NULL, 2, false);
+		last = &im->status_xfer[1];
+		mcp25xxfd_irq_message_add(priv, last, NULL, &im->status,
+					  sizeof(im->status), false);
+		/* snapshot what was pending when the status was read */
+		im->tx_pending_mask = priv->fifos.tx_pending_mask;
+	}
+
+	/* the last transfer must not leave CS asserted */
+	if (last)
+		last->cs_change = false;
+
+	ret = spi_sync(spi, &im->msg);
+	if (ret)
+		return ret;
+	mcp25xxfd_lat_spi(priv, im->msg.actual_length,
+			  count * 2 + hweight32(mask) +
+			  (prefetch_status ? 2 : 0));
+
+	im->status_valid = prefetch_status;
+	priv->rx_read.pipelined_count++;
+
+	/* preprocess data */
+	for (i = 0; i < 32; i++) {
+		if (!(mask & BIT(i)))
+			continue;
+		rx = (struct mcp25xxfd_obj_rx *)
+		    (priv->fifos.fifo_data + priv->fifos.fifo_address[i]);
+		mcp25xxfd_transform_rx(spi, rx);
+		priv->stats.fifo_usage[i]++;
+	}
+
+	return 0;
+}
+
+static int mcp25xxfd_alloc_irq_message(struct mcp25xxfd_priv *priv)
+{
+	priv->irq_message = kzalloc(sizeof(*priv->irq_message),
+				    GFP_KERNEL | GFP_DMA);
+	if (!priv->irq_message)
+		return -ENOMEM;
+
+	return 0;
+}
+
+/* adaptive choice between read_fifos and bulk_read_fifos for CanFD
+ *
+ * for each interrupt we estimate the cost of both implementations in
+ * spi bytes, where each spi transfer adds spi_xfer_cost_bytes:
+ *   * bulk_read_fifos:
+ *     * one transfer per range of adjacent fifos with the full payload
+ *     * the release transfers (depending on use_bulk_release_fifos)
+ *   * read_fifos (per fifo):
+ *     * one transfer for header + 8 bytes of data
+ *     * one transfer for the extra payload of frames with dlc > 8
+ *     * one release transfer
+ * the share of frames with dlc > 8 and their size is taken from the
+ * recent dlc histogram, so the decision follows the traffic mix.
+ */
+static bool mcp25xxfd_rx_read_prefer_bulk(struct spi_device *spi, u32 mask)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	const u32 header_size = sizeof(struct mcp25xxfd_obj_rx);
+	const u32 xfer_cost = spi_xfer_cost_bytes;
+	u32 fifos = hweight32(mask);
+	/* ranges of adjacent bits: count the lowest bit of each range */
+	u32 ranges = hweight32(mask & ~(mask << 1));
+	u32 weight = 0, ext_frames = 0, ext_bytes = 0;
+	u32 bulk, fifo;
+	int dlc, len;
+
+	/* the cost of bulk_read_fifos */
+	bulk = ranges * 2 + fifos * (header_size + priv->fifos.payload_size);
+	if (use_pipelined_irq && priv->irq_message)
+		/* reads and releases in a single spi_message */
+		bulk += fifos * 3 + xfer_cost;
+	else if (use_bulk_release_fifos)
+		bulk += ranges * (3 + 2 * xfer_cost) +
+			(fifos - ranges) * FIFOCON_SPACING;
+	else
+		bulk += ranges * xfer_cost + fifos * (3 + xfer_cost);
+
+	/* the expected extra payload of read_fifos */
+	for (dlc = 0; dlc < 16; dlc++) {
+		weight += priv->rx_read.dlc_recent[dlc];
+		len = can_dlc2len(dlc);
+		if (len <= 8)
+			continue;
+		ext_frames += priv->rx_read.dlc_recent[dlc];
+		ext_bytes += priv->rx_read.dlc_recent[dlc] * (len - 8);
+	}
+
+	/* the cost of read_fifos - scaled by the weight of the histogram */
+	fifo = fifos * (2 + header_size + 8 + 2 * xfer_cost + 3);
+	if (weight)
+		fifo += fifos * (ext_frames * (2 + xfer_cost) + ext_bytes) /
+			weight;
+
+	priv->rx_read.cost_bulk = bulk;
+	priv->rx_read.cost_fifo = fifo;
+
+	return bulk <= fifo;
+}
+
 static int mcp25xxfd_can_ist_handle_rxif(struct spi_device *spi)
 {
 	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
-	u32 mask = priv->status.rxif;
+	u32 mask = priv->status.rxif & priv->fifos.rx_fifo_mask;
+	bool bulk;
 	int ret;
 
 	if (!mask)
 		return 0;
 
-	/* read all the fifos - for non-fd case use bulk read optimization */
+	/* read all the fifos - for non-fd case use bulk read optimization
+	 * for fd choose the implementation with the lower estimated cost
+	 */
 	if (((priv->can.ctrlmode & CAN_CTRLMODE_FD) == 0) ||
-	    use_complete_fdfifo_read)
-		ret = mcp25xxfd_bulk_read_fifos(spi);
-	else
+	    use_complete_fdfifo_read) {
+		bulk = true;
+	} else {
+		bulk = mcp25xxfd_rx_read_prefer_bulk(spi, mask);
+		if (bulk)
+			priv->rx_read.bulk_count++;
+		else
+			priv->rx_read.fifo_count++;
+	}
+
+	if (!bulk)
 		ret = mcp25xxfd_read_fifos(spi);
+	else if (use_pipelined_irq && priv->irq_message)
+		ret = mcp25xxfd_pipelined_read_fifos(spi, mask);
+	else
+		ret = mcp25xxfd_bulk_read_fifos(spi);
 
 	return 0;
 }
@@ -2596,6 +3812,7 @@ static int mcp25xxfd_can_ist_handle_txatif_fifo(struct spi_device *spi,
 
 	/* mark the fifo as processed */
 	mcp25xxfd_mark_tx_processed(spi, fifo);
+	mcp25xxfd_tx_mq_release(priv, fifo);
 
 	/* handle all the known cases accordingly - ignoring FIFO full */
 	val &= CAN_FIFOSTA_TXABT | CAN_FIFOSTA_TXLARB | CAN_FIFOSTA_TXERR;
@@ -2641,7 +3858,7 @@ static void mcp25xxfd_error_skb(struct net_device *net)
 	if (skb) {
 		frame->can_id = priv->can_err_id;
 		memcpy(frame->data, priv->can_err_data, 8);
-		netif_rx_ni(skb);
+		mcp25xxfd_rx_skb(priv, skb);
 	} else {
 		netdev_err(net, "cannot allocate error skb\n");
 	}
@@ -2886,6 +4103,7 @@ static int mcp25xxfd_disable_interrupts(struct spi_device *spi, u32 speed_hz)
 	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
 
 	priv->status.intf = 0;
+	priv->int_ie = 0;
 	return mcp25xxfd_cmd_write(spi, CAN_INT, 0, speed_hz);
 }
 
@@ -2898,6 +4116,7 @@ static int mcp25xxfd_enable_interrupts(struct spi_device *spi, u32 speed_hz)
 	    CAN_INT_MODIE |
 	    CAN_INT_SERRIE |
 	    CAN_INT_IVMIE | CAN_INT_CERRIE | CAN_INT_RXOVIE | CAN_INT_ECCIE;
+	priv->int_ie = priv->status.intf;
 	return mcp25xxfd_cmd_write(spi, CAN_INT, priv->status.intf, speed_hz);
 }
 
@@ -2923,6 +4142,7 @@ static int mcp25xxfd_can_ist_handle_status(struct spi_device *spi)
 	const u32 clear_irq = CAN_INT_TBCIF |
 	    CAN_INT_MODIF |
 	    CAN_INT_SERRIF | CAN_INT_CERRIF | CAN_INT_WAKIF | CAN_INT_IVMIF;
+	u64 start_ns;
 	int ret;
 
 	/* clear all the interrupts asap */
@@ -2962,8 +4182,10 @@ static int mcp25xxfd_can_ist_handle_status(struct spi_device *spi)
 			return ret;
 	}
 
-	/* handle the rx */
-	if (priv->status.intf & CAN_INT_RXIF) {
+	/* handle the rx - unless masked because of the napi backlog */
+	start_ns = mcp25xxfd_lat_start(priv);
+	if ((priv->status.intf & CAN_INT_RXIF) &&
+	    !test_bit(MCP25XXFD_NAPI_RX_MASKED, &priv->napi_flags)) {
 		priv->stats.int_rx_count++;
 		ret = mcp25xxfd_can_ist_handle_rxif(spi);
 		if (ret)
@@ -2985,9 +4207,12 @@ static int mcp25xxfd_can_ist_handle_status(struct spi_device *spi)
 		if (ret)
 			return ret;
 	}
+	mcp25xxfd_lat_stop(priv, MCP25XXFD_LAT_FIFO, start_ns);
 
 	/* process the queued fifos */
+	start_ns = mcp25xxfd_lat_start(priv);
 	ret = mcp25xxfd_process_queued_fifos(spi);
+	mcp25xxfd_lat_stop(priv, MCP25XXFD_LAT_DELIVER, start_ns);
 
 	/* handle error interrupt flags */
 	if (priv->status.rxovif) {
@@ -3078,8 +4303,11 @@ static int mcp25xxfd_can_ist_handle_status(struct spi_device *spi)
 			mcp25xxfd_hw_sleep(spi);
 		}
 	} else {
-		/* restart the tx queue if needed */
-		if (priv->fifos.tx_processed_mask == priv->fifos.tx_fifo_mask)
+		/* restart the tx queue if needed - in multiqueue mode
+		 * the queues get woken individually
+		 */
+		if (!priv->tx_mq &&
+		    priv->fifos.tx_processed_mask == priv->fifos.tx_fifo_mask)
 			mcp25xxfd_wake_queue(spi);
 	}
 
@@ -3097,33 +4325,63 @@ static int mcp25xxfd_can_ist_handle_status(struct spi_device *spi)
 	return 0;
 }
 
-static irqreturn_t mcp25xxfd_can_ist(int irq, void *dev_id)
+/* only installed with latency_stats to time the wakeup of the thread */
+static irqreturn_t mcp25xxfd_can_irq(int irq, void *dev_id)
 {
 	struct mcp25xxfd_priv *priv = dev_id;
+
+	priv->lat.irq_ns = ktime_get_ns();
+
+	return IRQ_WAKE_THREAD;
+}
+
+static irqreturn_t mcp25xxfd_can_ist_run(struct mcp25xxfd_priv *priv)
+{
 	struct spi_device *spi = priv->spi;
+	u64 start_ns;
 	int ret;
 
 	priv->stats.irq_calls++;
 	priv->stats.irq_state = IRQ_STATE_RUNNING;
 
+	/* a status read during the last irq run is stale by now */
+	if (priv->irq_message)
+		priv->irq_message->status_valid = false;
+
 	while (!priv->force_quit) {
 		/* count irq loops */
 		priv->stats.irq_loops++;
 
-		/* copy pending to in_irq - any
-		 * updates that happen asyncronously
-		 * are not taken into account here
-		 */
-		priv->fifos.tx_pending_mask_in_irq =
-		    priv->fifos.tx_pending_mask;
-
-		/* read interrupt status flags */
-		ret = mcp25xxfd_cmd_readn(spi, CAN_INT,
-					  &priv->status,
-					  sizeof(priv->status),
-					  priv->spi_speed_hz);
-		if (ret)
-			return ret;
+		if (priv->irq_message && priv->irq_message->status_valid) {
+			/* the status got read by the pipelined rx message
+			 * of the last loop, so use it together with
+			 * the pending mask from that time
+			 */
+			priv->irq_message->status_valid = false;
+			priv->fifos.tx_pending_mask_in_irq =
+			    priv->irq_message->tx_pending_mask;
+			memcpy(&priv->status, &priv->irq_message->status,
+			       sizeof(priv->status));
+			priv->rx_read.status_prefetch_count++;
+		} else {
+			/* copy pending to in_irq - any
+			 * updates that happen asyncronously
+			 * are not taken into account here
+			 */
+			priv->fifos.tx_pending_mask_in_irq =
+			    priv->fifos.tx_pending_mask;
+
+			/* read interrupt status flags */
+			start_ns = mcp25xxfd_lat_start(priv);
+			ret = mcp25xxfd_cmd_readn(spi, CAN_INT,
+						  &priv->status,
+						  sizeof(priv->status),
+						  priv->spi_speed_hz);
+			mcp25xxfd_lat_stop(priv, MCP25XXFD_LAT_STATUS,
+					   start_ns);
+			if (ret)
+				return ret;
+		}
 
 		/* only act if the mask is applied */
 		if ((priv->status.intf &
@@ -3134,11 +4392,30 @@ static irqreturn_t mcp25xxfd_can_ist(int irq, void *dev_id)
 		ret = mcp25xxfd_can_ist_handle_status(spi);
 		if (ret)
 			return ret;
+
+		/* hand the queued frames to napi */
+		start_ns = mcp25xxfd_lat_start(priv);
+		ret = mcp25xxfd_napi_schedule(spi);
+		mcp25xxfd_lat_stop(priv, MCP25XXFD_LAT_DELIVER, start_ns);
+		if (ret)
+			return ret;
 	}
 
 	return IRQ_HANDLED;
 }
 
+static irqreturn_t mcp25xxfd_can_ist(int irq, void *dev_id)
+{
+	struct mcp25xxfd_priv *priv = dev_id;
+	irqreturn_t ret;
+
+	mcp25xxfd_lat_run_start(priv);
+	ret = mcp25xxfd_can_ist_run(priv);
+	mcp25xxfd_lat_run_end(priv);
+
+	return ret;
+}
+
 static int mcp25xxfd_get_berr_counter(const struct net_device *net,
 				      struct can_berr_counter *bec)
 {
@@ -3409,31 +4686,269 @@ static int mcp25xxfd_setup_osc(struct spi_device *spi)
 	return -ENODEV;
 }
 
-static int mcp25xxfd_setup_fifo(struct net_device *net,
-				struct mcp25xxfd_priv *priv,
-				struct spi_device *spi)
+/* fifo layout:
+ * the 2KB of fifo RAM are split between TEF, tx and rx fifos when the
+ * interface gets opened. The default split depends on the mtu, but it
+ * can get changed via the fifo_layout sysfs attribute of the network
+ * device (also while the interface is running - see
+ * mcp25xxfd_reconfigure_fifos) by writing
+ * "<tx_fifos> <rx_fifo_depth> <payload_size>", where 0 selects the
+ * default for the given value.
+ * A payload_size below the mtu means that longer CanFD frames get
+ * dropped on tx and counted as length errors on rx.
+ */
+static const u32 mcp25xxfd_payload_sizes[] = {
+	[CAN_TXQCON_PLSIZE_8] = 8,
+	[CAN_TXQCON_PLSIZE_12] = 12,
+	[CAN_TXQCON_PLSIZE_16] = 16,
+	[CAN_TXQCON_PLSIZE_20] = 20,
+	[CAN_TXQCON_PLSIZE_24] = 24,
+	[CAN_TXQCON_PLSIZE_32] = 32,
+	[CAN_TXQCON_PLSIZE_48] = 48,
+	[CAN_TXQCON_PLSIZE_64] = 64,
+};
+
+static int mcp25xxfd_payload_mode(u32 payload_size)
 {
-	u32 val, available_memory, tx_memory_used;
-	int ret;
-	int i, fifo;
+	int i;
 
-	/* clear all filter */
-	for (i = 0; i < 32; i++) {
-		ret = mcp25xxfd_cmd_write(spi, CAN_FLTOBJ(i), 0,
-					  priv->spi_setup_speed_hz);
+	for (i = 0; i < ARRAY_SIZE(mcp25xxfd_payload_sizes); i++)
+		if (mcp25xxfd_payload_sizes[i] == payload_size)
+			return i;
+
+	return -EINVAL;
+}
+
+static bool mcp25xxfd_fifo_layout_fits(u32 tx, u32 rx, u32 rx_depth,
+				       u32 payload_size)
+{
+	u32 tx_size = sizeof(struct mcp25xxfd_obj_tef) +
+	    sizeof(struct mcp25xxfd_obj_tx) + payload_size;
+	u32 rx_size = sizeof(struct mcp25xxfd_obj_rx) + payload_size;
+
+	/* FIFO0 is the TEF, so there are 31 fifos for tx and rx */
+	if (tx + rx > 31)
+		return false;
+
+	return tx * tx_size + rx * rx_depth * rx_size <=
+	    MCP25XXFD_BUFFER_TXRX_SIZE;
+}
+
+static int mcp25xxfd_apply_fifo_layout(struct net_device *net,
+				       struct mcp25xxfd_priv *priv)
+{
+	const struct mcp25xxfd_fifo_layout *layout = &priv->fifo_layout;
+	int mode;
+
+	if (layout->tx_fifos)
+		priv->fifos.tx_fifos = layout->tx_fifos;
+
+	if (layout->rx_fifo_depth) {
+		if (layout->rx_fifo_depth > 32) {
+			dev_err(&priv->spi->dev, "rx fifo depth %u exceeds 32\n",
+				layout->rx_fifo_depth);
+			return -EINVAL;
+		}
+		priv->fifos.rx_fifo_depth = layout->rx_fifo_depth;
+	}
+
+	if (layout->payload_size) {
+		mode = mcp25xxfd_payload_mode(layout->payload_size);
+		if (mode < 0 ||
+		    layout->payload_size > priv->fifos.payload_size) {
+			dev_err(&priv->spi->dev,
+				"payload size %u is not possible with mtu %u\n",
+				layout->payload_size, net->mtu);
+			return -EINVAL;
+		}
+		priv->fifos.payload_size = layout->payload_size;
+		priv->fifos.payload_mode = mode;
+	}
+
+	return 0;
+}
+
+/* rx filters:
+ * without rules each rx fifo gets a filter that matches all frames,
+ * where the controller uses the first matching filter with space left
+ * in its fifo.
+ * Rules (set via the rx_filter sysfs attribute of the network device)
+ * get compiled into the FLTOBJ/FLTMASK/FLTCON registers instead, so that
+ * frames not matching any rule never get stored in the controller and
+ * never cross the spi bus:
+ * * each fifo_class > 0 gets a dedicated rx fifo (starting with the
+ *   lowest) with one filter per rule
+ * * fifo_class 0 shares the remaining rx fifos, with one filter per
+ *   rule and fifo as far as the 32 filters allow
+ * the last fifo of each chain gets the overflow interrupt enabled.
+ * can_id/can_mask follow struct can_filter: CAN_EFF_FLAG in can_id
+ * selects extended ids, CAN_EFF_FLAG in can_mask restricts matches to
+ * this frame format; CAN_RTR_FLAG can not be filtered in hardware.
+ */
+static void mcp25xxfd_rx_rule_to_filter(const struct mcp25xxfd_rx_rule *rule,
+					struct mcp25xxfd_rx_filter *flt,
+					u32 fifo)
+{
+	u32 id = rule->can_id, mask = rule->can_mask;
+
+	if (id & CAN_EFF_FLAG) {
+		flt->obj = CAN_FILOBJ_EXIDE |
+		    (((id & CAN_EFF_SID_MASK) >> CAN_EFF_SID_SHIFT) <<
+		     CAN_FILOBJ_SID_SHIFT) |
+		    (((id & CAN_EFF_EID_MASK) >> CAN_EFF_EID_SHIFT) <<
+		     CAN_FILOBJ_EID_SHIFT);
+		flt->mask =
+		    (((mask & CAN_EFF_SID_MASK) >> CAN_EFF_SID_SHIFT) <<
+		     CAN_FILMASK_MSID_SHIFT) |
+		    (((mask & CAN_EFF_EID_MASK) >> CAN_EFF_EID_SHIFT) <<
+		     CAN_FILMASK_MEID_SHIFT);
+	} else {
+		flt->obj = (id & CAN_SFF_MASK) << CAN_FILOBJ_SID_SHIFT;
+		flt->mask = (mask & CAN_SFF_MASK) << CAN_FILMASK_MSID_SHIFT;
+	}
+	if (mask & CAN_EFF_FLAG)
+		flt->mask |= CAN_FILMASK_MIDE;
+	flt->fifo = fifo;
+}
+
+static int mcp25xxfd_compile_rx_filters(struct mcp25xxfd_priv *priv)
+{
+	const struct mcp25xxfd_rx_rule *rules = priv->rx_filter.rules;
+	struct mcp25xxfd_rx_filter *hw = priv->rx_filter.hw;
+	u32 count = priv->rx_filter.rule_count;
+	u32 start = priv->fifos.rx_fifo_start;
+	u32 classes = 1, shared = 0, ovie = 0;
+	u32 fifos, fifo, n = 0;
+	int i, prev = -1;
+
+	/* without rules every rx fifo matches everything */
+	if (!count) {
+		for (i = 0; i < priv->fifos.rx_fifos; i++) {
+			hw[i].obj = 0;
+			hw[i].mask = 0;
+			hw[i].fifo = start + priv->fifos.rx_fifos - 1 - i;
+		}
+		priv->rx_filter.hw_count = priv->fifos.rx_fifos;
+		priv->fifos.rx_ovie_mask = BIT(start);
+		return 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		classes = max(classes, rules[i].fifo_class + 1);
+		if (!rules[i].fifo_class)
+			shared++;
+	}
+	if (classes > priv->fifos.rx_fifos || count > MCP25XXFD_RX_FILTERS)
+		return -ENOSPC;
+
+	/* the dedicated fifos */
+	for (i = 0; i < count; i++) {
+		if (!rules[i].fifo_class)
+			continue;
+		fifo = start + rules[i].fifo_class - 1;
+		mcp25xxfd_rx_rule_to_filter(&rules[i], &hw[n++], fifo);
+		ovie |= BIT(fifo);
+	}
+
+	/* the shared fifos - highest first */
+	fifos = priv->fifos.rx_fifos - (classes - 1);
+	for (fifo = start + priv->fifos.rx_fifos - 1;
+	     shared && fifos && n + shared <= MCP25XXFD_RX_FILTERS;
+	     fifo--, fifos--) {
+		for (i = 0; i < count; i++)
+			if (!rules[i].fifo_class)
+				mcp25xxfd_rx_rule_to_filter(&rules[i], &hw[n++],
+							    fifo);
+		/* only the lowest shared fifo reports overflows */
+		if (prev >= 0)
+			ovie &= ~BIT(prev);
+		ovie |= BIT(fifo);
+		prev = fifo;
+	}
+	/* there was not a single filter left for the shared rules */
+	if (shared && fifos == priv->fifos.rx_fifos - (classes - 1))
+		return -ENOSPC;
+
+	priv->rx_filter.hw_count = n;
+	priv->fifos.rx_ovie_mask = ovie;
+
+	return 0;
+}
+
+static int mcp25xxfd_write_rx_filters(struct spi_device *spi, u32 speed_hz)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	struct mcp25xxfd_rx_filter *flt;
+	int i, ret;
+
+	for (i = 0; i < MCP25XXFD_RX_FILTERS; i++) {
+		/* object and mask may only get changed while disabled */
+		ret = mcp25xxfd_cmd_write_mask(spi, CAN_FLTCON(i), 0,
+					       CAN_FIFOCON_FLTEN(i) |
+					       CAN_FILCON_MASK(i), speed_hz);
 		if (ret)
 			return ret;
-		ret = mcp25xxfd_cmd_write(spi, CAN_FLTMASK(i), 0,
-					  priv->spi_setup_speed_hz);
+		if (i >= priv->rx_filter.hw_count)
+			continue;
+
+		flt = &priv->rx_filter.hw[i];
+		ret = mcp25xxfd_cmd_write(spi, CAN_FLTOBJ(i), flt->obj,
+					  speed_hz);
 		if (ret)
 			return ret;
-		ret = mcp25xxfd_cmd_write_mask(spi, CAN_FLTCON(i), 0,
-					       CAN_FILCON_MASK(i),
-					       priv->spi_setup_speed_hz);
+		ret = mcp25xxfd_cmd_write(spi, CAN_FLTMASK(i), flt->mask,
+					  speed_hz);
+		if (ret)
+			return ret;
+		ret = mcp25xxfd_cmd_write_mask(spi, CAN_FLTCON(i),
+					       CAN_FIFOCON_FLTEN(i) |
+					       (flt->fifo << CAN_FILCON_SHIFT(i)),
+					       CAN_FIFOCON_FLTEN(i) |
+					       CAN_FILCON_MASK(i), speed_hz);
+		if (ret)
+			return ret;
+	}
+
+	return 0;
+}
+
+/* apply changed rules on a running interface - called with rtnl held */
+static int mcp25xxfd_update_rx_filters(struct net_device *net)
+{
+	struct mcp25xxfd_priv *priv = netdev_priv(net);
+	struct spi_device *spi = priv->spi;
+	int ret, i, fifo;
+
+	ret = mcp25xxfd_compile_rx_filters(priv);
+	if (ret)
+		return ret;
+
+	/* the overflow interrupts of the rx fifos - only the IE byte */
+	for (i = 0; i < priv->fifos.rx_fifos; i++) {
+		fifo = priv->fifos.rx_fifo_start + i;
+		ret = mcp25xxfd_cmd_write_mask(spi, CAN_FIFOCON(fifo),
+					       mcp25xxfd_rx_fifocon(priv, fifo),
+					       CAN_FIFOCON_RXOVIE,
+					       priv->spi_speed_hz);
 		if (ret)
 			return ret;
 	}
 
+	return mcp25xxfd_write_rx_filters(spi, priv->spi_speed_hz);
+}
+
+static int mcp25xxfd_setup_fifo(struct net_device *net,
+				struct mcp25xxfd_priv *priv,
+				struct spi_device *spi)
+{
+	u32 val, available_memory, tx_memory_used;
+	int ret;
+	int i, fifo;
+
+	/* the masks get rebuilt for the (possibly changed) layout */
+	priv->fifos.tx_fifo_mask = 0;
+	priv->fifos.rx_fifo_mask = 0;
+
 	/* decide on TEF, tx and rx FIFOS */
 	switch (net->mtu) {
 	case CAN_MTU:
@@ -3473,13 +4988,18 @@ static int mcp25xxfd_setup_fifo(struct net_device *net,
 	}
 
 	/* if defined as a module modify the number of tx_fifos */
-	if (tx_fifos) {
+	if (tx_fifos && !priv->fifo_layout.tx_fifos) {
 		dev_info(&spi->dev,
 			 "Using %i tx-fifos as per module parameter\n",
 			 tx_fifos);
 		priv->fifos.tx_fifos = tx_fifos;
 	}
 
+	/* apply the requested fifo layout */
+	ret = mcp25xxfd_apply_fifo_layout(net, priv);
+	if (ret)
+		return ret;
+
 	/* check range - we need 1 RX-fifo and one tef-fifo, hence 30 */
 	if (priv->fifos.tx_fifos > 30) {
 		dev_err(&spi->dev,
@@ -3490,10 +5010,10 @@ static int mcp25xxfd_setup_fifo(struct net_device *net,
 	tx_memory_used = priv->fifos.tx_fifos *
 	    (sizeof(struct mcp25xxfd_obj_tef) +
 	     sizeof(struct mcp25xxfd_obj_tx) + priv->fifos.payload_size);
-	/* check that we are not exceeding memory limits with 1 RX buffer */
-	if (tx_memory_used + (sizeof(struct mcp25xxfd_obj_rx) +
-			      priv->fifos.payload_size) >
-	    MCP25XXFD_BUFFER_TXRX_SIZE) {
+	/* check that we are not exceeding memory limits with 1 RX fifo */
+	if (!mcp25xxfd_fifo_layout_fits(priv->fifos.tx_fifos, 1,
+					priv->fifos.rx_fifo_depth,
+					priv->fifos.payload_size)) {
 		dev_err(&spi->dev,
 			"Configured %i tx-fifos exceeds available memory already\n",
 			priv->fifos.tx_fifos);
@@ -3560,60 +5080,70 @@ static int mcp25xxfd_setup_fifo(struct net_device *net,
 
 	for (i = 0; i < priv->fifos.tx_fifos; i++) {
 		fifo = priv->fifos.tx_fifo_start + i;
+		/* the prioriy needs to be inverted
+		 * we need to run from lowest to
+		 * highest to avoid MAB errors
+		 * - in multiqueue mode the queue index is the priority
+		 */
+		priv->fifos.fifocon[fifo] = (val & ~CAN_FIFOCON_FRESET) |
+		    ((priv->tx_mq ? i : 31 - fifo) <<
+		     CAN_FIFOCON_TXPRI_SHIFT);
 		ret = mcp25xxfd_cmd_write(spi, CAN_FIFOCON(fifo),
-					  /* the prioriy needs to be inverted
-					   * we need to run from lowest to
-					   * highest to avoid MAB errors
-					   */
-					  val | ((31 - fifo) <<
-						 CAN_FIFOCON_TXPRI_SHIFT),
+					  priv->fifos.fifocon[fifo] |
+					  CAN_FIFOCON_FRESET,
 					  priv->spi_setup_speed_hz);
 		if (ret)
 			return ret;
 		priv->fifos.tx_fifo_mask |= BIT(fifo);
 	}
 
+	/* compile the rx filters for this layout, which also decides
+	 * on the fifos with overflow interrupts
+	 */
+	ret = mcp25xxfd_compile_rx_filters(priv);
+	if (ret) {
+		u32 rules = priv->rx_filter.rule_count;
+
+		dev_warn(&spi->dev,
+			 "rx filter rules do not fit %u rx-fifos - accepting all frames\n",
+			 priv->fifos.rx_fifos);
+		priv->rx_filter.rule_count = 0;
+		mcp25xxfd_compile_rx_filters(priv);
+		priv->rx_filter.rule_count = rules;
+	}
+
 	/* now set up RX FIFO */
-	for (i = 0,
-	     fifo = priv->fifos.rx_fifo_start + priv->fifos.rx_fifos - 1;
-	     i < priv->fifos.rx_fifos; i++, fifo--) {
-		/* prepare the fifo itself */
+	for (i = 0; i < priv->fifos.rx_fifos; i++) {
+		fifo = priv->fifos.rx_fifo_start + i;
 		ret = mcp25xxfd_cmd_write(spi, CAN_FIFOCON(fifo),
-					  (priv->fifos.payload_mode <<
-					   CAN_FIFOCON_PLSIZE_SHIFT) |
-					  ((priv->fifos.rx_fifo_depth - 1) <<
-					   CAN_FIFOCON_FSIZE_SHIFT) |
-					  /* RX timestamps: */
-					  CAN_FIFOCON_RXTSEN |
-					  /* reset FIFO: */
-					  CAN_FIFOCON_FRESET |
-					  /* FIFO Full: */
-					  CAN_FIFOCON_TFERFFIE |
-					  /* FIFO Half Full: */
-					  CAN_FIFOCON_TFHRFHIE |
-					  /* FIFO not empty: */
-					  CAN_FIFOCON_TFNRFNIE |
-					  /* on last fifo add overflow flag: */
-					  ((i == priv->fifos.rx_fifos - 1) ?
-					   CAN_FIFOCON_RXOVIE : 0),
+					  mcp25xxfd_rx_fifocon(priv, fifo) |
+					  CAN_FIFOCON_FRESET,
 					  priv->spi_setup_speed_hz);
 		if (ret)
 			return ret;
-		/* prepare the rx filter config: filter i directs to fifo
-		 * FLTMSK and FLTOBJ are 0 already, so they match everything
-		 */
-		ret = mcp25xxfd_cmd_write_mask(spi, CAN_FLTCON(i),
-					       CAN_FIFOCON_FLTEN(i) |
-					       (fifo << CAN_FILCON_SHIFT(i)),
-					       CAN_FIFOCON_FLTEN(i) |
-					       CAN_FILCON_MASK(i),
-					       priv->spi_setup_speed_hz);
-		if (ret)
-			return ret;
 
 		priv->fifos.rx_fifo_mask |= BIT(fifo);
 	}
 
+	/* and the filters directing frames to them */
+	ret = mcp25xxfd_write_rx_filters(spi, priv->spi_setup_speed_hz);
+	if (ret)
+		return ret;
+
+	/* return unused fifos to their reset state, so that fifos of
+	 * a previous layout do not occupy RAM any longer
+	 */
+	for (fifo = priv->fifos.tx_fifo_start + priv->fifos.tx_fifos;
+	     fifo < 32; fifo++) {
+		ret = mcp25xxfd_cmd_write(spi, CAN_FIFOCON(fifo),
+					  CAN_FIFOCON_FRESET |
+					  (CAN_FIFOCON_TXAT_UNLIMITED <<
+					   CAN_FIFOCON_TXAT_SHIFT),
+					  priv->spi_setup_speed_hz);
+		if (ret)
+			return ret;
+	}
+
 	/* we need to move out of CONFIG mode shortly to get the addresses */
 	ret = mcp25xxfd_set_opmode(spi, CAN_CON_MODE_INTERNAL_LOOPBACK,
 				   priv->spi_setup_speed_hz);
@@ -3642,6 +5172,9 @@ static int mcp25xxfd_setup_fifo(struct net_device *net,
 
 	/* and prepare the spi_messages */
 	ret = mcp25xxfd_fill_spi_transmit_fifos(priv);
+	if (ret)
+		return ret;
+	ret = mcp25xxfd_alloc_irq_message(priv);
 	if (ret)
 		return ret;
 
@@ -3690,12 +5223,17 @@ static int mcp25xxfd_setup(struct net_device *net,
 	if (ret)
 		return ret;
 
-	/* time stamp control register - 1ns resolution, but disabled */
+	/* time stamp control register - 1us resolution by default,
+	 * the TBC increments every TBCPRE + 1 clock cycles
+	 */
 	ret = mcp25xxfd_cmd_write(spi, CAN_TBC, 0, priv->spi_setup_speed_hz);
 	if (ret)
 		return ret;
-	priv->regs.tscon = CAN_TSCON_TBCEN | ((priv->can.clock.freq / 1000000)
-					      << CAN_TSCON_TBCPRE_SHIFT);
+	priv->tstamp.prescaler = tbc_prescaler ?
+	    clamp_t(u32, tbc_prescaler, 1, 1024) :
+	    priv->can.clock.freq / 1000000;
+	priv->regs.tscon = CAN_TSCON_TBCEN |
+	    ((priv->tstamp.prescaler - 1) << CAN_TSCON_TBCPRE_SHIFT);
 	ret = mcp25xxfd_cmd_write(spi, CAN_TSCON,
 				  priv->regs.tscon, priv->spi_setup_speed_hz);
 	if (ret)
@@ -3726,6 +5264,258 @@ static int mcp25xxfd_setup(struct net_device *net,
 	return mcp25xxfd_setup_fifo(net, priv, spi);
 }
 
+/* reconfiguration of the fifo layout while the interface is running:
+ * * stop the tx queue and wait (up to idle_ms) until all frames handed
+ *   to the controller got transmitted - otherwise give up with -EBUSY
+ * * disable the irq and napi, run the irq handler a last time to drain
+ *   the rx fifos and the TEF
+ * * switch to CONFIG mode - the controller does so only once the bus
+ *   is idle - and set up the fifos with the new layout
+ * * return to normal mode and restart irq, napi and tx queue
+ * Frames received during the few spi transfers between the final drain
+ * and the mode switch get lost, hence the autotuner only triggers
+ * this after an interval without rx overflows or while tx dominates.
+ * Called with rtnl held.
+ */
+static bool mcp25xxfd_tx_in_flight(struct mcp25xxfd_priv *priv)
+{
+	return (priv->fifos.tx_submitted_mask | priv->fifos.tx_pending_mask) &
+	    ~priv->fifos.tx_processed_mask;
+}
+
+static int mcp25xxfd_wait_opmode(struct spi_device *spi, int mode,
+				 unsigned int timeout_ms)
+{
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	unsigned int waited;
+	int ret, omode;
+
+	for (waited = 0; ; waited++) {
+		ret = mcp25xxfd_get_opmode(spi, &omode,
+					   priv->spi_setup_speed_hz);
+		if (ret)
+			return ret;
+		if (omode == mode)
+			return 0;
+		if (waited >= timeout_ms)
+			return -ETIMEDOUT;
+		msleep(1);
+	}
+}
+
+static int mcp25xxfd_reconfigure_fifos(struct net_device *net,
+				       const struct mcp25xxfd_fifo_layout *layout,
+				       unsigned int idle_ms)
+{
+	struct mcp25xxfd_priv *priv = netdev_priv(net);
+	struct spi_device *spi = priv->spi;
+	struct mcp25xxfd_fifo_layout old = priv->fifo_layout;
+	unsigned int waited;
+	int ret, err;
+
+	/* stop the queue and submit a partially collected tx batch */
+	priv->fifo_reconfig = true;
+	netif_tx_disable(net);
+	mcp25xxfd_tx_batch_submit(spi);
+
+	/* wait for the transmission of everything handed to the controller */
+	for (waited = 0; mcp25xxfd_tx_in_flight(priv); waited++) {
+		if (waited >= idle_ms) {
+			priv->fifo_reconfig = false;
+			if (priv->tx_queue_status == TX_QUEUE_STATUS_RUNNING)
+				netif_tx_wake_all_queues(net);
+			return -EBUSY;
+		}
+		msleep(1);
+	}
+
+	/* quiesce irq handler and napi */
+	disable_irq(spi->irq);
+	if (priv->rx_napi) {
+		napi_disable(&priv->napi);
+		while (test_bit(MCP25XXFD_NAPI_RX_UNMASKING,
+				&priv->napi_flags))
+			msleep(1);
+		priv->napi_flags = 0;
+	}
+
+	/* drain the rx fifos and the TEF with all interrupts enabled */
+	ret = mcp25xxfd_enable_interrupts(spi, priv->spi_setup_speed_hz);
+	if (ret)
+		goto out_failed;
+	mcp25xxfd_can_ist(spi->irq, priv);
+
+	/* switch to CONFIG mode, which resets all fifos */
+	ret = mcp25xxfd_disable_interrupts(spi, priv->spi_setup_speed_hz);
+	if (ret)
+		goto out_failed;
+	ret = mcp25xxfd_set_opmode(spi, CAN_CON_MODE_CONFIG,
+				   priv->spi_setup_speed_hz);
+	if (ret)
+		goto out_failed;
+	ret = mcp25xxfd_wait_opmode(spi, CAN_CON_MODE_CONFIG, idle_ms);
+	if (ret)
+		goto out_failed;
+
+	/* set up the fifos with the new layout - or the old one on error */
+	mcp25xxfd_free_spi_transmit_fifos(priv);
+	kfree(priv->irq_message);
+	priv->irq_message = NULL;
+	priv->fifo_layout = *layout;
+	ret = mcp25xxfd_setup_fifo(net, priv, spi);
+	if (ret) {
+		mcp25xxfd_free_spi_transmit_fifos(priv);
+		kfree(priv->irq_message);
+		priv->irq_message = NULL;
+		priv->fifo_layout = old;
+		err = mcp25xxfd_setup_fifo(net, priv, spi);
+		if (err)
+			goto out_failed_err;
+	}
+
+	/* and restart */
+	if (priv->tx_mq)
+		netif_set_real_num_tx_queues(net, priv->fifos.tx_fifos);
+	err = mcp25xxfd_set_normal_opmode(spi);
+	/* the TBC was reset in config mode */
+	if (!err)
+		err = mcp25xxfd_tstamp_start(priv);
+	if (!err)
+		err = mcp25xxfd_enable_interrupts(spi,
+						  priv->spi_setup_speed_hz);
+	if (err)
+		goto out_failed_err;
+
+	enable_irq(spi->irq);
+	if (priv->rx_napi) {
+		napi_enable(&priv->napi);
+		if (!skb_queue_empty(&priv->rx_queue)) {
+			local_bh_disable();
+			napi_schedule(&priv->napi);
+			local_bh_enable();
+		}
+	}
+
+	priv->stats.fifo_reconfigs++;
+	priv->fifo_reconfig = false;
+	mcp25xxfd_wake_queue(spi);
+
+	return ret;
+
+out_failed_err:
+	ret = err;
+out_failed:
+	/* the controller is in an undefined state, so keep tx stopped */
+	netdev_err(net, "fifo reconfiguration failed: %i - restart the interface\n",
+		   ret);
+	mcp25xxfd_free_spi_transmit_fifos(priv);
+	kfree(priv->irq_message);
+	priv->irq_message = NULL;
+	priv->tx_queue_status = TX_QUEUE_STATUS_STOPPED;
+	enable_irq(spi->irq);
+	if (priv->rx_napi)
+		napi_enable(&priv->napi);
+	priv->fifo_reconfig = false;
+
+	return ret;
+}
+
+/* fifo layout autotuner:
+ * every MCP25XXFD_AUTOTUNE_INTERVAL_MS the rx overflows and the number
+ * of times the last tx fifo got used (so the tx queue had to get stopped
+ * until all tx fifos were transmitted) are compared with the last run:
+ * * rx overflows without tx pressure halve the number of tx fifos
+ * * tx pressure without rx overflows doubles the number of tx fifos
+ *   (as long as MCP25XXFD_AUTOTUNE_MIN_RX_FIFOS rx fifos remain)
+ * the reconfiguration itself only happens if the tx fifos are idle
+ * within MCP25XXFD_AUTOTUNE_IDLE_MS, otherwise it is retried next run.
+ */
+#define MCP25XXFD_AUTOTUNE_INTERVAL_MS 1000
+#define MCP25XXFD_AUTOTUNE_IDLE_MS 5
+#define MCP25XXFD_AUTOTUNE_TX_FULL 4
+#define MCP25XXFD_AUTOTUNE_MIN_TX_FIFOS 1
+#define MCP25XXFD_AUTOTUNE_MIN_RX_FIFOS 4
+
+static void mcp25xxfd_fifo_autotune_snapshot(struct mcp25xxfd_priv *priv)
+{
+	int last = priv->fifos.tx_fifo_start + priv->fifos.tx_fifos - 1;
+
+	priv->autotune.rx_overflow = priv->stats.rx_overflow;
+	priv->autotune.tx_full = priv->stats.fifo_usage[last];
+}
+
+static u32 mcp25xxfd_fifo_autotune_tx(struct mcp25xxfd_priv *priv)
+{
+	int last = priv->fifos.tx_fifo_start + priv->fifos.tx_fifos - 1;
+	u64 rx_overflow = priv->stats.rx_overflow - priv->autotune.rx_overflow;
+	u64 tx_full = priv->stats.fifo_usage[last] - priv->autotune.tx_full;
+	u32 tx = priv->fifos.tx_fifos;
+
+	if (rx_overflow && !tx_full)
+		return max_t(u32, tx / 2, MCP25XXFD_AUTOTUNE_MIN_TX_FIFOS);
+
+	if (tx_full >= MCP25XXFD_AUTOTUNE_TX_FULL && !rx_overflow) {
+		for (tx = min_t(u32, 2 * tx, 30); tx > priv->fifos.tx_fifos;
+		     tx--)
+			if (mcp25xxfd_fifo_layout_fits(tx,
+						       MCP25XXFD_AUTOTUNE_MIN_RX_FIFOS,
+						       priv->fifos.rx_fifo_depth,
+						       priv->fifos.payload_size))
+				break;
+	}
+
+	return tx;
+}
+
+static void mcp25xxfd_fifo_autotune_work(struct work_struct *work)
+{
+	struct mcp25xxfd_priv *priv =
+	    container_of(to_delayed_work(work), struct mcp25xxfd_priv,
+			 autotune.work);
+	struct net_device *net = priv->net;
+	struct mcp25xxfd_fifo_layout layout;
+	u32 tx;
+	int ret;
+
+	/* mcp25xxfd_stop cancels us while holding rtnl */
+	if (!rtnl_trylock())
+		goto out;
+
+	if (!netif_running(net) || !priv->autotune.enabled) {
+		rtnl_unlock();
+		return;
+	}
+
+	tx = mcp25xxfd_fifo_autotune_tx(priv);
+	if (tx != priv->fifos.tx_fifos) {
+		layout = priv->fifo_layout;
+		layout.tx_fifos = tx;
+		ret = mcp25xxfd_reconfigure_fifos(net, &layout,
+						  MCP25XXFD_AUTOTUNE_IDLE_MS);
+		/* tx is busy, so keep the statistics for the next run */
+		if (ret == -EBUSY) {
+			rtnl_unlock();
+			goto out;
+		}
+		if (!ret)
+			netdev_info(net, "autotuner switched to %u tx-fifos\n",
+				    tx);
+	}
+	mcp25xxfd_fifo_autotune_snapshot(priv);
+
+	rtnl_unlock();
+out:
+	schedule_delayed_work(&priv->autotune.work,
+			      msecs_to_jiffies(MCP25XXFD_AUTOTUNE_INTERVAL_MS));
+}
+
+static void mcp25xxfd_fifo_autotune_start(struct mcp25xxfd_priv *priv)
+{
+	mcp25xxfd_fifo_autotune_snapshot(priv);
+	schedule_delayed_work(&priv->autotune.work,
+			      msecs_to_jiffies(MCP25XXFD_AUTOTUNE_INTERVAL_MS));
+}
+
 static int mcp25xxfd_open(struct net_device *net)
 {
 	struct mcp25xxfd_priv *priv = netdev_priv(net);
@@ -3742,16 +5532,29 @@ static int mcp25xxfd_open(struct net_device *net)
 
 	priv->force_quit = 0;
 
+	/* napi and multiqueue mode are decided when opening */
+	priv->rx_napi = use_napi;
+	priv->tx_mq = use_multiqueue && net->num_tx_queues > 1;
+	priv->napi_flags = 0;
+	if (priv->rx_napi)
+		napi_enable(&priv->napi);
+
 	/* clear those statistics */
 	memset(&priv->stats, 0, sizeof(priv->stats));
+	memset(&priv->rx_read, 0, sizeof(priv->rx_read));
+	memset(&priv->lat, 0, sizeof(priv->lat));
+	priv->lat.enabled = latency_stats;
 
-	ret = request_threaded_irq(spi->irq, NULL,
+	ret = request_threaded_irq(spi->irq,
+				   priv->lat.enabled ? mcp25xxfd_can_irq : NULL,
 				   mcp25xxfd_can_ist,
 				   IRQF_ONESHOT | IRQF_TRIGGER_LOW,
 				   DEVICE_NAME, priv);
 	if (ret) {
 		dev_err(&spi->dev, "failed to acquire irq %d - %i\n",
 			spi->irq, ret);
+		if (priv->rx_napi)
+			napi_disable(&priv->napi);
 		mcp25xxfd_power_enable(priv->transceiver, 0);
 		close_candev(net);
 		return ret;
@@ -3766,6 +5569,11 @@ static int mcp25xxfd_open(struct net_device *net)
 	if (ret)
 		goto open_clean;
 
+	ret = netif_set_real_num_tx_queues(net, priv->tx_mq ?
+					   priv->fifos.tx_fifos : 1);
+	if (ret)
+		goto open_clean;
+
 	mcp25xxfd_do_set_nominal_bittiming(net);
 	mcp25xxfd_do_set_data_bittiming(net);
 
@@ -3775,6 +5583,11 @@ static int mcp25xxfd_open(struct net_device *net)
 	/* setting up default state */
 	priv->can.state = CAN_STATE_ERROR_ACTIVE;
 
+	/* the TBC is running now */
+	ret = mcp25xxfd_tstamp_start(priv);
+	if (ret)
+		goto open_clean;
+
 	/* only now enable the interrupt on the controller */
 	ret = mcp25xxfd_enable_interrupts(spi, priv->spi_setup_speed_hz);
 	if (ret)
@@ -3783,13 +5596,21 @@ static int mcp25xxfd_open(struct net_device *net)
 	can_led_event(net, CAN_LED_EVENT_OPEN);
 
 	priv->tx_queue_status = TX_QUEUE_STATUS_RUNNING;
-	netif_wake_queue(net);
+	netif_tx_wake_all_queues(net);
+
+	if (priv->autotune.enabled)
+		mcp25xxfd_fifo_autotune_start(priv);
 
 	return 0;
 
 open_clean:
+	cancel_delayed_work_sync(&priv->tstamp.work);
 	mcp25xxfd_disable_interrupts(spi, priv->spi_setup_speed_hz);
 	free_irq(spi->irq, priv);
+	if (priv->rx_napi) {
+		napi_disable(&priv->napi);
+		skb_queue_purge(&priv->rx_queue);
+	}
 	mcp25xxfd_hw_sleep(spi);
 	mcp25xxfd_power_enable(priv->transceiver, 0);
 	close_candev(net);
@@ -3817,14 +5638,27 @@ static int mcp25xxfd_stop(struct net_device *net)
 	struct mcp25xxfd_priv *priv = netdev_priv(net);
 	struct spi_device *spi = priv->spi;
 
-	close_candev(net);
+	cancel_delayed_work_sync(&priv->autotune.work);
+	cancel_delayed_work_sync(&priv->tstamp.work);
 
-	kfree(priv->spi_transmit_fifos);
-	priv->spi_transmit_fifos = NULL;
+	close_candev(net);
 
 	priv->force_quit = 1;
 	free_irq(spi->irq, priv);
 
+	if (priv->rx_napi) {
+		napi_disable(&priv->napi);
+		/* the RXIE unmask message lives in irq_message */
+		while (test_bit(MCP25XXFD_NAPI_RX_UNMASKING,
+				&priv->napi_flags))
+			msleep(1);
+		skb_queue_purge(&priv->rx_queue);
+	}
+
+	mcp25xxfd_free_spi_transmit_fifos(priv);
+	kfree(priv->irq_message);
+	priv->irq_message = NULL;
+
 	/* Disable and clear pending interrupts */
 	mcp25xxfd_disable_interrupts(spi, priv->spi_setup_speed_hz);
 
@@ -3845,9 +5679,182 @@ static const struct net_device_ops mcp25xxfd_netdev_ops = {
 	.ndo_open = mcp25xxfd_open,
 	.ndo_stop = mcp25xxfd_stop,
 	.ndo_start_xmit = mcp25xxfd_start_xmit,
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+	.ndo_select_queue = mcp25xxfd_select_queue,
+#endif
 	.ndo_change_mtu = can_change_mtu,
 };
 
+/* sysfs attributes of the network device */
+#define MCP25XXFD_RECONFIG_IDLE_MS 100
+
+static ssize_t fifo_layout_show(struct device *dev,
+				struct device_attribute *attr, char *buf)
+{
+	struct mcp25xxfd_priv *priv = netdev_priv(to_net_dev(dev));
+
+	return sprintf(buf, "%u %u %u\n", priv->fifo_layout.tx_fifos,
+		       priv->fifo_layout.rx_fifo_depth,
+		       priv->fifo_layout.payload_size);
+}
+
+static ssize_t fifo_layout_store(struct device *dev,
+				 struct device_attribute *attr,
+				 const char *buf, size_t count)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct mcp25xxfd_priv *priv = netdev_priv(net);
+	struct mcp25xxfd_fifo_layout layout;
+	u32 max_payload = (net->mtu == CANFD_MTU) ? 64 : 8;
+	int ret;
+
+	if (sscanf(buf, "%u %u %u", &layout.tx_fifos,
+		   &layout.rx_fifo_depth, &layout.payload_size) != 3)
+		return -EINVAL;
+
+	/* check the layout with the defaults filled in */
+	if (layout.tx_fifos > 30 || layout.rx_fifo_depth > 32 ||
+	    layout.payload_size > max_payload ||
+	    (layout.payload_size &&
+	     mcp25xxfd_payload_mode(layout.payload_size) < 0))
+		return -EINVAL;
+	if (!mcp25xxfd_fifo_layout_fits(layout.tx_fifos ? :
+					(tx_fifos ? : 7), 1,
+					layout.rx_fifo_depth ? : 1,
+					layout.payload_size ? : max_payload))
+		return -ENOSPC;
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+
+	if (netif_running(net))
+		ret = mcp25xxfd_reconfigure_fifos(net, &layout,
+						  MCP25XXFD_RECONFIG_IDLE_MS);
+	else
+		ret = 0;
+	if (!ret)
+		priv->fifo_layout = layout;
+
+	rtnl_unlock();
+
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR_RW(fifo_layout);
+
+static ssize_t fifo_autotune_show(struct device *dev,
+				  struct device_attribute *attr, char *buf)
+{
+	struct mcp25xxfd_priv *priv = netdev_priv(to_net_dev(dev));
+
+	return sprintf(buf, "%u\n", priv->autotune.enabled);
+}
+
+static ssize_t fifo_autotune_store(struct device *dev,
+				   struct device_attribute *attr,
+				   const char *buf, size_t count)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct mcp25xxfd_priv *priv = netdev_priv(net);
+	bool enable;
+	int ret;
+
+	ret = kstrtobool(buf, &enable);
+	if (ret)
+		return ret;
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+
+	if (enable && !priv->autotune.enabled && netif_running(net))
+		mcp25xxfd_fifo_autotune_start(priv);
+	priv->autotune.enabled = enable;
+
+	rtnl_unlock();
+
+	return count;
+}
+
+static DEVICE_ATTR_RW(fifo_autotune);
+
+static ssize_t rx_filter_show(struct device *dev,
+			      struct device_attribute *attr, char *buf)
+{
+	struct mcp25xxfd_priv *priv = netdev_priv(to_net_dev(dev));
+	const struct mcp25xxfd_rx_rule *rule;
+	ssize_t len = 0;
+	int i;
+
+	for (i = 0; i < priv->rx_filter.rule_count; i++) {
+		rule = &priv->rx_filter.rules[i];
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%08x %08x %u\n",
+				 rule->can_id, rule->can_mask,
+				 rule->fifo_class);
+	}
+
+	return len;
+}
+
+/* "<can_id> <can_mask> [<fifo_class>]" (hex ids) adds a rule,
+ * "clear" removes all rules
+ */
+static ssize_t rx_filter_store(struct device *dev,
+			       struct device_attribute *attr,
+			       const char *buf, size_t count)
+{
+	struct net_device *net = to_net_dev(dev);
+	struct mcp25xxfd_priv *priv = netdev_priv(net);
+	struct mcp25xxfd_rx_rule rule = { };
+	u32 old_count;
+	int ret = 0;
+
+	if (!sysfs_streq(buf, "clear") &&
+	    sscanf(buf, "%x %x %u", &rule.can_id, &rule.can_mask,
+		   &rule.fifo_class) < 2)
+		return -EINVAL;
+	if (rule.fifo_class >= 31)
+		return -EINVAL;
+
+	if (!rtnl_trylock())
+		return restart_syscall();
+
+	old_count = priv->rx_filter.rule_count;
+	if (sysfs_streq(buf, "clear")) {
+		priv->rx_filter.rule_count = 0;
+	} else if (old_count < MCP25XXFD_RX_FILTERS) {
+		priv->rx_filter.rules[old_count] = rule;
+		priv->rx_filter.rule_count++;
+	} else {
+		ret = -ENOSPC;
+	}
+
+	if (!ret && netif_running(net)) {
+		ret = mcp25xxfd_update_rx_filters(net);
+		if (ret) {
+			priv->rx_filter.rule_count = old_count;
+			mcp25xxfd_compile_rx_filters(priv);
+		}
+	}
+
+	rtnl_unlock();
+
+	return ret ? ret : count;
+}
+
+static DEVICE_ATTR_RW(rx_filter);
+
+static struct attribute *mcp25xxfd_sysfs_attrs[] = {
+	&dev_attr_fifo_layout.attr,
+	&dev_attr_fifo_autotune.attr,
+	&dev_attr_rx_filter.attr,
+	NULL,
+};
+
+static const struct attribute_group mcp25xxfd_sysfs_group = {
+	.name = DEVICE_NAME,
+	.attrs = mcp25xxfd_sysfs_attrs,
+};
+
 static const struct of_device_id mcp25xxfd_of_match[] = {
 	{
 	 .compatible = "microchip,mcp2517fd",
@@ -3906,10 +5913,33 @@ static int mcp25xxfd_dump_regs(struct seq_file *file, void *offset)
 }
 
 #if defined(CONFIG_DEBUG_FS)
+/* one line per log2 bucket: times in ns, the spi cost per handler run */
+static int mcp25xxfd_dump_latency(struct seq_file *file, void *offset)
+{
+	struct spi_device *spi = file->private;
+	struct mcp25xxfd_priv *priv = spi_get_drvdata(spi);
+	int i, j;
+
+	seq_printf(file, "%-12s %10s %10s %10s %10s %10s %10s %10s\n",
+		   "<", "irq_ns", "status_ns", "fifo_ns", "release_ns",
+		   "deliver_ns", "spi_bytes", "spi_xfers");
+
+	for (i = 0; i < MCP25XXFD_LAT_BUCKETS; i++) {
+		seq_printf(file, "%-12llu", BIT_ULL(i));
+		for (j = 0; j < MCP25XXFD_LAT_STAGES; j++)
+			seq_printf(file, " %10llu", priv->lat.stage_hist[j][i]);
+		seq_printf(file, " %10llu %10llu\n",
+			   priv->lat.spi_bytes_hist[i],
+			   priv->lat.spi_xfers_hist[i]);
+	}
+
+	return 0;
+}
+
 static void mcp25xxfd_debugfs_add(struct mcp25xxfd_priv *priv)
 {
 	struct dentry *root, *fifousage, *fifoaddr, *rx, *tx, *status,
-	    *regs, *stats, *rxdlc, *txdlc;
+	    *regs, *stats, *rxdlc, *txdlc, *rxread, *rxdlcrecent, *lat;
 	char name[32];
 	int i;
 
@@ -3927,6 +5957,9 @@ static void mcp25xxfd_debugfs_add(struct mcp25xxfd_priv *priv)
 	fifousage = debugfs_create_dir("fifo_usage", stats);
 	rxdlc = debugfs_create_dir("rx_dlc_usage", stats);
 	txdlc = debugfs_create_dir("tx_dlc_usage", stats);
+	rxread = debugfs_create_dir("read_strategy", rx);
+	rxdlcrecent = debugfs_create_dir("dlc_recent", rxread);
+	lat = debugfs_create_dir("latency", root);
 
 	/* add spi speed info */
 	debugfs_create_u32("spi_setup_speed_hz", 0444, root,
@@ -3948,6 +5981,14 @@ static void mcp25xxfd_debugfs_add(struct mcp25xxfd_priv *priv)
 			   &priv->stats.rx_brs_count);
 	debugfs_create_u64("tx_brs_frames", 0444, stats,
 			   &priv->stats.tx_brs_count);
+	debugfs_create_u64("rx_napi_polls", 0444, stats,
+			   &priv->stats.rx_napi_polls);
+	debugfs_create_u64("rx_napi_masked", 0444, stats,
+			   &priv->stats.rx_napi_masked);
+	debugfs_create_u64("tx_batches", 0444, stats,
+			   &priv->stats.tx_batches);
+	debugfs_create_u64("tx_batch_frames", 0444, stats,
+			   &priv->stats.tx_batch_frames);
 
 	/* export the status structure */
 	debugfs_create_x32("intf", 0444, status, &priv->status.intf);
@@ -3977,6 +6018,20 @@ static void mcp25xxfd_debugfs_add(struct mcp25xxfd_priv *priv)
 	debugfs_create_u64("rx_overflow", 0444, rx, &priv->stats.rx_overflow);
 	debugfs_create_u64("rx_mab", 0444, stats, &priv->stats.rx_mab);
 
+	/* adaptive rx read strategy and its cost model */
+	debugfs_create_u32("cost_bulk", 0444, rxread,
+			   &priv->rx_read.cost_bulk);
+	debugfs_create_u32("cost_fifo", 0444, rxread,
+			   &priv->rx_read.cost_fifo);
+	debugfs_create_u64("bulk_reads", 0444, rxread,
+			   &priv->rx_read.bulk_count);
+	debugfs_create_u64("fifo_reads", 0444, rxread,
+			   &priv->rx_read.fifo_count);
+	debugfs_create_u64("pipelined_reads", 0444, rxread,
+			   &priv->rx_read.pipelined_count);
+	debugfs_create_u64("status_prefetched", 0444, rxread,
+			   &priv->rx_read.status_prefetch_count);
+
 	debugfs_create_u32("fifo_start", 0444, tx, &priv->fifos.tx_fifo_start);
 	debugfs_create_u32("fifo_count", 0444, tx, &priv->fifos.tx_fifos);
 	debugfs_create_x32("fifo_mask", 0444, tx, &priv->fifos.tx_fifo_mask);
@@ -3993,6 +6048,25 @@ static void mcp25xxfd_debugfs_add(struct mcp25xxfd_priv *priv)
 
 	debugfs_create_u32("fifo_max_payload_size", 0444, root,
 			   &priv->fifos.payload_size);
+	debugfs_create_u32("rx_fifo_depth", 0444, rx,
+			   &priv->fifos.rx_fifo_depth);
+	debugfs_create_x32("fifo_ovie_mask", 0444, rx,
+			   &priv->fifos.rx_ovie_mask);
+	debugfs_create_u32("filter_count", 0444, rx,
+			   &priv->rx_filter.hw_count);
+	debugfs_create_u64("fifo_reconfigs", 0444, stats,
+			   &priv->stats.fifo_reconfigs);
+
+	/* hardware timestamp conversion */
+	debugfs_create_u32("tstamp_prescaler", 0444, regs,
+			   &priv->tstamp.prescaler);
+	debugfs_create_u32("tstamp_period_ms", 0444, root,
+			   &priv->tstamp.period_ms);
+	debugfs_create_u32("tstamp_mult", 0444, root, &priv->tstamp.cc.mult);
+	debugfs_create_u64("tstamp_steps", 0444, stats,
+			   &priv->stats.tstamp_steps);
+	debugfs_create_u64("tstamp_slow_reads", 0444, stats,
+			   &priv->stats.tstamp_slow_reads);
 
 	/* interrupt statistics */
 	debugfs_create_u64("int", 0444, stats, &priv->stats.irq_calls);
@@ -4024,6 +6098,8 @@ static void mcp25xxfd_debugfs_add(struct mcp25xxfd_priv *priv)
 				   &priv->stats.rx_dlc_usage[i]);
 		debugfs_create_u64(name, 0444, txdlc,
 				   &priv->stats.tx_dlc_usage[i]);
+		debugfs_create_u32(name, 0444, rxdlcrecent,
+				   &priv->rx_read.dlc_recent[i]);
 	}
 
 	/* statistics on fifo buffer usage and address */
@@ -4035,6 +6111,15 @@ static void mcp25xxfd_debugfs_add(struct mcp25xxfd_priv *priv)
 				   &priv->fifos.fifo_address[i]);
 	}
 
+	/* irq handler timing - only recorded with latency_stats */
+	debugfs_create_bool("enabled", 0444, lat, &priv->lat.enabled);
+	debugfs_create_u64("spi_bytes", 0444, lat,
+			   &priv->lat.spi_bytes_total);
+	debugfs_create_u64("spi_xfers", 0444, lat,
+			   &priv->lat.spi_xfers_total);
+	debugfs_create_devm_seqfile(&priv->spi->dev, "histogram",
+				    lat, mcp25xxfd_dump_latency);
+
 	/* dump the controller registers themselves */
 	debugfs_create_devm_seqfile(&priv->spi->dev, "reg_dump",
 				    root, mcp25xxfd_dump_regs);
@@ -4130,11 +6215,18 @@ static int mcp25xxfd_can_probe(struct spi_device *spi)
 	}
 
 	/* Allocate can/net device */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 19, 0)
+	net = alloc_candev_mqs(sizeof(*priv), TX_ECHO_SKB_MAX,
+			       MCP25XXFD_TX_QUEUES_MAX, 1);
+#else
 	net = alloc_candev(sizeof(*priv), TX_ECHO_SKB_MAX);
+#endif
 	if (!net)
 		return -ENOMEM;
 
 	net->netdev_ops = &mcp25xxfd_netdev_ops;
+	net->ethtool_ops = &mcp25xxfd_ethtool_ops;
+	net->sysfs_groups[0] = &mcp25xxfd_sysfs_group;
 	net->flags |= IFF_ECHO;
 
 	priv = netdev_priv(net);
@@ -4166,6 +6258,15 @@ static int mcp25xxfd_can_probe(struct spi_device *spi)
 
 	mutex_init(&priv->clk_user_lock);
 	mutex_init(&priv->spi_rxtx_lock);
+	spin_lock_init(&priv->tx_lock);
+	spin_lock_init(&priv->tstamp.lock);
+
+	skb_queue_head_init(&priv->rx_queue);
+	netif_napi_add(net, &priv->napi, mcp25xxfd_napi_poll,
+		       NAPI_POLL_WEIGHT);
+
+	INIT_DELAYED_WORK(&priv->autotune.work, mcp25xxfd_fifo_autotune_work);
+	INIT_DELAYED_WORK(&priv->tstamp.work, mcp25xxfd_tstamp_work);
 
 	/* enable the clock and mark as enabled */
 	priv->clk_user_mask = MCP25XXFD_CLK_USER_CAN;
@@ -4319,6 +6420,8 @@ static int mcp25xxfd_can_remove(struct spi_device *spi)
 
 	unregister_candev(net);
 
+	netif_napi_del(&priv->napi);
+
 	mcp25xxfd_power_enable(priv->power, 0);
 
 	if (!IS_ERR(priv->clk))
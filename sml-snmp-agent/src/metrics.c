@@ -0,0 +1,269 @@
+/* ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <info@gerhard-bertelsmann.de> wrote this file. As long as you retain this
+ * notice you can do whatever you want with this stuff. If we meet some day,
+ * and you think this stuff is worth it, you can buy me a beer in return
+ * Gerhard Bertelsmann
+ * ----------------------------------------------------------------------------
+ */
+
+/*
+ * OBIS code to metric mapping
+ *
+ * config file - one metric per line, '#' starts a comment:
+ *
+ *   <OBIS A-B:C.D.E[*F]>  <name>  [integer|counter|gauge]  [scaler]  [OID]
+ *
+ * F defaults to 255, the OID to 1.3.6.1.4.1.39241.C.D.E
+ *
+ * the OBIS codes go into an open addressing hash table (linear probing,
+ * the 6 byte code packed into a 64 bit key), so the lookup per SML list
+ * entry costs the same no matter how many codes are mapped
+ *
+ * the values of a file are published with a seqlock: the reader thread is
+ * the only writer and never waits, the SNMP thread copies the values and
+ * retries if the sequence count changed meanwhile
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "snmp.h"
+#include "metrics.h"
+
+#define MAXLINE		256
+#define OID_BASE	"1.3.6.1.4.1.39241"
+
+#define HASH_BITS	8	/* table size >= 2 * METRICS_MAX */
+#define HASH_SIZE	(1 << HASH_BITS)
+#define HASH_USED	(1ULL << 63)
+
+struct metric metrics[METRICS_MAX];
+unsigned int metric_values[METRICS_MAX];
+int metrics_len;
+
+static uint64_t hash_key[HASH_SIZE];
+static unsigned char hash_slot[HASH_SIZE];
+
+/* the published values - seq is odd while an update is in progress */
+static struct {
+    unsigned int seq;
+    unsigned int files;
+    unsigned int values[METRICS_MAX];
+} snapshot;
+
+/* the codes the agent always had */
+static const char *metrics_builtin[] = {
+    "1-0:1.8.0   tarif0    integer",
+    "1-0:1.8.1   tarif1    integer",
+    "1-0:1.8.2   tarif2    integer",
+    "1-0:2.8.0   deliver0  integer",
+    "1-0:16.7.0  power     integer",
+};
+
+static uint64_t obis_key(const unsigned char *obis) {
+    uint64_t key = HASH_USED;
+    int i;
+
+    for (i = 0; i < OBIS_LEN; i++)
+	key |= (uint64_t) obis[i] << (i * 8);
+    return key;
+}
+
+static unsigned int obis_hash(uint64_t key) {
+    return (key * 0x9e3779b97f4a7c15ULL) >> (64 - HASH_BITS);
+}
+
+static int metrics_insert(int slot) {
+    uint64_t key = obis_key(metrics[slot].obis);
+    unsigned int h = obis_hash(key);
+
+    while (hash_key[h]) {
+	if (hash_key[h] == key)
+	    return -1;
+	h = (h + 1) & (HASH_SIZE - 1);
+    }
+    hash_key[h] = key;
+    hash_slot[h] = slot;
+    return 0;
+}
+
+int metrics_lookup(const unsigned char *obis, int len) {
+    uint64_t key;
+    unsigned int h;
+
+    if (len != OBIS_LEN)
+	return -1;
+    key = obis_key(obis);
+    for (h = obis_hash(key); hash_key[h]; h = (h + 1) & (HASH_SIZE - 1)) {
+	if (hash_key[h] == key)
+	    return hash_slot[h];
+    }
+    return -1;
+}
+
+static int parse_obis(const char *s, unsigned char *obis) {
+    unsigned int v[OBIS_LEN];
+    int i, n = 0;
+
+    v[5] = 255;
+    if (sscanf(s, "%u-%u:%u.%u.%u%n", &v[0], &v[1], &v[2], &v[3], &v[4], &n) != 5)
+	return -1;
+    if (s[n] == '*') {
+	s += n + 1;
+	n = 0;
+	if (sscanf(s, "%u%n", &v[5], &n) != 1)
+	    return -1;
+    }
+    if (s[n])
+	return -1;
+    for (i = 0; i < OBIS_LEN; i++) {
+	if (v[i] > 255)
+	    return -1;
+	obis[i] = v[i];
+    }
+    return 0;
+}
+
+static int metrics_parse_line(char *line, const char *filename, int lineno) {
+    struct metric *m;
+    char *obis, *name, *type, *scaler, *oid, *end;
+
+    line[strcspn(line, "#\r\n")] = 0;
+    obis = strtok(line, " \t");
+    if (!obis)
+	return 0;
+
+    if (metrics_len == METRICS_MAX) {
+	fprintf(stderr, "%s:%d: more than %d metrics\n", filename, lineno, METRICS_MAX);
+	return -1;
+    }
+    m = &metrics[metrics_len];
+    memset(m, 0, sizeof(*m));
+
+    if (parse_obis(obis, m->obis)) {
+	fprintf(stderr, "%s:%d: invalid OBIS code %s\n", filename, lineno, obis);
+	return -1;
+    }
+
+    name = strtok(NULL, " \t");
+    if (!name || strlen(name) >= METRIC_NAME_LEN) {
+	fprintf(stderr, "%s:%d: missing or too long metric name\n", filename, lineno);
+	return -1;
+    }
+    strcpy(m->name, name);
+
+    type = strtok(NULL, " \t");
+    if (!type || !strcmp(type, "integer")) {
+	m->type = PRIMV_INT;
+    } else if (!strcmp(type, "counter")) {
+	m->type = PRIMV_COUNTR;
+    } else if (!strcmp(type, "gauge")) {
+	m->type = PRIMV_GAUGE;
+    } else {
+	fprintf(stderr, "%s:%d: unknown type %s\n", filename, lineno, type);
+	return -1;
+    }
+
+    scaler = strtok(NULL, " \t");
+    if (scaler) {
+	m->scaler = strtol(scaler, &end, 10);
+	if (*end) {
+	    fprintf(stderr, "%s:%d: invalid scaler %s\n", filename, lineno, scaler);
+	    return -1;
+	}
+    }
+    m->factor = pow(10, m->scaler);
+
+    oid = strtok(NULL, " \t");
+    if (oid) {
+	if (strlen(oid) >= METRIC_OID_LEN) {
+	    fprintf(stderr, "%s:%d: OID too long\n", filename, lineno);
+	    return -1;
+	}
+	strcpy(m->oid, oid);
+    } else {
+	snprintf(m->oid, METRIC_OID_LEN, OID_BASE ".%u.%u.%u", m->obis[2], m->obis[3], m->obis[4]);
+    }
+
+    if (metrics_insert(metrics_len)) {
+	fprintf(stderr, "%s:%d: duplicate OBIS code %s\n", filename, lineno, obis);
+	return -1;
+    }
+    metrics_len++;
+    return 0;
+}
+
+static void metrics_clear(void) {
+    metrics_len = 0;
+    memset(hash_key, 0, sizeof(hash_key));
+    memset(metric_values, 0, sizeof(metric_values));
+}
+
+void metrics_publish(void) {
+    unsigned int seq = snapshot.seq;
+    int i;
+
+    __atomic_store_n(&snapshot.seq, seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    for (i = 0; i < metrics_len; i++)
+	__atomic_store_n(&snapshot.values[i], metric_values[i], __ATOMIC_RELAXED);
+    __atomic_store_n(&snapshot.files, snapshot.files + 1, __ATOMIC_RELAXED);
+    __atomic_store_n(&snapshot.seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* copies the values of the last published file - returns the number of files */
+unsigned int metrics_snapshot(unsigned int *values) {
+    unsigned int seq, files;
+    int i;
+
+    for (;;) {
+	seq = __atomic_load_n(&snapshot.seq, __ATOMIC_ACQUIRE);
+	if (seq & 1)
+	    continue;
+	for (i = 0; i < metrics_len; i++)
+	    values[i] = __atomic_load_n(&snapshot.values[i], __ATOMIC_RELAXED);
+	files = __atomic_load_n(&snapshot.files, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	if (__atomic_load_n(&snapshot.seq, __ATOMIC_RELAXED) == seq)
+	    return files;
+    }
+}
+
+int metrics_load(const char *filename) {
+    char line[MAXLINE];
+    FILE *fp;
+    int lineno = 0;
+
+    fp = fopen(filename, "r");
+    if (!fp) {
+	fprintf(stderr, "can't open config file %s\n", filename);
+	return -1;
+    }
+
+    metrics_clear();
+    while (fgets(line, sizeof(line), fp)) {
+	lineno++;
+	if (metrics_parse_line(line, filename, lineno)) {
+	    fclose(fp);
+	    return -1;
+	}
+    }
+    fclose(fp);
+    return 0;
+}
+
+int metrics_default(void) {
+    char line[MAXLINE];
+    unsigned int i;
+
+    metrics_clear();
+    for (i = 0; i < sizeof(metrics_builtin) / sizeof(metrics_builtin[0]); i++) {
+	strcpy(line, metrics_builtin[i]);
+	if (metrics_parse_line(line, "builtin", i + 1))
+	    return -1;
+    }
+    return 0;
+}
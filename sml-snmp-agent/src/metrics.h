@@ -0,0 +1,43 @@
+/* ----------------------------------------------------------------------------
+ * "THE BEER-WARE LICENSE" (Revision 42):
+ * <info@gerhard-bertelsmann.de> wrote this file. As long as you retain this
+ * notice you can do whatever you want with this stuff. If we meet some day,
+ * and you think this stuff is worth it, you can buy me a beer in return
+ * Gerhard Bertelsmann
+ * ----------------------------------------------------------------------------
+ */
+
+#ifndef _METRICS_H_
+#define _METRICS_H_
+
+#define OBIS_LEN	6
+#define METRICS_MAX	128
+#define METRIC_NAME_LEN	32
+#define METRIC_OID_LEN	64
+
+/* one OBIS code we export - the value lives in metric_values[slot] */
+struct metric {
+    unsigned char obis[OBIS_LEN];
+    char name[METRIC_NAME_LEN];
+    char oid[METRIC_OID_LEN];
+    unsigned char type;		/* SNMP type: PRIMV_INT, PRIMV_COUNTR or PRIMV_GAUGE */
+    int scaler;			/* power of ten applied on top of the SML scaler */
+    double factor;		/* 10^scaler */
+};
+
+extern struct metric metrics[METRICS_MAX];
+extern unsigned int metric_values[METRICS_MAX];
+extern int metrics_len;
+
+int metrics_load(const char *filename);
+int metrics_default(void);
+int metrics_lookup(const unsigned char *obis, int len);
+
+/*
+ * metric_values belongs to the reader thread - it publishes them once per
+ * SML file, the SNMP thread takes a consistent copy without any lock
+ */
+void metrics_publish(void);
+unsigned int metrics_snapshot(unsigned int *values);
+
+#endif
@@ -0,0 +1,91 @@
+// Copyright 2011 Juri Glass, Mathias Runge, Nadim El Sayed
+// DAI-Labor, TU-Berlin
+//
+// This file is part of libSML.
+//
+// libSML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libSML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libSML.  If not, see <http://www.gnu.org/licenses/>.
+
+// compares sml_crc16_update with the byte at a time table loop
+//
+// usage: crc16_bench [megabytes]
+
+#include <sml/sml_crc16.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+static u16 bytetab[256];
+
+static u16 crc16_bytewise(u16 crc, const unsigned char *cp, size_t len) {
+	while (len--) {
+		crc = (crc >> 8) ^ bytetab[(crc ^ *cp++) & 0xff];
+	}
+
+	return crc;
+}
+
+static double now() {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+	size_t len = (argc > 1 ? atoi(argv[1]) : 64) << 20;
+	size_t chunk, i;
+	unsigned char *buf;
+	double t, mb = len / 1e6;
+	u16 a, b;
+	int j;
+
+	for (i = 0; i < 256; i++) {
+		u16 c = i;
+		for (j = 0; j < 8; j++) {
+			c = (c & 1) ? (c >> 1) ^ 0x8408 : c >> 1;
+		}
+		bytetab[i] = c;
+	}
+
+	buf = malloc(len);
+	if (!buf) {
+		return 1;
+	}
+	for (i = 0; i < len; i++) {
+		buf[i] = rand();
+	}
+
+	// 32 byte chunks stay on the table path, 64k chunks use clmul if available
+	for (chunk = 32; chunk <= 65536; chunk *= 2048) {
+		t = now();
+		a = sml_crc16_init();
+		for (i = 0; i < len; i += chunk) {
+			a = crc16_bytewise(a, &buf[i], chunk);
+		}
+		t = now() - t;
+		printf("chunk %6zu  bytewise %8.1f MB/s\n", chunk, mb / t);
+
+		t = now();
+		b = sml_crc16_init();
+		for (i = 0; i < len; i += chunk) {
+			b = sml_crc16_update(b, &buf[i], chunk);
+		}
+		t = now() - t;
+		printf("chunk %6zu  update   %8.1f MB/s%s\n", chunk, mb / t, a == b ? "" : "  MISMATCH");
+	}
+
+	free(buf);
+
+	return 0;
+}
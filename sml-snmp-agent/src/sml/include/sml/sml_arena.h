@@ -0,0 +1,66 @@
+// Copyright 2011 Juri Glass, Mathias Runge, Nadim El Sayed
+// DAI-Labor, TU-Berlin
+//
+// This file is part of libSML.
+//
+// libSML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libSML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libSML.  If not, see <http://www.gnu.org/licenses/>.
+
+#ifndef SML_ARENA_H_
+#define SML_ARENA_H_
+
+#include <stdlib.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define SML_ARENA_BLOCK_SIZE 4096
+
+typedef struct sml_arena_block {
+	struct sml_arena_block *next;
+	size_t size;
+	size_t used;
+	unsigned char data[];
+} sml_arena_block;
+
+// bump allocator for the objects of a parsed file - everything gets
+// released at once by sml_arena_reset, the blocks are kept for the next file
+typedef struct {
+	sml_arena_block *blocks;
+	sml_arena_block *current;
+	size_t block_size;
+} sml_arena;
+
+sml_arena *sml_arena_init(size_t block_size);
+void *sml_arena_alloc(sml_arena *arena, size_t size);
+void sml_arena_reset(sml_arena *arena);
+void sml_arena_free(sml_arena *arena);
+
+// the allocation functions of the object model - they allocate from the
+// arena of the running sml_file_parse_arena call (per thread) and fall
+// back to malloc/free otherwise
+void *sml_malloc(size_t size);
+void *sml_realloc(void *ptr, size_t old_size, size_t size);
+void sml_free(void *ptr);
+
+// set the arena for the calling thread, returns the previous one
+sml_arena *sml_arena_use(sml_arena *arena);
+// non-zero while an arena is set - octet strings don't copy their data then
+int sml_arena_active();
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SML_ARENA_H_ */
@@ -31,6 +31,15 @@ u16 sml_crc16_calculate(unsigned char *cp, int len);
 // CRC-16/CCITT(Kermit) implementation poly=0x1021 init=0x0000 refin=true refout=true xorout=0x0000
 u16 sml_crc16kermit_calculate(unsigned char *cp, int len);
 
+// streaming variants: crc = init(); crc = sml_crc16_update(crc, ...); ...; final(crc)
+// gives the same result as the _calculate functions over all the data
+// update works on 8 bytes per step, larger buffers get folded with pclmul on x86
+u16 sml_crc16_init();
+u16 sml_crc16_update(u16 crc, const unsigned char *cp, size_t len);
+u16 sml_crc16_final(u16 crc);
+u16 sml_crc16kermit_init();
+u16 sml_crc16kermit_final(u16 crc);
+
 #ifdef __cplusplus
 }
 #endif
@@ -32,11 +32,17 @@ typedef struct {
 	sml_message **messages;
 	short messages_len;
 	sml_buffer *buf;
+	sml_arena *arena; // set for files parsed by sml_file_parse_arena
 } sml_file;
 
 sml_file *sml_file_init();
 // parses a SML file.
 sml_file *sml_file_parse(unsigned char *buffer, size_t buffer_len);
+// parses a SML file without copying - the file borrows buffer, which has to
+// stay valid and unchanged until sml_file_free. Octet strings point into
+// buffer. All objects are placed in arena, sml_file_free just resets it,
+// so don't free single objects of such a file.
+sml_file *sml_file_parse_arena(unsigned char *buffer, size_t buffer_len, sml_arena *arena);
 void sml_file_add_message(sml_file *file, sml_message *message);
 void sml_file_write(sml_file *file);
 void sml_file_free(sml_file *file);
@@ -19,6 +19,7 @@
 #ifndef SML_SHARED_H_
 #define SML_SHARED_H_
 
+#include "sml_arena.h"
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
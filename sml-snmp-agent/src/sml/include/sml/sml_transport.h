@@ -21,6 +21,7 @@
 
 #include <sml/sml_file.h>
 #include <stdlib.h>
+#include <sys/types.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -33,10 +34,44 @@ extern "C" {
 size_t sml_transport_read(int fd, unsigned char *buffer, size_t max_len);
 
 // sml_transport_listen is an endless loop which reads continously
-// via sml_transport_read and calls the sml_transporter_receiver
+// via a sml_transport_reader and calls the sml_transporter_receiver
 void sml_transport_listen(int fd,
 						  void (*sml_transport_receiver)(unsigned char *buffer, size_t buffer_len));
 
+#define SML_TRANSPORT_BUFFER_LEN 8096
+
+// streaming reader: reads in large chunks, unescapes 1b1b1b1b sequences in
+// place and checks the CRC while the bytes come in. The receiver gets the
+// file from start to end sequence (escape sequences removed) inside the
+// reader buffer - it is only valid during the call.
+typedef struct {
+	unsigned char buf[SML_TRANSPORT_BUFFER_LEN];
+	size_t fill;  // bytes in buf
+	size_t scan;  // next byte to look at
+	size_t start; // start sequence of the current file
+	size_t out;   // end of the unescaped part of the current file
+	int in_file;
+	u16 crc;        // CRC16 (x25) over the raw bytes of the file so far
+	u16 crc_kermit; // some meters use CRC16 Kermit
+	unsigned long files;
+	unsigned long crc_errors;
+	unsigned long dropped; // overlong or unknown escape sequences
+} sml_transport_reader;
+
+void sml_transport_reader_init(sml_transport_reader *reader);
+
+// reads once from fd and delivers the complete files. Returns the number of
+// bytes read, 0 on EOF and -1 on errors
+ssize_t sml_transport_reader_read(sml_transport_reader *reader, int fd,
+								  void (*sml_transport_receiver)(unsigned char *buffer,
+																 size_t buffer_len));
+
+// same for data which didn't come from a fd, returns the bytes taken
+size_t sml_transport_reader_feed(sml_transport_reader *reader, const unsigned char *data,
+								 size_t len,
+								 void (*sml_transport_receiver)(unsigned char *buffer,
+																size_t buffer_len));
+
 // sml_transport_writes adds the SML transport protocol escape
 // sequences and writes the given file to fd. The file must be
 // in the parsed format.
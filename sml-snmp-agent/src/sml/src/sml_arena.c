@@ -0,0 +1,139 @@
+// Copyright 2011 Juri Glass, Mathias Runge, Nadim El Sayed
+// DAI-Labor, TU-Berlin
+//
+// This file is part of libSML.
+//
+// libSML is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// libSML is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with libSML.  If not, see <http://www.gnu.org/licenses/>.
+
+#include <sml/sml_arena.h>
+#include <string.h>
+
+// all allocations are aligned to this
+#define SML_ARENA_ALIGN 8
+
+static __thread sml_arena *sml_current_arena = NULL;
+
+static sml_arena_block *sml_arena_block_init(size_t size) {
+	sml_arena_block *block = (sml_arena_block *)malloc(sizeof(sml_arena_block) + size);
+	if (block == NULL) {
+		return NULL;
+	}
+	*block = (sml_arena_block){.next = NULL, .size = size, .used = 0};
+
+	return block;
+}
+
+sml_arena *sml_arena_init(size_t block_size) {
+	sml_arena *arena = (sml_arena *)malloc(sizeof(sml_arena));
+	if (arena == NULL) {
+		return NULL;
+	}
+	if (block_size == 0) {
+		block_size = SML_ARENA_BLOCK_SIZE;
+	}
+	*arena = (sml_arena){.blocks = NULL, .current = NULL, .block_size = block_size};
+
+	arena->blocks = sml_arena_block_init(block_size);
+	if (arena->blocks == NULL) {
+		free(arena);
+		return NULL;
+	}
+	arena->current = arena->blocks;
+
+	return arena;
+}
+
+void *sml_arena_alloc(sml_arena *arena, size_t size) {
+	sml_arena_block *block = arena->current;
+	void *p;
+
+	size = (size + SML_ARENA_ALIGN - 1) & ~(size_t)(SML_ARENA_ALIGN - 1);
+
+	while (block->used + size > block->size) {
+		// blocks are kept on reset, reuse the next one if it fits
+		if (block->next == NULL) {
+			size_t block_size = arena->block_size;
+			if (size > block_size) {
+				block_size = size;
+			}
+			block->next = sml_arena_block_init(block_size);
+			if (block->next == NULL) {
+				return NULL;
+			}
+		}
+		block = block->next;
+		block->used = 0;
+	}
+	arena->current = block;
+
+	p = &block->data[block->used];
+	block->used += size;
+
+	return p;
+}
+
+void sml_arena_reset(sml_arena *arena) {
+	if (arena) {
+		arena->current = arena->blocks;
+		arena->blocks->used = 0;
+	}
+}
+
+void sml_arena_free(sml_arena *arena) {
+	if (arena) {
+		sml_arena_block *block = arena->blocks;
+		while (block) {
+			sml_arena_block *next = block->next;
+			free(block);
+			block = next;
+		}
+		free(arena);
+	}
+}
+
+sml_arena *sml_arena_use(sml_arena *arena) {
+	sml_arena *prev = sml_current_arena;
+	sml_current_arena = arena;
+
+	return prev;
+}
+
+int sml_arena_active() { return sml_current_arena != NULL; }
+
+void *sml_malloc(size_t size) {
+	if (sml_current_arena) {
+		return sml_arena_alloc(sml_current_arena, size);
+	}
+
+	return malloc(size);
+}
+
+void *sml_realloc(void *ptr, size_t old_size, size_t size) {
+	if (sml_current_arena) {
+		void *p = sml_arena_alloc(sml_current_arena, size);
+		if (p && ptr) {
+			memcpy(p, ptr, old_size < size ? old_size : size);
+		}
+		return p;
+	}
+
+	return realloc(ptr, size);
+}
+
+void sml_free(void *ptr) {
+	// arena memory goes away with sml_arena_reset
+	if (sml_current_arena == NULL) {
+		free(ptr);
+	}
+}
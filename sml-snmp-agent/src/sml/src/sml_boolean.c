@@ -20,7 +20,7 @@
 #include <stdio.h>
 
 sml_boolean *sml_boolean_init(u8 b) {
-	sml_boolean *boolean = malloc(sizeof(u8));
+	sml_boolean *boolean = sml_malloc(sizeof(u8));
 	*boolean = b;
 
 	return boolean;
@@ -72,6 +72,6 @@ void sml_boolean_write(sml_boolean *boolean, sml_buffer *buf) {
 
 void sml_boolean_free(sml_boolean *b) {
 	if (b) {
-		free(b);
+		sml_free(b);
 	}
 }
@@ -17,6 +17,12 @@
 // along with libSML.  If not, see <http://www.gnu.org/licenses/>.
 
 #include <sml/sml_crc16.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <wmmintrin.h>
+#define SML_CRC16_CLMUL
+#endif
 
 #define PPPINITFCS16 0xffff // initial FCS value
 
@@ -45,25 +51,132 @@ static u16 crctab[256] = {
 	0xf78f, 0xe606, 0xd49d, 0xc514, 0xb1ab, 0xa022, 0x92b9, 0x8330, 0x7bc7, 0x6a4e, 0x58d5, 0x495c,
 	0x3de3, 0x2c6a, 0x1ef1, 0x0f78};
 
-u16 sml_crc16_calculate(unsigned char *cp, int len) {
-	u16 fcs = PPPINITFCS16;
+// slicing-by-8: crctab_slice[k][b] is the crc of byte b followed by k zero bytes
+static u16 crctab_slice[8][256];
 
-	while (len--) {
-		fcs = (fcs >> 8) ^ crctab[(fcs ^ *cp++) & 0xff];
+#ifdef SML_CRC16_CLMUL
+// folding constants x^191 mod P and x^127 mod P, bit reversed in 64 bits -
+// plain integers, as only sml_crc16_clmul may use SSE
+static int crc_clmul;
+static u64 crc_fold_k[2];
+#endif
+
+// x^n mod P for P = x^16 + x^12 + x^5 + 1
+static u16 sml_crc16_xpow(int n) {
+	u16 r = 1;
+
+	while (n--) {
+		r = (r & 0x8000) ? (r << 1) ^ 0x1021 : r << 1;
 	}
 
-	fcs ^= 0xffff;
-	fcs = ((fcs & 0xff) << 8) | ((fcs & 0xff00) >> 8);
+	return r;
+}
+
+static u64 sml_crc16_rev64(u16 k) {
+	u64 r = 0;
+	int i;
 
-	return fcs;
+	for (i = 0; i < 16; i++) {
+		if (k & (1 << i)) {
+			r |= 1ULL << (63 - i);
+		}
+	}
+
+	return r;
 }
 
-u16 sml_crc16kermit_calculate(unsigned char *cp, int len) {
-	u16 crc = 0x000;
+static void __attribute__((constructor)) sml_crc16_tables() {
+	int i, k;
 
+	for (i = 0; i < 256; i++) {
+		crctab_slice[0][i] = crctab[i];
+	}
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			u16 c = crctab_slice[k - 1][i];
+			crctab_slice[k][i] = (c >> 8) ^ crctab[c & 0xff];
+		}
+	}
+
+#ifdef SML_CRC16_CLMUL
+	__builtin_cpu_init();
+	crc_clmul = __builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse2");
+	crc_fold_k[0] = sml_crc16_rev64(sml_crc16_xpow(191));
+	crc_fold_k[1] = sml_crc16_rev64(sml_crc16_xpow(127));
+#endif
+}
+
+static u16 sml_crc16_slice8(u16 crc, const unsigned char *cp, size_t len) {
+	while (len >= 8) {
+		crc ^= cp[0] | (cp[1] << 8);
+		crc = crctab_slice[7][crc & 0xff] ^ crctab_slice[6][crc >> 8] ^ crctab_slice[5][cp[2]] ^
+			  crctab_slice[4][cp[3]] ^ crctab_slice[3][cp[4]] ^ crctab_slice[2][cp[5]] ^
+			  crctab_slice[1][cp[6]] ^ crctab_slice[0][cp[7]];
+		cp += 8;
+		len -= 8;
+	}
 	while (len--) {
 		crc = (crc >> 8) ^ crctab[(crc ^ *cp++) & 0xff];
 	}
 
 	return crc;
 }
+
+#ifdef SML_CRC16_CLMUL
+// fold 16 byte blocks into one with carry-less multiplies: the high degree
+// half A_hi and the low half A_lo of a block are replaced by A_hi * x^192 and
+// A_lo * x^128 mod P, which lands within the next block. The register is
+// bit reflected, hence the constants for x^191 and x^127.
+__attribute__((target("pclmul,sse2"))) static u16 sml_crc16_clmul(u16 crc, const unsigned char *cp,
+																  size_t len) {
+	unsigned char block[16];
+	__m128i x, k = _mm_loadu_si128((const __m128i *)crc_fold_k);
+	size_t n = len & ~(size_t)15;
+
+	memcpy(block, cp, 16);
+	block[0] ^= crc & 0xff;
+	block[1] ^= crc >> 8;
+	x = _mm_loadu_si128((const __m128i *)block);
+
+	for (cp += 16; n > 16; cp += 16, n -= 16) {
+		x = _mm_xor_si128(_mm_xor_si128(_mm_clmulepi64_si128(x, k, 0x00),
+										_mm_clmulepi64_si128(x, k, 0x11)),
+						  _mm_loadu_si128((const __m128i *)cp));
+	}
+
+	_mm_storeu_si128((__m128i *)block, x);
+	crc = sml_crc16_slice8(0, block, 16);
+
+	return sml_crc16_slice8(crc, cp, len & 15);
+}
+#endif
+
+u16 sml_crc16_init() { return PPPINITFCS16; }
+
+u16 sml_crc16_update(u16 crc, const unsigned char *cp, size_t len) {
+#ifdef SML_CRC16_CLMUL
+	if (crc_clmul && len >= 64) {
+		return sml_crc16_clmul(crc, cp, len);
+	}
+#endif
+
+	return sml_crc16_slice8(crc, cp, len);
+}
+
+u16 sml_crc16_final(u16 crc) {
+	crc ^= 0xffff;
+
+	return ((crc & 0xff) << 8) | ((crc & 0xff00) >> 8);
+}
+
+u16 sml_crc16kermit_init() { return 0x0000; }
+
+u16 sml_crc16kermit_final(u16 crc) { return crc; }
+
+u16 sml_crc16_calculate(unsigned char *cp, int len) {
+	return sml_crc16_final(sml_crc16_update(sml_crc16_init(), cp, len));
+}
+
+u16 sml_crc16kermit_calculate(unsigned char *cp, int len) {
+	return sml_crc16kermit_final(sml_crc16_update(sml_crc16kermit_init(), cp, len));
+}
@@ -27,14 +27,7 @@
 // EDL meter must provide at least 250 bytes as a receive buffer
 #define SML_FILE_BUFFER_LENGTH 512
 
-sml_file *sml_file_parse(unsigned char *buffer, size_t buffer_len) {
-	sml_file *file = (sml_file *)malloc(sizeof(sml_file));
-	*file = (sml_file){.messages = NULL, .messages_len = 0, .buf = NULL};
-
-	sml_buffer *buf = sml_buffer_init(buffer_len);
-	memcpy(buf->buffer, buffer, buffer_len);
-	file->buf = buf;
-
+static void sml_file_parse_messages(sml_file *file, sml_buffer *buf) {
 	sml_message *msg;
 
 	// parsing all messages
@@ -56,13 +49,45 @@ sml_file *sml_file_parse(unsigned char *buffer, size_t buffer_len) {
 		if (msg)
 			sml_file_add_message(file, msg);
 	}
+}
+
+sml_file *sml_file_parse(unsigned char *buffer, size_t buffer_len) {
+	sml_file *file = (sml_file *)sml_malloc(sizeof(sml_file));
+	*file = (sml_file){.messages = NULL, .messages_len = 0, .buf = NULL, .arena = NULL};
+
+	sml_buffer *buf = sml_buffer_init(buffer_len);
+	memcpy(buf->buffer, buffer, buffer_len);
+	file->buf = buf;
+
+	sml_file_parse_messages(file, buf);
+
+	return file;
+}
+
+sml_file *sml_file_parse_arena(unsigned char *buffer, size_t buffer_len, sml_arena *arena) {
+	sml_arena *prev = sml_arena_use(arena);
+
+	sml_file *file = (sml_file *)sml_malloc(sizeof(sml_file));
+	sml_buffer *buf = (sml_buffer *)sml_malloc(sizeof(sml_buffer));
+	if (file == NULL || buf == NULL) {
+		sml_arena_use(prev);
+		sml_arena_reset(arena);
+		return NULL;
+	}
+	*file = (sml_file){.messages = NULL, .messages_len = 0, .buf = buf, .arena = arena};
+	*buf = (sml_buffer){
+		.buffer = buffer, .buffer_len = buffer_len, .cursor = 0, .error = 0, .error_msg = NULL};
+
+	sml_file_parse_messages(file, buf);
+
+	sml_arena_use(prev);
 
 	return file;
 }
 
 sml_file *sml_file_init() {
-	sml_file *file = (sml_file *)malloc(sizeof(sml_file));
-	*file = (sml_file){.messages = NULL, .messages_len = 0, .buf = NULL};
+	sml_file *file = (sml_file *)sml_malloc(sizeof(sml_file));
+	*file = (sml_file){.messages = NULL, .messages_len = 0, .buf = NULL, .arena = NULL};
 
 	sml_buffer *buf = sml_buffer_init(SML_FILE_BUFFER_LENGTH);
 	file->buf = buf;
@@ -72,8 +97,9 @@ sml_file *sml_file_init() {
 
 void sml_file_add_message(sml_file *file, sml_message *message) {
 	file->messages_len++;
-	file->messages =
-		(sml_message **)realloc(file->messages, sizeof(sml_message *) * file->messages_len);
+	file->messages = (sml_message **)sml_realloc(file->messages,
+												 sizeof(sml_message *) * (file->messages_len - 1),
+												 sizeof(sml_message *) * file->messages_len);
 	file->messages[file->messages_len - 1] = message;
 }
 
@@ -88,20 +114,26 @@ void sml_file_write(sml_file *file) {
 }
 
 void sml_file_free(sml_file *file) {
+	if (file && file->arena) {
+		// the file and all its objects live in the arena
+		sml_arena_reset(file->arena);
+		return;
+	}
+
 	if (file) {
 		if (file->messages) {
 			int i;
 			for (i = 0; i < file->messages_len; i++) {
 				sml_message_free(file->messages[i]);
 			}
-			free(file->messages);
+			sml_free(file->messages);
 		}
 
 		if (file->buf) {
 			sml_buffer_free(file->buf);
 		}
 
-		free(file);
+		sml_free(file);
 	}
 }
 
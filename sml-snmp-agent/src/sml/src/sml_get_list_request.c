@@ -20,7 +20,7 @@
 #include <stdio.h>
 
 sml_get_list_request *sml_get_list_request_init() {
-	sml_get_list_request *msg = (sml_get_list_request *)malloc(sizeof(sml_get_list_request));
+	sml_get_list_request *msg = (sml_get_list_request *)sml_malloc(sizeof(sml_get_list_request));
 	*msg = (sml_get_list_request){.client_id = NULL,
 								  .server_id = NULL,
 								  .username = NULL,
@@ -41,7 +41,7 @@ void sml_get_list_request_write(sml_get_list_request *msg, sml_buffer *buf) {
 }
 
 sml_get_list_request *sml_get_list_request_parse(sml_buffer *buf) {
-	sml_get_list_request *msg = (sml_get_list_request *)malloc(sizeof(sml_get_list_request));
+	sml_get_list_request *msg = (sml_get_list_request *)sml_malloc(sizeof(sml_get_list_request));
 	*msg = (sml_get_list_request){.client_id = NULL,
 								  .server_id = NULL,
 								  .username = NULL,
@@ -92,6 +92,6 @@ void sml_get_list_request_free(sml_get_list_request *msg) {
 		sml_octet_string_free(msg->list_name);
 		sml_octet_string_free(msg->username);
 		sml_octet_string_free(msg->password);
-		free(msg);
+		sml_free(msg);
 	}
 }
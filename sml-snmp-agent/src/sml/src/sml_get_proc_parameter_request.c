@@ -22,7 +22,7 @@
 
 sml_get_proc_parameter_request *sml_get_proc_parameter_request_init() {
 	sml_get_proc_parameter_request *msg =
-		(sml_get_proc_parameter_request *)malloc(sizeof(sml_get_proc_parameter_request));
+		(sml_get_proc_parameter_request *)sml_malloc(sizeof(sml_get_proc_parameter_request));
 	*msg = (sml_get_proc_parameter_request){.server_id = NULL,
 											.username = NULL,
 											.password = NULL,
@@ -90,6 +90,6 @@ void sml_get_proc_parameter_request_free(sml_get_proc_parameter_request *msg) {
 		sml_tree_path_free(msg->parameter_tree_path);
 		sml_octet_string_free(msg->attribute);
 
-		free(msg);
+		sml_free(msg);
 	}
 }
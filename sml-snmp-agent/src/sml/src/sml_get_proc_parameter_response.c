@@ -21,7 +21,7 @@
 
 sml_get_proc_parameter_response *sml_get_proc_parameter_response_init() {
 	sml_get_proc_parameter_response *msg =
-		(sml_get_proc_parameter_response *)malloc(sizeof(sml_get_proc_parameter_response));
+		(sml_get_proc_parameter_response *)sml_malloc(sizeof(sml_get_proc_parameter_response));
 	*msg = (sml_get_proc_parameter_response){
 		.server_id = NULL, .parameter_tree_path = NULL, .parameter_tree = NULL};
 
@@ -73,6 +73,6 @@ void sml_get_proc_parameter_response_free(sml_get_proc_parameter_response *msg)
 		sml_tree_path_free(msg->parameter_tree_path);
 		sml_tree_free(msg->parameter_tree);
 
-		free(msg);
+		sml_free(msg);
 	}
 }
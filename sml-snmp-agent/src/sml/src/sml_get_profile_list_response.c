@@ -22,7 +22,7 @@
 
 sml_get_profile_list_response *sml_get_profile_list_response_init() {
 	sml_get_profile_list_response *msg =
-		(sml_get_profile_list_response *)malloc(sizeof(sml_get_profile_list_response));
+		(sml_get_profile_list_response *)sml_malloc(sizeof(sml_get_profile_list_response));
 	*msg = (sml_get_profile_list_response){.server_id = NULL,
 										   .act_time = NULL,
 										   .reg_period = NULL,
@@ -124,6 +124,6 @@ void sml_get_profile_list_response_free(sml_get_profile_list_response *msg) {
 		sml_octet_string_free(msg->rawdata);
 		sml_signature_free(msg->period_signature);
 
-		free(msg);
+		sml_free(msg);
 	}
 }
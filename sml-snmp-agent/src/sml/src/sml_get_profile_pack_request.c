@@ -24,7 +24,7 @@
 
 sml_get_profile_pack_request *sml_get_profile_pack_request_init() {
 	sml_get_profile_pack_request *msg =
-		(sml_get_profile_pack_request *)malloc(sizeof(sml_get_profile_pack_request));
+		(sml_get_profile_pack_request *)sml_malloc(sizeof(sml_get_profile_pack_request));
 	*msg = (sml_get_profile_pack_request){.server_id = NULL,
 										  .username = NULL,
 										  .password = NULL,
@@ -115,13 +115,13 @@ sml_get_profile_pack_request *sml_get_profile_pack_request_parse(sml_buffer *buf
 		int i, len = sml_buf_get_next_length(buf);
 		sml_obj_req_entry_list *last = 0, *n = 0;
 		for (i = len; i > 0; i--) {
-			n = (sml_obj_req_entry_list *)malloc(sizeof(sml_obj_req_entry_list));
+			n = (sml_obj_req_entry_list *)sml_malloc(sizeof(sml_obj_req_entry_list));
 			*n = (sml_obj_req_entry_list){.object_list_entry = NULL, .next = NULL};
 			n->object_list_entry = sml_obj_req_entry_parse(buf);
 			if (sml_buf_has_errors(buf)) {
 				if (n->object_list_entry)
 					sml_octet_string_free(n->object_list_entry);
-				free(n);
+				sml_free(n);
 				goto error;
 			}
 
@@ -161,12 +161,12 @@ void sml_get_profile_pack_request_free(sml_get_profile_pack_request *msg) {
 			do {
 				n = d->next;
 				sml_obj_req_entry_free(d->object_list_entry);
-				free(d);
+				sml_free(d);
 				d = n;
 			} while (d);
 		}
 
 		sml_tree_free(msg->das_details);
-		free(msg);
+		sml_free(msg);
 	}
 }
@@ -31,7 +31,7 @@ static void sml_prof_obj_header_entry_free_(void *p) {
 		sml_unit_free(entry->unit);
 		sml_number_free(entry->scaler);
 
-		free(entry);
+		sml_free(entry);
 	}
 }
 
@@ -78,7 +78,7 @@ static void sml_prof_obj_period_entry_free_(void *p) {
 		sml_sequence_free(entry->value_list);
 		sml_signature_free(entry->period_signature);
 
-		free(entry);
+		sml_free(entry);
 	}
 }
 
@@ -145,7 +145,7 @@ static void sml_value_entry_free_(void *p) {
 		sml_value_free(entry->value);
 		sml_signature_free(entry->value_signature);
 
-		free(entry);
+		sml_free(entry);
 	}
 }
 
@@ -153,7 +153,7 @@ static void sml_value_entry_free_(void *p) {
 
 sml_get_profile_pack_response *sml_get_profile_pack_response_init() {
 	sml_get_profile_pack_response *msg =
-		(sml_get_profile_pack_response *)malloc(sizeof(sml_get_profile_pack_response));
+		(sml_get_profile_pack_response *)sml_malloc(sizeof(sml_get_profile_pack_response));
 	*msg = (sml_get_profile_pack_response){.server_id = NULL,
 										   .act_time = NULL,
 										   .reg_period = NULL,
@@ -245,7 +245,7 @@ void sml_get_profile_pack_response_free(sml_get_profile_pack_response *msg) {
 		sml_octet_string_free(msg->rawdata);
 		sml_signature_free(msg->profile_signature);
 
-		free(msg);
+		sml_free(msg);
 	}
 }
 
@@ -253,7 +253,7 @@ void sml_get_profile_pack_response_free(sml_get_profile_pack_response *msg) {
 
 sml_prof_obj_header_entry *sml_prof_obj_header_entry_init() {
 	sml_prof_obj_header_entry *entry =
-		(sml_prof_obj_header_entry *)malloc(sizeof(sml_prof_obj_header_entry));
+		(sml_prof_obj_header_entry *)sml_malloc(sizeof(sml_prof_obj_header_entry));
 	*entry = (sml_prof_obj_header_entry){.obj_name = NULL, .unit = NULL, .scaler = NULL};
 	return entry;
 }
@@ -304,7 +304,7 @@ void sml_prof_obj_header_entry_free(sml_prof_obj_header_entry *entry) {
 
 sml_prof_obj_period_entry *sml_prof_obj_period_entry_init() {
 	sml_prof_obj_period_entry *entry =
-		(sml_prof_obj_period_entry *)malloc(sizeof(sml_prof_obj_period_entry));
+		(sml_prof_obj_period_entry *)sml_malloc(sizeof(sml_prof_obj_period_entry));
 	*entry = (sml_prof_obj_period_entry){
 		.val_time = NULL, .status = NULL, .value_list = NULL, .period_signature = NULL};
 	return entry;
@@ -325,7 +325,7 @@ void sml_prof_obj_period_entry_free(sml_prof_obj_period_entry *entry) {
 // sml_value_entry;
 
 sml_value_entry *sml_value_entry_init() {
-	sml_value_entry *entry = (sml_value_entry *)malloc(sizeof(sml_value_entry));
+	sml_value_entry *entry = (sml_value_entry *)sml_malloc(sizeof(sml_value_entry));
 	*entry = (sml_value_entry){.value = NULL, .value_signature = NULL};
 
 	return entry;
@@ -27,7 +27,7 @@
 // sml_sequence;
 
 sml_sequence *sml_sequence_init(void (*elem_free)(void *elem)) {
-	sml_sequence *seq = (sml_sequence *)malloc(sizeof(sml_sequence));
+	sml_sequence *seq = (sml_sequence *)sml_malloc(sizeof(sml_sequence));
 	*seq = (sml_sequence){.elems = NULL, .elems_len = 0, .elem_free = elem_free};
 
 	return seq;
@@ -82,23 +82,24 @@ void sml_sequence_free(sml_sequence *seq) {
 		}
 
 		if (seq->elems != 0) {
-			free(seq->elems);
+			sml_free(seq->elems);
 		}
 
-		free(seq);
+		sml_free(seq);
 	}
 }
 
 void sml_sequence_add(sml_sequence *seq, void *new_entry) {
 	seq->elems_len++;
-	seq->elems = (void **)realloc(seq->elems, sizeof(void *) * seq->elems_len);
+	seq->elems = (void **)sml_realloc(seq->elems, sizeof(void *) * (seq->elems_len - 1),
+									  sizeof(void *) * seq->elems_len);
 	seq->elems[seq->elems_len - 1] = new_entry;
 }
 
 // sml_list;
 
 sml_list *sml_list_init() {
-	sml_list *s = (sml_list *)malloc(sizeof(sml_list));
+	sml_list *s = (sml_list *)sml_malloc(sizeof(sml_list));
 	*s = (sml_list){.obj_name = NULL,
 					.status = NULL,
 					.val_time = NULL,
@@ -341,7 +342,7 @@ void sml_list_entry_free(sml_list *list) {
 		sml_value_free(list->value);
 		sml_octet_string_free(list->value_signature);
 
-		free(list);
+		sml_free(list);
 	}
 }
 
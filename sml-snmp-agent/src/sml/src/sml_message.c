@@ -30,7 +30,7 @@
 // sml_message;
 
 sml_message *sml_message_parse(sml_buffer *buf) {
-	sml_message *msg = (sml_message *)malloc(sizeof(sml_message));
+	sml_message *msg = (sml_message *)sml_malloc(sizeof(sml_message));
 	*msg = (sml_message){.transaction_id = NULL,
 						 .group_id = NULL,
 						 .abort_on_error = NULL,
@@ -105,7 +105,7 @@ error:
 }
 
 sml_message *sml_message_init() {
-	sml_message *msg = (sml_message *)malloc(sizeof(sml_message));
+	sml_message *msg = (sml_message *)sml_malloc(sizeof(sml_message));
 	*msg = (sml_message){.transaction_id = NULL,
 						 .group_id = NULL,
 						 .abort_on_error = NULL,
@@ -122,7 +122,7 @@ void sml_message_free(sml_message *msg) {
 		sml_number_free(msg->abort_on_error);
 		sml_message_body_free(msg->message_body);
 		sml_number_free(msg->crc);
-		free(msg);
+		sml_free(msg);
 	}
 }
 
@@ -147,7 +147,7 @@ void sml_message_write(sml_message *msg, sml_buffer *buf) {
 // sml_message_body;
 
 sml_message_body *sml_message_body_parse(sml_buffer *buf) {
-	sml_message_body *msg_body = (sml_message_body *)malloc(sizeof(sml_message_body));
+	sml_message_body *msg_body = (sml_message_body *)sml_malloc(sizeof(sml_message_body));
 	*msg_body = (sml_message_body){.tag = NULL, .data = NULL};
 
 	if ((buf->cursor + 1) > buf->buffer_len) {
@@ -220,12 +220,12 @@ sml_message_body *sml_message_body_parse(sml_buffer *buf) {
 	return msg_body;
 
 error:
-	free(msg_body);
+	sml_free(msg_body);
 	return NULL;
 }
 
 sml_message_body *sml_message_body_init(u32 tag, void *data) {
-	sml_message_body *message_body = (sml_message_body *)malloc(sizeof(sml_message_body));
+	sml_message_body *message_body = (sml_message_body *)sml_malloc(sizeof(sml_message_body));
 	*message_body = (sml_message_body){.tag = sml_u32_init(tag), .data = data};
 	return message_body;
 }
@@ -343,6 +343,6 @@ void sml_message_body_free(sml_message_body *message_body) {
 			break;
 		}
 		sml_number_free(message_body->tag);
-		free(message_body);
+		sml_free(message_body);
 	}
 }
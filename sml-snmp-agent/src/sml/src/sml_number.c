@@ -53,7 +53,7 @@ void *sml_number_init(u64 number, unsigned char type __attribute__((unused)), in
 		bytes += sizeof(u64) - size;
 	}
 
-	char *np = malloc(size);
+	char *np = sml_malloc(size);
 	if (np == NULL) {
 		goto error;
 	}
@@ -90,19 +90,19 @@ void *sml_number_parse(sml_buffer *buf, unsigned char type, int max_size) {
 		return NULL;
 	}
 
-	unsigned char *np = malloc(max_size);
+	unsigned char *np = sml_malloc(max_size);
 	memset(np, 0, max_size);
 
 	// at least l bytes available?
 	if ((buf->cursor + l) > buf->buffer_len) {
 		buf->error = 1;
-		free(np);
+		sml_free(np);
 		return NULL;
 	}
 
 	if ((buf->cursor + 1) > buf->buffer_len) { // at least 1 byte?
 		buf->error = 1;
-		free(np);
+		sml_free(np);
 		return NULL;
 	}
 
@@ -146,6 +146,6 @@ void sml_number_write(void *np, unsigned char type, int size, sml_buffer *buf) {
 
 void sml_number_free(void *np) {
 	if (np) {
-		free(np);
+		sml_free(np);
 	}
 }
@@ -33,10 +33,10 @@ uint8_t c2toi(uint8_t c1, uint8_t c2);
 uint8_t c2ptoi(char *c);
 
 octet_string *sml_octet_string_init(unsigned char *str, int length) {
-	octet_string *s = (octet_string *)malloc(sizeof(octet_string));
+	octet_string *s = (octet_string *)sml_malloc(sizeof(octet_string));
 	*s = (octet_string){.str = NULL, .len = 0};
 	if (length > 0) {
-		s->str = (unsigned char *)malloc(length);
+		s->str = (unsigned char *)sml_malloc(length);
 		memcpy(s->str, str, length);
 		s->len = length;
 	}
@@ -59,9 +59,9 @@ octet_string *sml_octet_string_init_from_hex(char *str) {
 void sml_octet_string_free(octet_string *str) {
 	if (str) {
 		if (str->str) {
-			free(str->str);
+			sml_free(str->str);
 		}
-		free(str);
+		sml_free(str);
 	}
 }
 
@@ -83,7 +83,14 @@ octet_string *sml_octet_string_parse(sml_buffer *buf) {
 		return NULL;
 	}
 
-	octet_string *str = sml_octet_string_init(sml_buf_get_current_buf(buf), l);
+	octet_string *str;
+	if (sml_arena_active()) {
+		// zero-copy: point into the borrowed buffer
+		str = (octet_string *)sml_malloc(sizeof(octet_string));
+		*str = (octet_string){.str = l > 0 ? sml_buf_get_current_buf(buf) : NULL, .len = l};
+	} else {
+		str = sml_octet_string_init(sml_buf_get_current_buf(buf), l);
+	}
 	sml_buf_update_bytes_read(buf, l);
 	return str;
 }
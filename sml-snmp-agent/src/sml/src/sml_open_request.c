@@ -21,7 +21,7 @@
 #include <stdio.h>
 
 sml_open_request *sml_open_request_init() {
-	sml_open_request *open_request = (sml_open_request *)malloc(sizeof(sml_open_request));
+	sml_open_request *open_request = (sml_open_request *)sml_malloc(sizeof(sml_open_request));
 	*open_request = (sml_open_request){.codepage = NULL,
 									   .client_id = NULL,
 									   .req_file_id = NULL,
@@ -102,6 +102,6 @@ void sml_open_request_free(sml_open_request *msg) {
 		sml_octet_string_free(msg->password);
 		sml_number_free(msg->sml_version);
 
-		free(msg);
+		sml_free(msg);
 	}
 }
@@ -20,7 +20,7 @@
 #include <sml/sml_open_response.h>
 
 sml_open_response *sml_open_response_init() {
-	sml_open_response *msg = (sml_open_response *)malloc(sizeof(sml_open_response));
+	sml_open_response *msg = (sml_open_response *)sml_malloc(sizeof(sml_open_response));
 	*msg = (sml_open_response){.codepage = NULL,
 							   .client_id = NULL,
 							   .req_file_id = NULL,
@@ -94,6 +94,6 @@ void sml_open_response_free(sml_open_response *msg) {
 		sml_time_free(msg->ref_time);
 		sml_number_free(msg->sml_version);
 
-		free(msg);
+		sml_free(msg);
 	}
 }
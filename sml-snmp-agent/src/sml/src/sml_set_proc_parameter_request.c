@@ -20,7 +20,7 @@
 
 sml_set_proc_parameter_request *sml_set_proc_parameter_request_init() {
 	sml_set_proc_parameter_request *msg =
-		(sml_set_proc_parameter_request *)malloc(sizeof(sml_set_proc_parameter_request));
+		(sml_set_proc_parameter_request *)sml_malloc(sizeof(sml_set_proc_parameter_request));
 	*msg = (sml_set_proc_parameter_request){.server_id = NULL,
 											.username = NULL,
 											.password = NULL,
@@ -87,6 +87,6 @@ void sml_set_proc_parameter_request_free(sml_set_proc_parameter_request *msg) {
 		sml_tree_path_free(msg->parameter_tree_path);
 		sml_tree_free(msg->parameter_tree);
 
-		free(msg);
+		sml_free(msg);
 	}
 }
@@ -19,7 +19,7 @@
 #include <sml/sml_status.h>
 
 sml_status *sml_status_init() {
-	sml_status *status = (sml_status *)malloc(sizeof(sml_status));
+	sml_status *status = (sml_status *)sml_malloc(sizeof(sml_status));
 	*status = (sml_status){.type = SML_TYPE_UNSIGNED, .data.status8 = NULL};
 
 	return status;
@@ -70,6 +70,6 @@ void sml_status_write(sml_status *status, sml_buffer *buf) {
 void sml_status_free(sml_status *status) {
 	if (status) {
 		sml_number_free(status->data.status8);
-		free(status);
+		sml_free(status);
 	}
 }
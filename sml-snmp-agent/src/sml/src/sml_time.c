@@ -22,7 +22,7 @@
 #include <stdio.h>
 
 sml_time *sml_time_init() {
-	sml_time *t = (sml_time *)malloc(sizeof(sml_time));
+	sml_time *t = (sml_time *)sml_malloc(sizeof(sml_time));
 	*t = (sml_time){.tag = NULL, .data.sec_index = NULL};
 	return t;
 }
@@ -41,7 +41,7 @@ sml_time *sml_time_parse(sml_buffer *buf) {
 	// instead, the DTZ541 starts with 0x65 + 4 bytes secIndex
 	// the workaround will add this information during parsing
 	if (sml_buf_get_current_byte(buf) == (SML_TYPE_UNSIGNED | 5)) {
-		tme->tag = malloc(sizeof(u8));
+		tme->tag = sml_malloc(sizeof(u8));
 		*(tme->tag) = SML_TIME_SEC_INDEX;
 	} else {
 		if (sml_buf_get_next_type(buf) != SML_TYPE_LIST) {
@@ -132,6 +132,6 @@ void sml_time_free(sml_time *tme) {
 	if (tme) {
 		sml_number_free(tme->tag);
 		sml_number_free(tme->data.timestamp);
-		free(tme);
+		sml_free(tme);
 	}
 }
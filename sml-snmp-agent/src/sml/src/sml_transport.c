@@ -114,14 +114,234 @@ size_t sml_transport_read(int fd, unsigned char *buffer, size_t max_len) {
 	return 0;
 }
 
-void sml_transport_listen(int fd, void (*sml_transport_receiver)(unsigned char *buffer,
+void sml_transport_reader_init(sml_transport_reader *reader) {
+	reader->fill = 0;
+	reader->scan = 0;
+	reader->start = 0;
+	reader->out = 0;
+	reader->in_file = 0;
+	reader->files = 0;
+	reader->crc_errors = 0;
+	reader->dropped = 0;
+}
+
+static void sml_transport_reader_crc(sml_transport_reader *reader, size_t pos, size_t len) {
+	reader->crc = sml_crc16_update(reader->crc, &(reader->buf[pos]), len);
+	reader->crc_kermit = sml_crc16_update(reader->crc_kermit, &(reader->buf[pos]), len);
+}
+
+static void sml_transport_reader_begin(sml_transport_reader *reader, size_t pos) {
+	reader->in_file = 1;
+	reader->start = pos;
+	reader->scan = pos + 8;
+	reader->out = pos + 8;
+	reader->crc = sml_crc16_init();
+	reader->crc_kermit = sml_crc16kermit_init();
+	sml_transport_reader_crc(reader, pos, 8);
+}
+
+// checksum len raw bytes at scan and keep keep_len of them in the unescaped part
+static void sml_transport_reader_take(sml_transport_reader *reader, size_t len, size_t keep_len) {
+	sml_transport_reader_crc(reader, reader->scan, len);
+	if (reader->out != reader->scan) {
+		memmove(&(reader->buf[reader->out]), &(reader->buf[reader->scan]), keep_len);
+	}
+	reader->out += keep_len;
+	reader->scan += len;
+}
+
+static int sml_transport_reader_find_start(sml_transport_reader *reader) {
+	unsigned char *p;
+
+	while (reader->fill - reader->scan >= 8) {
+		p = memchr(&(reader->buf[reader->scan]), 0x1b, reader->fill - reader->scan);
+		if (p == NULL) {
+			reader->scan = reader->fill;
+			return 0;
+		}
+		reader->scan = p - reader->buf;
+		if (reader->fill - reader->scan < 8) {
+			return 0;
+		}
+		if (memcmp(p, start_seq, 8) == 0) {
+			sml_transport_reader_begin(reader, reader->scan);
+			return 1;
+		}
+		reader->scan++;
+	}
+
+	return 0;
+}
+
+static int sml_transport_reader_check_crc(sml_transport_reader *reader, unsigned char *crc) {
+	u16 wire = (crc[0] << 8) | crc[1];
+	u16 kermit = sml_crc16kermit_final(reader->crc_kermit);
+
+	return sml_crc16_final(reader->crc) == wire || kermit == wire ||
+		   (((kermit & 0xff) << 8) | (kermit >> 8)) == wire;
+}
+
+// escape sequences are 4 byte aligned to the start sequence - returns 1 when
+// the file is done (delivered or dropped), 0 if more data is needed
+static int sml_transport_reader_scan_file(sml_transport_reader *reader,
+										  void (*sml_transport_receiver)(unsigned char *buffer,
+																		 size_t buffer_len)) {
+	unsigned char *buf = reader->buf;
+	unsigned char *p;
+	size_t words, data, len;
+
+	while (reader->fill - reader->scan >= 4) {
+		// the data words up to the first one with an escape byte
+		words = (reader->fill - reader->scan) & ~(size_t)3;
+		p = memchr(&(buf[reader->scan]), 0x1b, words);
+		data = p ? (size_t)(p - &(buf[reader->scan])) & ~(size_t)3 : words;
+		if (data) {
+			sml_transport_reader_take(reader, data, data);
+			continue;
+		}
+
+		if (memcmp(&(buf[reader->scan]), esc_seq, 4) != 0) {
+			sml_transport_reader_take(reader, 4, 4);
+			continue;
+		}
+		if (reader->fill - reader->scan < 8) {
+			return 0;
+		}
+
+		p = &(buf[reader->scan + 4]);
+		if (memcmp(p, esc_seq, 4) == 0) {
+			// escaped 1b1b1b1b in the data
+			sml_transport_reader_take(reader, 8, 4);
+			continue;
+		}
+
+		if (p[0] == 0x1a) {
+			// end sequence: 1b1b1b1b 1a <padding> <crc16>
+			sml_transport_reader_crc(reader, reader->scan, 6);
+			memmove(&(buf[reader->out]), &(buf[reader->scan]), 8);
+			len = reader->out + 8 - reader->start;
+			reader->scan += 8;
+			reader->in_file = 0;
+
+			if (sml_transport_reader_check_crc(reader, &(buf[reader->out + 6]))) {
+				reader->files++;
+				sml_transport_receiver(&(buf[reader->start]), len);
+			} else {
+				reader->crc_errors++;
+				fprintf(stderr, "libsml: warning: CRC error, file dropped\n");
+			}
+			return 1;
+		}
+
+		reader->dropped++;
+		if (memcmp(p, &(start_seq[4]), 4) == 0) {
+			// start sequence within the file - start over
+			sml_transport_reader_begin(reader, reader->scan);
+			continue;
+		}
+
+		fprintf(stderr, "libsml: error: unrecognized sequence\n");
+		reader->in_file = 0;
+		reader->scan += 4;
+		return 1;
+	}
+
+	return 0;
+}
+
+static void sml_transport_reader_process(sml_transport_reader *reader,
+										 void (*sml_transport_receiver)(unsigned char *buffer,
+																		size_t buffer_len)) {
+	size_t keep;
+
+	for (;;) {
+		if (!reader->in_file && !sml_transport_reader_find_start(reader)) {
+			break;
+		}
+		if (!sml_transport_reader_scan_file(reader, sml_transport_receiver)) {
+			break;
+		}
+	}
+
+	// move the unfinished file or a partial start sequence to the front
+	keep = reader->in_file ? reader->start : reader->scan;
+	if (keep) {
+		memmove(reader->buf, &(reader->buf[keep]), reader->fill - keep);
+		reader->fill -= keep;
+		reader->scan -= keep;
+		reader->out -= keep;
+		reader->start = 0;
+	}
+
+	if (reader->fill == sizeof(reader->buf)) {
+		fprintf(stderr, "libsml: error: file exceeds the buffer, dropped\n");
+		reader->dropped++;
+		reader->in_file = 0;
+		reader->fill = 0;
+		reader->scan = 0;
+	}
+}
+
+ssize_t sml_transport_reader_read(sml_transport_reader *reader, int fd,
+								  void (*sml_transport_receiver)(unsigned char *buffer,
 																 size_t buffer_len)) {
-	unsigned char buffer[MC_SML_BUFFER_LEN];
-	size_t bytes;
+	fd_set readfds;
+	ssize_t r;
+
+	for (;;) {
+		r = read(fd, &(reader->buf[reader->fill]), sizeof(reader->buf) - reader->fill);
+		if (r >= 0) {
+			break;
+		}
+		if (errno == EINTR) {
+			continue;
+		}
+		if (errno == EAGAIN) {
+			FD_ZERO(&readfds);
+			FD_SET(fd, &readfds);
+			select(fd + 1, &readfds, 0, 0, 0);
+			continue;
+		}
+		fprintf(stderr, "libsml: sml_transport_reader_read(): read error\n");
+		return -1;
+	}
+	if (r == 0) {
+		return 0; // EOF
+	}
+
+	reader->fill += r;
+	sml_transport_reader_process(reader, sml_transport_receiver);
+
+	return r;
+}
+
+size_t sml_transport_reader_feed(sml_transport_reader *reader, const unsigned char *data,
+								 size_t len,
+								 void (*sml_transport_receiver)(unsigned char *buffer,
+																size_t buffer_len)) {
+	size_t n, taken = 0;
 
-	while ((bytes = sml_transport_read(fd, buffer, MC_SML_BUFFER_LEN)) > 0) {
-		sml_transport_receiver(buffer, bytes);
+	while (taken < len) {
+		n = sizeof(reader->buf) - reader->fill;
+		if (n > len - taken) {
+			n = len - taken;
+		}
+		memcpy(&(reader->buf[reader->fill]), &(data[taken]), n);
+		reader->fill += n;
+		taken += n;
+		sml_transport_reader_process(reader, sml_transport_receiver);
 	}
+
+	return taken;
+}
+
+void sml_transport_listen(int fd, void (*sml_transport_receiver)(unsigned char *buffer,
+																 size_t buffer_len)) {
+	sml_transport_reader reader;
+
+	sml_transport_reader_init(&reader);
+	while (sml_transport_reader_read(&reader, fd, sml_transport_receiver) > 0)
+		;
 }
 
 int sml_transport_write(int fd, sml_file *file) {
@@ -23,7 +23,7 @@
 // sml_tree_path;
 
 sml_tree_path *sml_tree_path_init() {
-	sml_tree_path *tree_path = (sml_tree_path *)malloc(sizeof(sml_tree_path));
+	sml_tree_path *tree_path = (sml_tree_path *)sml_malloc(sizeof(sml_tree_path));
 	*tree_path = (sml_tree_path){.path_entries_len = 0, .path_entries = NULL};
 
 	return tree_path;
@@ -61,8 +61,9 @@ error:
 
 void sml_tree_path_add_path_entry(sml_tree_path *tree_path, octet_string *entry) {
 	tree_path->path_entries_len++;
-	tree_path->path_entries = (octet_string **)realloc(
-		tree_path->path_entries, sizeof(octet_string *) * tree_path->path_entries_len);
+	tree_path->path_entries = (octet_string **)sml_realloc(
+		tree_path->path_entries, sizeof(octet_string *) * (tree_path->path_entries_len - 1),
+		sizeof(octet_string *) * tree_path->path_entries_len);
 
 	tree_path->path_entries[tree_path->path_entries_len - 1] = entry;
 }
@@ -91,17 +92,17 @@ void sml_tree_path_free(sml_tree_path *tree_path) {
 				sml_octet_string_free(tree_path->path_entries[i]);
 			}
 
-			free(tree_path->path_entries);
+			sml_free(tree_path->path_entries);
 		}
 
-		free(tree_path);
+		sml_free(tree_path);
 	}
 }
 
 // sml_tree;
 
 sml_tree *sml_tree_init() {
-	sml_tree *tree = (sml_tree *)malloc(sizeof(sml_tree));
+	sml_tree *tree = (sml_tree *)sml_malloc(sizeof(sml_tree));
 	*tree = (sml_tree){
 		.parameter_name = NULL, .parameter_value = NULL, .child_list = NULL, .child_list_len = 0};
 
@@ -163,8 +164,9 @@ error:
 
 void sml_tree_add_tree(sml_tree *base_tree, sml_tree *tree) {
 	base_tree->child_list_len++;
-	base_tree->child_list =
-		(sml_tree **)realloc(base_tree->child_list, sizeof(sml_tree *) * base_tree->child_list_len);
+	base_tree->child_list = (sml_tree **)sml_realloc(
+		base_tree->child_list, sizeof(sml_tree *) * (base_tree->child_list_len - 1),
+		sizeof(sml_tree *) * base_tree->child_list_len);
 	base_tree->child_list[base_tree->child_list_len - 1] = tree;
 }
 
@@ -177,8 +179,8 @@ void sml_tree_free(sml_tree *tree) {
 			sml_tree_free(tree->child_list[i]);
 		}
 
-		free(tree->child_list);
-		free(tree);
+		sml_free(tree->child_list);
+		sml_free(tree);
 	}
 }
 
@@ -208,7 +210,7 @@ void sml_tree_write(sml_tree *tree, sml_buffer *buf) {
 // sml_proc_par_value;
 
 sml_proc_par_value *sml_proc_par_value_init() {
-	sml_proc_par_value *value = (sml_proc_par_value *)malloc(sizeof(sml_proc_par_value));
+	sml_proc_par_value *value = (sml_proc_par_value *)sml_malloc(sizeof(sml_proc_par_value));
 	*value = (sml_proc_par_value){.tag = NULL, .data.value = NULL};
 	return value;
 }
@@ -304,25 +306,25 @@ void sml_proc_par_value_free(sml_proc_par_value *ppv) {
 				break;
 			default:
 				if (ppv->data.value) {
-					free(ppv->data.value);
+					sml_free(ppv->data.value);
 				}
 			}
 			sml_number_free(ppv->tag);
 		} else {
 			// Without the tag, there might be a memory leak.
 			if (ppv->data.value) {
-				free(ppv->data.value);
+				sml_free(ppv->data.value);
 			}
 		}
 
-		free(ppv);
+		sml_free(ppv);
 	}
 }
 
 // sml_tuple_entry;
 
 sml_tupel_entry *sml_tupel_entry_init() {
-	sml_tupel_entry *tupel = (sml_tupel_entry *)malloc(sizeof(sml_tupel_entry));
+	sml_tupel_entry *tupel = (sml_tupel_entry *)sml_malloc(sizeof(sml_tupel_entry));
 	*tupel = (sml_tupel_entry){.server_id = NULL,
 							   .sec_index = NULL,
 							   .status = NULL,
@@ -527,14 +529,14 @@ void sml_tupel_entry_free(sml_tupel_entry *tupel) {
 
 		sml_octet_string_free(tupel->signature_mA_R2_R3);
 
-		free(tupel);
+		sml_free(tupel);
 	}
 }
 
 // sml_period_entry;
 
 sml_period_entry *sml_period_entry_init() {
-	sml_period_entry *period = (sml_period_entry *)malloc(sizeof(sml_period_entry));
+	sml_period_entry *period = (sml_period_entry *)sml_malloc(sizeof(sml_period_entry));
 	*period = (sml_period_entry){
 		.obj_name = NULL, .unit = NULL, .scaler = NULL, .value = NULL, .value_signature = NULL};
 
@@ -612,7 +614,7 @@ static void sml_period_entry_free_(void *p) {
 		sml_value_free(period->value);
 		sml_octet_string_free(period->value_signature);
 
-		free(period);
+		sml_free(period);
 	}
 }
 
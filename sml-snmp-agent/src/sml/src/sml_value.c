@@ -83,7 +83,7 @@ void sml_value_write(sml_value *value, sml_buffer *buf) {
 }
 
 sml_value *sml_value_init() {
-	sml_value *value = (sml_value *)malloc(sizeof(sml_value));
+	sml_value *value = (sml_value *)sml_malloc(sizeof(sml_value));
 	*value = (sml_value){.type = SML_TYPE_OCTET_STRING, .data.bytes = NULL};
 
 	return value;
@@ -102,7 +102,7 @@ void sml_value_free(sml_value *value) {
 			sml_number_free(value->data.int8);
 			break;
 		}
-		free(value);
+		sml_free(value);
 	}
 }
 
@@ -24,6 +24,7 @@
 #include <libgen.h>
 #include "snmp.h"
 #include "sml_server.h"
+#include "metrics.h"
 
 #include <sml/sml_file.h>
 #include <sml/sml_transport.h>
@@ -33,20 +34,7 @@
 #define MAX_STRING_LEN	32
 #define MAXLINE		128
 
-pthread_mutex_t value_mutex = PTHREAD_MUTEX_INITIALIZER;
-
 extern void *snmp_agent(void *);
-const char obis_tarif0[] = { 0x01, 0x00, 0x01, 0x08, 0x00 };
-const char obis_tarif1[] = { 0x01, 0x00, 0x01, 0x08, 0x01 };
-const char obis_tarif2[] = { 0x01, 0x00, 0x01, 0x08, 0x02 };
-const char obis_deliver0[] = { 0x01, 0x00, 0x02, 0x08, 0x00 };
-const char power_meter[] = { 0x01, 0x00, 0x10, 0x07, 0x00 };
-
-unsigned int counter_tarif0;
-unsigned int counter_tarif1;
-unsigned int counter_tarif2;
-unsigned int counter_deliver0;
-unsigned int pmeter;
 FILE *log_file_ptr = NULL;
 
 int verbose = 0;
@@ -57,6 +45,7 @@ void print_usage(char *prg) {
     fprintf(stderr, "         -p <port>           SNMP port - default 161\n");
     fprintf(stderr, "         -i <interface>      serial interface - default /dev/ttyUSB0\n");
     fprintf(stderr, "         -l <log file>       raw serial log file\n");
+    fprintf(stderr, "         -c <config file>    OBIS to SNMP mapping - default built-in\n");
     fprintf(stderr, "         -f                  running in foreground\n\n");
 }
 
@@ -126,16 +115,24 @@ int serial_port_open(const char *device) {
 }
 
 void transport_receiver(unsigned char *buffer, size_t buffer_len) {
+    /* parse objects of one file - reused for every file of the reader thread */
+    static sml_arena *arena = NULL;
+    sml_file *file = NULL;
     short i;
     //unsigned char message_buffer[SML_BUFFER_LEN];
     sml_get_list_response *body;
     sml_list *entry = NULL;
-    int m = 0, n = 10;
+    int m = 0, n = 10, slot;
     struct timeval time;
 
     // the buffer contains the whole message, with transport escape sequences.
     // these escape sequences are stripped here.
-    sml_file *file = sml_file_parse(buffer + 8, buffer_len - 16);
+    if (!arena)
+	arena = sml_arena_init(0);
+    if (arena)
+	file = sml_file_parse_arena(buffer + 8, buffer_len - 16, arena);
+    if (!file)
+	file = sml_file_parse(buffer + 8, buffer_len - 16);
 
     if (log_file_ptr)
 	fwrite(buffer, 1, buffer_len, log_file_ptr);
@@ -166,6 +163,9 @@ void transport_receiver(unsigned char *buffer, size_t buffer_len) {
 		    printf("sensor time: %lu.%lu, %i\n", time.tv_sec, time.tv_usec, *body->act_sensor_time->tag);
 	    }
 	    for (entry = body->val_list; entry != NULL; entry = entry->next) {	/* linked list */
+		slot = metrics_lookup(entry->obj_name->str, entry->obj_name->len);
+		if (slot < 0 && !verbose)
+		    continue;
 		//int unit = (entry->unit) ? *entry->unit : 0;
 		int scaler = (entry->scaler) ? *entry->scaler : 1;
 		// printf("  scale: %d  unit: %d\n",unit,scaler);
@@ -217,33 +217,11 @@ void transport_receiver(unsigned char *buffer, size_t buffer_len) {
 		} */
 		gettimeofday(&time, NULL);
 
-		pthread_mutex_lock(&value_mutex);
-		if (!memcmp(entry->obj_name->str, obis_tarif0, sizeof(obis_tarif0))) {
-		    counter_tarif0 = (int)(value + 0.5);
-		    if (verbose)
-			printf("CT0:%d\n", counter_tarif0);
-		}
-		if (!memcmp(entry->obj_name->str, obis_tarif1, sizeof(obis_tarif1))) {
-		    counter_tarif1 = (int)(value + 0.5);
-		    if (verbose)
-			printf("CT1:%d\n", counter_tarif1);
-		}
-		if (!memcmp(entry->obj_name->str, obis_tarif2, sizeof(obis_tarif2))) {
-		    counter_tarif2 = (int)(value + 0.5);
-		    if (verbose)
-			printf("CT2:%d\n", counter_tarif2);
-		}
-		if (!memcmp(entry->obj_name->str, obis_deliver0, sizeof(obis_deliver0))) {
-		    counter_deliver0 = (int)(value + 0.5);
+		if (slot >= 0) {
+		    metric_values[slot] = (int)(value * metrics[slot].factor + 0.5);
 		    if (verbose)
-			printf("CB0:%d\n", counter_deliver0);
+			printf("%s:%d\n", metrics[slot].name, metric_values[slot]);
 		}
-		if (!memcmp(entry->obj_name->str, power_meter, sizeof(power_meter))) {
-		    pmeter = (int)(value + 0.5);
-		    if (verbose)
-			printf("Power:%d\n", pmeter);
-		}
-		pthread_mutex_unlock(&value_mutex);
 
 		/* printf("%lu.%lu (%i)\t%.2f %s\n", time.tv_sec, time.tv_usec, time_mode, value, dlms_get_unit(unit)); */
 		if (verbose) {
@@ -260,6 +238,9 @@ void transport_receiver(unsigned char *buffer, size_t buffer_len) {
 	}
     }
 
+    /* all values of the file at once */
+    metrics_publish();
+
     if (verbose)
 	sml_file_print(file);
 
@@ -279,6 +260,7 @@ int main(int argc, char **argv) {
     int opt, foreground;
     char device[MAX_STRING_LEN];
     char *logfile;
+    char *config = NULL;
 
     struct edl21_data edl21_thread_data;
     struct snmp_data snmp_thread_data;
@@ -288,7 +270,7 @@ int main(int argc, char **argv) {
     bzero(device, sizeof(device));
     strcpy(device, "/dev/ttyUSB0");
 
-    while ((opt = getopt(argc, argv, "p:i:l:fh?")) != -1) {
+    while ((opt = getopt(argc, argv, "p:i:l:c:fh?")) != -1) {
 	switch (opt) {
 	case 'p':
 	    snmp_thread_data.snmp_port = strtoul(optarg, (char **)NULL, 10);
@@ -318,6 +300,9 @@ int main(int argc, char **argv) {
 		exit(1);
             }
 	    break;
+	case 'c':
+	    config = optarg;
+	    break;
 	case 'h':
 	case '?':
 	    print_usage(basename(argv[0]));
@@ -330,6 +315,9 @@ int main(int argc, char **argv) {
     }
     verbose = foreground;
 
+    if (config ? metrics_load(config) : metrics_default())
+	exit(1);
+
     pthread_t thread_reader;
     pthread_t thread_snmp;
     pthread_attr_t attr;
@@ -47,13 +47,8 @@ OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <pthread.h>
 #include "snmp.h"
 #include "sml_server.h"
+#include "metrics.h"
 
-extern pthread_mutex_t value_mutex;
-extern unsigned int counter_tarif0;
-extern unsigned int counter_tarif1;
-extern unsigned int counter_tarif2;
-extern unsigned int counter_deliver0;
-extern unsigned int pmeter;
 
 extern int verbose;
 
@@ -66,12 +61,7 @@ char oid[30][30] = {
     "1.3.6.1.2.1.1.3.0",
     "1.3.6.1.4.1.39241.1.1.0",
     "1.3.6.1.4.1.39241.1.2.0",
-    "1.3.6.1.4.1.39241.1.3.0",
-    "1.3.6.1.4.1.39241.1.8.0",
-    "1.3.6.1.4.1.39241.1.8.1",
-    "1.3.6.1.4.1.39241.1.8.2",
-    "1.3.6.1.4.1.39241.2.8.0",
-    "1.3.6.1.4.1.39241.16.7.0"
+    "1.3.6.1.4.1.39241.1.3.0"
 };
 
 char description[] = "volkszaehler.org / DAI Labor Berlin / Frauenhofer FOKUS";
@@ -119,9 +109,11 @@ void debugg(unsigned char *packet, int length) {
 }
 
 void process_varbind_list(struct varbind_list_rx *varbind_list) {
-    int i, timeticks;
+    int i, j, timeticks;
     time_t t;
-    pthread_mutex_lock(&value_mutex);
+    unsigned int values[METRICS_MAX];
+
+    metrics_snapshot(values);
     for (i = 0; i < varbind_list->varbind_idx; i++) {
 
 	if (!strcmp((char *)&oid[0][0], (char *)varbind_list->varbind_list[i]->oid)) {
@@ -141,33 +133,16 @@ void process_varbind_list(struct varbind_list_rx *varbind_list) {
 	    update_varbind(varbind_list->varbind_list[i], 0x02, &NumberOfAgents);
 	}
 
-	if (!strcmp((char *)&oid[5][0], (char *)varbind_list->varbind_list[i]->oid)) {
-	    if (verbose)
-		printf("SNMP Request Counter Tarif 0: %d\n", counter_tarif0);
-	    update_varbind(varbind_list->varbind_list[i], 0x02, &counter_tarif0);
-	}
-	if (!strcmp((char *)&oid[6][0], (char *)varbind_list->varbind_list[i]->oid)) {
-	    if (verbose)
-		printf("SNMP Request Counter Tarif 1: %d\n", counter_tarif1);
-	    update_varbind(varbind_list->varbind_list[i], 0x02, &counter_tarif1);
-	}
-	if (!strcmp((char *)&oid[7][0], (char *)varbind_list->varbind_list[i]->oid)) {
-	    if (verbose)
-		printf("SNMP Request Counter Tarif 2: %d\n", counter_tarif2);
-	    update_varbind(varbind_list->varbind_list[i], 0x02, &counter_tarif2);
-	}
-	if (!strcmp((char *)&oid[8][0], (char *)varbind_list->varbind_list[i]->oid)) {
-	    if (verbose)
-		printf("SNMP Request Counter Lieferung 0: %d\n", counter_deliver0);
-	    update_varbind(varbind_list->varbind_list[i], 0x02, &counter_deliver0);
-	}
-	if (!strcmp((char *)&oid[9][0], (char *)varbind_list->varbind_list[i]->oid)) {
-	    if (verbose)
-		printf("SNMP Request Power Meter: %d\n", pmeter);
-	    update_varbind(varbind_list->varbind_list[i], 0x02, &pmeter);
+	/* the OBIS codes from the config */
+	for (j = 0; j < metrics_len; j++) {
+	    if (!strcmp(metrics[j].oid, (char *)varbind_list->varbind_list[i]->oid)) {
+		if (verbose)
+		    printf("SNMP Request %s: %d\n", metrics[j].name, values[j]);
+		update_varbind(varbind_list->varbind_list[i], metrics[j].type, &values[j]);
+		break;
+	    }
 	}
     }
-    pthread_mutex_unlock(&value_mutex);
 }
 
 void sendPacket(struct in_addr host, short port, int sock, struct snmp_message_tx *snmp_msg) {
@@ -528,6 +528,12 @@ void disp_varbind_list_rx(struct varbind_list_rx *varbind_list)
 	case PRIMV_OBJID:
 	    printf("Data Type: Object Identifier, Value: %s\n", (unsigned char *)varbind_list->varbind_list[i]->value);
 	    break;
+	case PRIMV_COUNTR:
+	    printf("Data Type: Counter, Value: %u\n", *(unsigned int *)varbind_list->varbind_list[i]->value);
+	    break;
+	case PRIMV_GAUGE:
+	    printf("Data Type: Gauge, Value: %u\n", *(unsigned int *)varbind_list->varbind_list[i]->value);
+	    break;
 	case PRIMV_TIMTICK:
 	    printf("Data Type: Timeticks, Value: %d\n", *(unsigned int *)varbind_list->varbind_list[i]->value);
 	    break;
@@ -603,9 +609,12 @@ void update_varbind(struct varbind *varbind, unsigned char data_type, void *valu
 	varbind->value = (unsigned char *)calloc(1, strlen((char *)value) + 1);
 	strcpy((char *)varbind->value, (char *)value);
 	break;
+    case 0x41:
+    case 0x42:
     case 0x43:
 	varbind->value = (unsigned int *)calloc(1, sizeof(unsigned int));
 	*(unsigned int *)varbind->value = *(unsigned int *)value;
+	break;
     default:
 	break;
     }
@@ -620,6 +629,8 @@ void disp_varbind(struct varbind *varbind)
     switch (varbind->data_type) {
     case PRIMV_INT:
     case PRIMV_NULL:
+    case PRIMV_COUNTR:
+    case PRIMV_GAUGE:
     case PRIMV_TIMTICK:
 	printf("Value: %i\n", *(unsigned int *)varbind->value);
 	break;
@@ -703,12 +714,15 @@ struct varbind_list_tx *create_varbind_list_tx(struct varbind_list_rx *varbinds_
 	    varbind_list_buffer[len_pointer + 1] = pointer - len_pointer - 4;
 	    len_pointer = pointer - 2;
 	    break;
+	case PRIMV_COUNTR:
+	case PRIMV_GAUGE:
 	case PRIMV_TIMTICK:
 	    data_buffer = encode_oid(varbinds_to_send->varbind_list[i]->oid);
 	    memcpy(&varbind_list_buffer[pointer], data_buffer, data_buffer[1] + 2);
 	    pointer += data_buffer[1] + 2;
 	    free(data_buffer);
-	    data_buffer = encode_integer_by_length(*(unsigned int *)varbinds_to_send->varbind_list[i]->value, 4, 0x43);
+	    data_buffer = encode_integer_by_length(*(unsigned int *)varbinds_to_send->varbind_list[i]->value, 4,
+						   varbinds_to_send->varbind_list[i]->data_type);
 	    memcpy(&varbind_list_buffer[pointer], data_buffer, data_buffer[1] + 2);
 	    pointer += data_buffer[1] + 4;
 	    free(data_buffer);
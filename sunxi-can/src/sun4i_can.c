@@ -53,6 +53,7 @@
 #include <linux/can/error.h>
 #include <linux/can/led.h>
 #include <linux/clk.h>
+#include <linux/debugfs.h>
 #include <linux/delay.h>
 #include <linux/interrupt.h>
 #include <linux/init.h>
@@ -196,19 +197,56 @@
 #define SUN4I_MSG_EFF_FLAG	BIT(7)
 #define SUN4I_MSG_RTR_FLAG	BIT(6)
 
+/* receive message counter (r)
+ * offset:0x0020 default:0x0000_0000
+ */
+#define SUN4I_RMCNT_MASK	0x7f
+
+/* RX window: frame info, 2 or 4 id and up to 8 data words at BUF0..BUF12 -
+ * every register holds one byte
+ */
+#define SUN4I_RX_WIN_LEN	13
+
+/* frames queued in the driver - the controller has a single TX buffer */
+#define SUN4I_TX_RING_SIZE	8	/* power of 2 */
+
 /* max. number of interrupts handled in ISR */
 #define SUN4I_CAN_MAX_IRQ	20
 #define SUN4I_MODE_MAX_RETRIES	100
 
+/* TX buffer contents precomputed at xmit time - BUF0..BUF12 */
+struct sun4i_tx_frame {
+	u32 win[SUN4I_RX_WIN_LEN];
+	int len;
+};
+
 struct sun4ican_priv {
 	struct can_priv can;
+	struct napi_struct napi;
 	void __iomem *base;
 	struct clk *clk;
-	/* 8< debugging */
-	int rx_counter_new;
-	int rx_counter_old;
-	/* debugging >8 */
-	spinlock_t cmdreg_lock;	/* lock for concurrent cmd register writes */
+	spinlock_t cmdreg_lock;	/* lock for concurrent cmd/inten register writes */
+
+	/*
+	 * TX ring - the frame at tx_tail is in the TX buffer as long as
+	 * the ring isn't empty, the next one gets loaded from the irq
+	 */
+	struct sun4i_tx_frame tx_ring[SUN4I_TX_RING_SIZE];
+	unsigned int tx_head;
+	unsigned int tx_tail;
+	spinlock_t tx_lock;	/* tx_head/tx_tail and the TX buffer */
+
+	/* RX statistics - exported via debugfs */
+	u64 rx_frames;
+	u32 rx_polls;
+	u32 rx_polls_full;	/* polls that used up the budget */
+	u32 rx_rmcnt_max;
+	u32 rx_overruns;
+	u32 rx_overrun_rmcnt;	/* RMCNT and RBUFSA at the last overrun */
+	u32 rx_overrun_rbufsa;
+#if defined(CONFIG_DEBUG_FS)
+	struct dentry *debugfs_dir;
+#endif
 };
 
 static const struct can_bittiming_const sun4ican_bittiming_const = {
@@ -232,6 +270,22 @@ static void sun4i_can_write_cmdreg(struct sun4ican_priv *priv, u8 val)
 	spin_unlock_irqrestore(&priv->cmdreg_lock, flags);
 }
 
+/* the RX interrupt gets masked while NAPI drains the RX FIFO */
+static void sun4i_can_rx_irq(struct sun4ican_priv *priv, bool enable)
+{
+	unsigned long flags;
+	u32 inten;
+
+	spin_lock_irqsave(&priv->cmdreg_lock, flags);
+	inten = readl(priv->base + SUN4I_REG_INTEN_ADDR);
+	if (enable)
+		inten |= SUN4I_INTEN_RX;
+	else
+		inten &= ~SUN4I_INTEN_RX;
+	writel(inten, priv->base + SUN4I_REG_INTEN_ADDR);
+	spin_unlock_irqrestore(&priv->cmdreg_lock, flags);
+}
+
 static int set_normal_mode(struct net_device *dev)
 {
 	struct sun4ican_priv *priv = netdev_priv(dev);
@@ -274,6 +328,21 @@ static int set_reset_mode(struct net_device *dev)
 	return 0;
 }
 
+/* drop the frames still queued, e.g. after bus-off */
+static void sun4i_can_tx_flush(struct net_device *dev)
+{
+	struct sun4ican_priv *priv = netdev_priv(dev);
+	unsigned long flags;
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	while (priv->tx_tail != priv->tx_head) {
+		can_free_echo_skb(dev,
+				  priv->tx_tail & (SUN4I_TX_RING_SIZE - 1));
+		priv->tx_tail++;
+	}
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
+}
+
 /* bittiming is called in reset_mode only */
 static int sun4ican_set_bittiming(struct net_device *dev)
 {
@@ -363,6 +432,7 @@ static int sun4i_can_start(struct net_device *dev)
 		return err;
 	}
 
+	sun4i_can_tx_flush(dev);
 	priv->can.state = CAN_STATE_ERROR_ACTIVE;
 
 	return 0;
@@ -408,119 +478,205 @@ static int sun4ican_set_mode(struct net_device *dev, enum can_mode mode)
 	return 0;
 }
 
-/* transmit a CAN message
- * message layout in the sk_buff should be like this:
- * xx xx xx xx         ff         ll 00 11 22 33 44 55 66 77
- * [ can_id ] [flags] [len] [can data (up to 8 bytes]
+/* build the TX buffer contents from the can_frame
+ * buffer layout: frame info, 2 (SFF) or 4 (EFF) id bytes and the data
  */
-static int sun4ican_start_xmit(struct sk_buff *skb, struct net_device *dev)
+static void sun4i_can_tx_prepare(struct sun4i_tx_frame *frame,
+				 const struct can_frame *cf)
 {
-	struct sun4ican_priv *priv = netdev_priv(dev);
-	struct can_frame *cf = (struct can_frame *)skb->data;
-	u8 dlc;
-	u32 dreg, msg_flag_n;
-	canid_t id;
-	int i;
-
-	if (can_dropped_invalid_skb(dev, skb))
-		return NETDEV_TX_OK;
-
-	netif_stop_queue(dev);
-
-	id = cf->can_id;
-	dlc = cf->can_dlc;
-	msg_flag_n = dlc;
-
-	if (id & CAN_RTR_FLAG)
-		msg_flag_n |= SUN4I_MSG_RTR_FLAG;
+	u32 *win = frame->win;
+	canid_t id = cf->can_id;
+	u8 dlc = cf->can_dlc;
+	int i, n;
 
+	win[0] = dlc;
 	if (id & CAN_EFF_FLAG) {
-		msg_flag_n |= SUN4I_MSG_EFF_FLAG;
-		dreg = SUN4I_REG_BUF5_ADDR;
-		writel((id >> 21) & 0xFF, priv->base + SUN4I_REG_BUF1_ADDR);
-		writel((id >> 13) & 0xFF, priv->base + SUN4I_REG_BUF2_ADDR);
-		writel((id >> 5)  & 0xFF, priv->base + SUN4I_REG_BUF3_ADDR);
-		writel((id << 3)  & 0xF8, priv->base + SUN4I_REG_BUF4_ADDR);
+		win[0] |= SUN4I_MSG_EFF_FLAG;
+		win[1] = (id >> 21) & 0xFF;
+		win[2] = (id >> 13) & 0xFF;
+		win[3] = (id >> 5)  & 0xFF;
+		win[4] = (id << 3)  & 0xF8;
+		n = 5;
 	} else {
-		dreg = SUN4I_REG_BUF3_ADDR;
-		writel((id >> 3) & 0xFF, priv->base + SUN4I_REG_BUF1_ADDR);
-		writel((id << 5) & 0xE0, priv->base + SUN4I_REG_BUF2_ADDR);
+		win[1] = (id >> 3) & 0xFF;
+		win[2] = (id << 5) & 0xE0;
+		n = 3;
 	}
 
-	for (i = 0; i < dlc; i++)
-		writel(cf->data[i], priv->base + (dreg + i * 4));
+	/* remote frames carry no data */
+	if (id & CAN_RTR_FLAG)
+		win[0] |= SUN4I_MSG_RTR_FLAG;
+	else
+		for (i = 0; i < dlc; i++)
+			win[n++] = cf->data[i];
+
+	frame->len = n;
+}
 
-	writel(msg_flag_n, priv->base + SUN4I_REG_BUF0_ADDR);
+/* load the frame at tx_tail into the TX buffer - tx_lock held */
+static void sun4i_can_tx_load(struct sun4ican_priv *priv)
+{
+	struct sun4i_tx_frame *frame =
+		&priv->tx_ring[priv->tx_tail & (SUN4I_TX_RING_SIZE - 1)];
 
-	can_put_echo_skb(skb, dev, 0);
+	__iowrite32_copy(priv->base + SUN4I_REG_BUF0_ADDR, frame->win,
+			 frame->len);
 
 	if (priv->can.ctrlmode & CAN_CTRLMODE_LOOPBACK)
 		sun4i_can_write_cmdreg(priv, SUN4I_CMD_SELF_RCV_REQ);
 	else
 		sun4i_can_write_cmdreg(priv, SUN4I_CMD_TRANS_REQ);
+}
+
+/* transmit a CAN message
+ * the frame is queued in the TX ring and loaded right away if the TX
+ * buffer is idle - otherwise the TX complete irq loads it
+ */
+static int sun4ican_start_xmit(struct sk_buff *skb, struct net_device *dev)
+{
+	struct sun4ican_priv *priv = netdev_priv(dev);
+	struct can_frame *cf = (struct can_frame *)skb->data;
+	unsigned long flags;
+	unsigned int idx;
+
+	if (can_dropped_invalid_skb(dev, skb))
+		return NETDEV_TX_OK;
+
+	/* only xmit writes the slot at tx_head */
+	idx = priv->tx_head & (SUN4I_TX_RING_SIZE - 1);
+	sun4i_can_tx_prepare(&priv->tx_ring[idx], cf);
+	can_put_echo_skb(skb, dev, idx);
+
+	spin_lock_irqsave(&priv->tx_lock, flags);
+	priv->tx_head++;
+	if (priv->tx_head - priv->tx_tail == 1)
+		sun4i_can_tx_load(priv);
+	if (priv->tx_head - priv->tx_tail == SUN4I_TX_RING_SIZE)
+		netif_stop_queue(dev);
+	spin_unlock_irqrestore(&priv->tx_lock, flags);
 
 	return NETDEV_TX_OK;
 }
 
+/* TX buffer released - complete the frame and load the next one */
+static void sun4i_can_tx_done(struct net_device *dev)
+{
+	struct sun4ican_priv *priv = netdev_priv(dev);
+	struct net_device_stats *stats = &dev->stats;
+
+	spin_lock(&priv->tx_lock);
+	if (priv->tx_tail == priv->tx_head) {
+		spin_unlock(&priv->tx_lock);
+		return;
+	}
+	stats->tx_bytes += can_get_echo_skb(dev,
+			priv->tx_tail & (SUN4I_TX_RING_SIZE - 1));
+	stats->tx_packets++;
+	priv->tx_tail++;
+	if (priv->tx_tail != priv->tx_head)
+		sun4i_can_tx_load(priv);
+	spin_unlock(&priv->tx_lock);
+
+	if (netif_queue_stopped(dev))
+		netif_wake_queue(dev);
+	can_led_event(dev, CAN_LED_EVENT_TX);
+}
+
+/* read the frame in front of the RX FIFO and release it */
 static void sun4i_can_rx(struct net_device *dev)
 {
 	struct sun4ican_priv *priv = netdev_priv(dev);
 	struct net_device_stats *stats = &dev->stats;
+	u32 win[SUN4I_RX_WIN_LEN];
 	struct can_frame *cf;
 	struct sk_buff *skb;
-	u8 fi;
-	u32 dreg;
+	u8 fi, dlc;
+	u32 *data;
 	canid_t id;
-	int i;
-	/* 8< debugging */
-	u8 rx_counter, fifo_start;
-	/* debugging >8 */
+	int i, len;
+
+	/* the frame info tells how much of the window has to be read */
+	fi = readl(priv->base + SUN4I_REG_BUF0_ADDR);
+	dlc = get_can_dlc(fi & 0x0F);
+	len = (fi & SUN4I_MSG_EFF_FLAG) ? 4 : 2;
+	if (!(fi & SUN4I_MSG_RTR_FLAG))
+		len += dlc;
+	__ioread32_copy(&win[1], priv->base + SUN4I_REG_BUF1_ADDR, len);
+
+	sun4i_can_write_cmdreg(priv, SUN4I_CMD_RELEASE_RBUF);
 
 	/* create zero'ed CAN frame buffer */
 	skb = alloc_can_skb(dev, &cf);
-	if (!skb)
+	if (!skb) {
+		stats->rx_dropped++;
 		return;
-
-	fi = readl(priv->base + SUN4I_REG_BUF0_ADDR);
-	cf->can_dlc = get_can_dlc(fi & 0x0F);
-
-	/* 8< debugging */
-	rx_counter = readl(priv->base + SUN4I_REG_RMCNT_ADDR);
-	fifo_start = readl(priv->base + SUN4I_REG_RBUFSA_ADDR);
-	printk(KERN_INFO "RX counter old: 0x%02x  RX counter new: 0x%02x   fifo_start: 0x%02x\n",  priv->rx_counter_old, rx_counter, fifo_start);
-	priv->rx_counter_old = priv->rx_counter_new;
-	priv->rx_counter_new = rx_counter;
-	/* debugging >8 */
+	}
 
 	if (fi & SUN4I_MSG_EFF_FLAG) {
-		dreg = SUN4I_REG_BUF5_ADDR;
-		id = (readl(priv->base + SUN4I_REG_BUF1_ADDR) << 21) |
-		     (readl(priv->base + SUN4I_REG_BUF2_ADDR) << 13) |
-		     (readl(priv->base + SUN4I_REG_BUF3_ADDR) << 5)  |
-		    ((readl(priv->base + SUN4I_REG_BUF4_ADDR) >> 3)  & 0x1f);
+		data = &win[5];
+		id = (win[1] << 21) | (win[2] << 13) | (win[3] << 5) |
+		    ((win[4] >> 3) & 0x1f);
 		id |= CAN_EFF_FLAG;
 	} else {
-		dreg = SUN4I_REG_BUF3_ADDR;
-		id = (readl(priv->base + SUN4I_REG_BUF1_ADDR) << 3) |
-		    ((readl(priv->base + SUN4I_REG_BUF2_ADDR) >> 5) & 0x7);
+		data = &win[3];
+		id = (win[1] << 3) | ((win[2] >> 5) & 0x7);
 	}
 
 	/* remote frame ? */
 	if (fi & SUN4I_MSG_RTR_FLAG)
 		id |= CAN_RTR_FLAG;
 	else
-		for (i = 0; i < cf->can_dlc; i++)
-			cf->data[i] = readl(priv->base + dreg + i * 4);
+		for (i = 0; i < dlc; i++)
+			cf->data[i] = data[i];
 
 	cf->can_id = id;
-
-	sun4i_can_write_cmdreg(priv, SUN4I_CMD_RELEASE_RBUF);
+	cf->can_dlc = dlc;
 
 	stats->rx_packets++;
-	stats->rx_bytes += cf->can_dlc;
-	netif_rx(skb);
+	stats->rx_bytes += dlc;
+	netif_receive_skb(skb);
+}
 
-	can_led_event(dev, CAN_LED_EVENT_RX);
+/* drain the frames the RX FIFO holds when the poll starts -
+ * RMCNT is read only once
+ */
+static int sun4i_can_poll(struct napi_struct *napi, int quota)
+{
+	struct net_device *dev = napi->dev;
+	struct sun4ican_priv *priv = netdev_priv(dev);
+	int work_done = 0;
+	int rmcnt;
+
+	rmcnt = readl(priv->base + SUN4I_REG_RMCNT_ADDR) & SUN4I_RMCNT_MASK;
+	priv->rx_polls++;
+	if (rmcnt > priv->rx_rmcnt_max)
+		priv->rx_rmcnt_max = rmcnt;
+
+	while (work_done < quota && work_done < rmcnt) {
+		/* a data overrun resets the controller, emptying the fifo */
+		if (!(readl(priv->base + SUN4I_REG_STA_ADDR) &
+		      SUN4I_STA_RBUF_RDY))
+			break;
+		sun4i_can_rx(dev);
+		work_done++;
+	}
+	priv->rx_frames += work_done;
+
+	if (work_done)
+		can_led_event(dev, CAN_LED_EVENT_RX);
+
+	if (work_done < quota) {
+		napi_complete_done(napi, work_done);
+		sun4i_can_rx_irq(priv, true);
+		/* frames received after RMCNT was read */
+		if ((readl(priv->base + SUN4I_REG_STA_ADDR) &
+		     SUN4I_STA_RBUF_RDY) && napi_reschedule(napi))
+			sun4i_can_rx_irq(priv, false);
+	} else {
+		priv->rx_polls_full++;
+	}
+
+	return work_done;
 }
 
 static int sun4i_can_err(struct net_device *dev, u8 isrc, u8 status)
@@ -533,9 +689,6 @@ static int sun4i_can_err(struct net_device *dev, u8 isrc, u8 status)
 	enum can_state rx_state, tx_state;
 	unsigned int rxerr, txerr, errc;
 	u32 ecc, alc;
-	/* 8< debugging */
-	u8 rx_counter, fifo_start;
-	/* debugging >8 */
 
 	/* we don't skip if alloc fails because we want the stats anyhow */
 	skb = alloc_can_err_skb(dev, &cf);
@@ -552,14 +705,14 @@ static int sun4i_can_err(struct net_device *dev, u8 isrc, u8 status)
 	if (isrc & SUN4I_INT_DATA_OR) {
 		/* data overrun interrupt */
 		netdev_dbg(dev, "data overrun interrupt\n");
+		priv->rx_overruns++;
+		priv->rx_overrun_rmcnt =
+			readl(priv->base + SUN4I_REG_RMCNT_ADDR);
+		priv->rx_overrun_rbufsa =
+			readl(priv->base + SUN4I_REG_RBUFSA_ADDR);
 		if (likely(skb)) {
 			cf->can_id |= CAN_ERR_CRTL;
 			cf->data[1] = CAN_ERR_CRTL_RX_OVERFLOW;
-			/* 8< debugging */
-			rx_counter = readl(priv->base + SUN4I_REG_RMCNT_ADDR);
-			fifo_start = readl(priv->base + SUN4I_REG_RBUFSA_ADDR);
-			printk(KERN_INFO "RX counter old: 0x%02x  RX counter new: 0x%02x   fifo_start: 0x%02x\n",  priv->rx_counter_old, rx_counter, fifo_start);
-			/* debugging >8 */
 		}
 		stats->rx_over_errors++;
 		stats->rx_errors++;
@@ -655,7 +808,6 @@ static irqreturn_t sun4i_can_interrupt(int irq, void *dev_id)
 {
 	struct net_device *dev = (struct net_device *)dev_id;
 	struct sun4ican_priv *priv = netdev_priv(dev);
-	struct net_device_stats *stats = &dev->stats;
 	u8 isrc, status;
 	int n = 0;
 
@@ -669,21 +821,12 @@ static irqreturn_t sun4i_can_interrupt(int irq, void *dev_id)
 
 		if (isrc & SUN4I_INT_TBUF_VLD) {
 			/* transmission complete interrupt */
-			stats->tx_bytes +=
-			    readl(priv->base +
-				  SUN4I_REG_RBUF_RBACK_START_ADDR) & 0xf;
-			stats->tx_packets++;
-			can_get_echo_skb(dev, 0);
-			netif_wake_queue(dev);
-			can_led_event(dev, CAN_LED_EVENT_TX);
+			sun4i_can_tx_done(dev);
 		}
 		if (isrc & SUN4I_INT_RBUF_VLD) {
-			/* receive interrupt */
-			while (status & SUN4I_STA_RBUF_RDY) {
-				/* RX buffer is not empty */
-				sun4i_can_rx(dev);
-				status = readl(priv->base + SUN4I_REG_STA_ADDR);
-			}
+			/* receive interrupt - the FIFO gets drained by NAPI */
+			sun4i_can_rx_irq(priv, false);
+			napi_schedule(&priv->napi);
 		}
 		if (isrc &
 		    (SUN4I_INT_DATA_OR | SUN4I_INT_ERR_WRN | SUN4I_INT_BUS_ERR |
@@ -726,6 +869,8 @@ static int sun4ican_open(struct net_device *dev)
 		goto exit_clock;
 	}
 
+	napi_enable(&priv->napi);
+
 	err = sun4i_can_start(dev);
 	if (err) {
 		netdev_err(dev, "could not start CAN peripheral\n");
@@ -738,6 +883,7 @@ static int sun4ican_open(struct net_device *dev)
 	return 0;
 
 exit_can_start:
+	napi_disable(&priv->napi);
 	clk_disable_unprepare(priv->clk);
 exit_clock:
 	free_irq(dev->irq, dev);
@@ -751,6 +897,7 @@ static int sun4ican_close(struct net_device *dev)
 	struct sun4ican_priv *priv = netdev_priv(dev);
 
 	netif_stop_queue(dev);
+	napi_disable(&priv->napi);
 	sun4i_can_stop(dev);
 	clk_disable_unprepare(priv->clk);
 
@@ -774,10 +921,50 @@ static const struct of_device_id sun4ican_of_match[] = {
 
 MODULE_DEVICE_TABLE(of, sun4ican_of_match);
 
+#if defined(CONFIG_DEBUG_FS)
+static void sun4ican_debugfs_add(struct net_device *dev)
+{
+	struct sun4ican_priv *priv = netdev_priv(dev);
+	struct dentry *root, *rx;
+	char name[32];
+
+	snprintf(name, sizeof(name), DRV_NAME "-%s", dev->name);
+	priv->debugfs_dir = debugfs_create_dir(name, NULL);
+	root = priv->debugfs_dir;
+
+	rx = debugfs_create_dir("rx", root);
+	debugfs_create_u64("frames", 0444, rx, &priv->rx_frames);
+	debugfs_create_u32("polls", 0444, rx, &priv->rx_polls);
+	debugfs_create_u32("polls_full", 0444, rx, &priv->rx_polls_full);
+	debugfs_create_u32("rmcnt_max", 0444, rx, &priv->rx_rmcnt_max);
+	debugfs_create_u32("overruns", 0444, rx, &priv->rx_overruns);
+	debugfs_create_x32("overrun_rmcnt", 0444, rx,
+			   &priv->rx_overrun_rmcnt);
+	debugfs_create_x32("overrun_rbufsa", 0444, rx,
+			   &priv->rx_overrun_rbufsa);
+}
+
+static void sun4ican_debugfs_remove(struct net_device *dev)
+{
+	struct sun4ican_priv *priv = netdev_priv(dev);
+
+	debugfs_remove_recursive(priv->debugfs_dir);
+}
+#else
+static void sun4ican_debugfs_add(struct net_device *dev)
+{
+}
+
+static void sun4ican_debugfs_remove(struct net_device *dev)
+{
+}
+#endif
+
 static int sun4ican_remove(struct platform_device *pdev)
 {
 	struct net_device *dev = platform_get_drvdata(pdev);
 
+	sun4ican_debugfs_remove(dev);
 	unregister_netdev(dev);
 	free_candev(dev);
 
@@ -815,7 +1002,8 @@ static int sun4ican_probe(struct platform_device *pdev)
 		goto exit;
 	}
 
-	dev = alloc_candev(sizeof(struct sun4ican_priv), 1);
+	dev = alloc_candev(sizeof(struct sun4ican_priv),
+			   SUN4I_TX_RING_SIZE);
 	if (!dev) {
 		dev_err(&pdev->dev,
 			"could not allocate memory for CAN device\n");
@@ -840,6 +1028,8 @@ static int sun4ican_probe(struct platform_device *pdev)
 	priv->base = addr;
 	priv->clk = clk;
 	spin_lock_init(&priv->cmdreg_lock);
+	spin_lock_init(&priv->tx_lock);
+	netif_napi_add(dev, &priv->napi, sun4i_can_poll, NAPI_POLL_WEIGHT);
 
 	platform_set_drvdata(pdev, dev);
 	SET_NETDEV_DEV(dev, &pdev->dev);
@@ -851,6 +1041,7 @@ static int sun4ican_probe(struct platform_device *pdev)
 		goto exit_free;
 	}
 	devm_can_led_init(dev);
+	sun4ican_debugfs_add(dev);
 
 	dev_info(&pdev->dev, "device registered (base=%p, irq=%d)\n",
 		 priv->base, dev->irq);
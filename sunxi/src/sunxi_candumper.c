@@ -1,9 +1,15 @@
+#define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
+#include <libgen.h>
+#include <sched.h>
+#include <signal.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 
 #include <sys/mman.h>
@@ -14,9 +20,70 @@
 #define CAN_BASE_ADDR	(0x01C2BC00)
 #define CAN_MAP_LEN	(0x0200)
 
+/* register word offsets */
+#define CAN_REG_STA	(0x0008 / 4)
+#define CAN_REG_INT	(0x000c / 4)
+#define CAN_REG_ERRC	(0x001c / 4)
+#define CAN_REG_RMCNT	(0x0020 / 4)
+#define CAN_REG_RBUFSA	(0x0024 / 4)
+#define CAN_REG_BUF0	(0x0040 / 4)
+/* RX window: frame info, 2 or 4 id and up to 8 data bytes */
+#define CAN_RX_WIN_LEN	13
+
+#define CAN_MSG_EFF_FLAG	0x80
+#define CAN_MSG_RTR_FLAG	0x40
+
+/*
+ * snapshot ring file: header followed by the records - head counts all
+ * records ever written, the newest one is at (head - 1) % entries
+ */
+#define SNAP_MAGIC	"SXCANSNP"
+#define SNAP_VERSION	1
+#define SNAP_ENTRIES	65536
+#define SNAP_RATE	10000
+
+struct snap_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t rec_size;
+    uint32_t entries;
+    uint32_t period_ns;
+    /* CLOCK_REALTIME - CLOCK_MONOTONIC at start */
+    int64_t mono_to_real_ns;
+    uint64_t head;
+    uint64_t missed;
+};
+
+struct snap_record {
+    uint64_t ts_ns;	/* CLOCK_MONOTONIC */
+    uint32_t sta;
+    uint32_t isrc;
+    uint32_t errc;
+    uint8_t rmcnt;
+    uint8_t rbufsa;
+    uint8_t win[CAN_RX_WIN_LEN];
+    uint8_t pad[5];
+};
+
 int can_mem;
 int *can_map;
 
+static volatile sig_atomic_t running = 1;
+
+void print_usage(char *prg) {
+    fprintf(stderr, "\nUsage: %s [-s <ring file> | -d <ring file>]\n", prg);
+    fprintf(stderr, "         without options the RX window gets dumped once\n\n");
+    fprintf(stderr, "         -s <ring file>      sample continuously into the ring file\n");
+    fprintf(stderr, "         -r <rate>           samples per second - default %d\n", SNAP_RATE);
+    fprintf(stderr, "         -n <entries>        ring entries - default %d\n", SNAP_ENTRIES);
+    fprintf(stderr, "         -t <seconds>        stop after seconds - default until SIGINT\n");
+    fprintf(stderr, "         -u                  store changed snapshots only\n");
+    fprintf(stderr, "         -a <cpu>            run the sampler on this CPU\n");
+    fprintf(stderr, "         -P <prio>           SCHED_FIFO priority of the sampler\n");
+    fprintf(stderr, "         -d <ring file>      decode the ring file\n");
+    fprintf(stderr, "         -c                  decode in candump log format\n\n");
+}
+
 void print_byte_rows(int *ptr, int rows) {
     int i, j;
     int *my_ptr_row, *my_ptr;
@@ -83,12 +150,302 @@ void sunxi_can_close(void) {
     }
 }
 
+static void stop_sampler(int sig) {
+    running = 0;
+}
+
+static uint64_t ts_ns(clockid_t clock) {
+    struct timespec ts;
+
+    clock_gettime(clock, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void ns_to_timespec(uint64_t ns, struct timespec *ts) {
+    ts->tv_sec = ns / 1000000000ULL;
+    ts->tv_nsec = ns % 1000000000ULL;
+}
+
+/* map the ring file - the sampler creates it, the decoder only reads */
+static struct snap_header *snap_map(const char *file, uint32_t entries, int create, size_t *len) {
+    struct snap_header *hdr;
+    struct stat st;
+    int fd;
+
+    fd = open(file, create ? O_RDWR | O_CREAT | O_TRUNC : O_RDONLY, 0644);
+    if (fd < 0) {
+	fprintf(stderr, "can't open %s: %s\n", file, strerror(errno));
+	return NULL;
+    }
+
+    if (create) {
+	*len = sizeof(struct snap_header) + (size_t)entries * sizeof(struct snap_record);
+	if (ftruncate(fd, *len)) {
+	    fprintf(stderr, "can't size %s: %s\n", file, strerror(errno));
+	    close(fd);
+	    return NULL;
+	}
+    } else {
+	if (fstat(fd, &st) || st.st_size < (off_t)sizeof(struct snap_header)) {
+	    fprintf(stderr, "%s: not a snapshot file\n", file);
+	    close(fd);
+	    return NULL;
+	}
+	*len = st.st_size;
+    }
+
+    hdr = mmap(NULL, *len, create ? PROT_READ | PROT_WRITE : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (hdr == MAP_FAILED) {
+	fprintf(stderr, "can't mmap %s: %s\n", file, strerror(errno));
+	return NULL;
+    }
+
+    if (create) {
+	memcpy(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic));
+	hdr->version = SNAP_VERSION;
+	hdr->rec_size = sizeof(struct snap_record);
+	hdr->entries = entries;
+    } else if (memcmp(hdr->magic, SNAP_MAGIC, sizeof(hdr->magic)) ||
+	       hdr->version != SNAP_VERSION ||
+	       hdr->rec_size != sizeof(struct snap_record) ||
+	       *len < sizeof(struct snap_header) + (size_t)hdr->entries * sizeof(struct snap_record)) {
+	fprintf(stderr, "%s: not a snapshot file\n", file);
+	munmap(hdr, *len);
+	return NULL;
+    }
+
+    return hdr;
+}
+
+/* read the registers of interest - no formatting, no syscalls */
+static void snap_take(volatile uint32_t *regs, struct snap_record *rec) {
+    int i;
+
+    rec->sta = regs[CAN_REG_STA];
+    rec->isrc = regs[CAN_REG_INT];
+    rec->errc = regs[CAN_REG_ERRC];
+    rec->rmcnt = regs[CAN_REG_RMCNT];
+    rec->rbufsa = regs[CAN_REG_RBUFSA];
+    for (i = 0; i < CAN_RX_WIN_LEN; i++)
+	rec->win[i] = regs[CAN_REG_BUF0 + i];
+}
+
+static int snap_sample(const char *file, uint32_t entries, uint32_t rate, int seconds, int changes_only,
+		       int cpu, int prio) {
+    volatile uint32_t *regs = (volatile uint32_t *)can_map;
+    struct snap_record *ring, cur, last;
+    struct snap_header *hdr;
+    struct sched_param sp;
+    struct timespec next_ts;
+    uint64_t head, period, next, now, end;
+    cpu_set_t cpus;
+    size_t len;
+
+    if (cpu >= 0) {
+	CPU_ZERO(&cpus);
+	CPU_SET(cpu, &cpus);
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+	    fprintf(stderr, "can't bind to CPU %d: %s\n", cpu, strerror(errno));
+    }
+    if (prio > 0) {
+	memset(&sp, 0, sizeof(sp));
+	sp.sched_priority = prio;
+	if (sched_setscheduler(0, SCHED_FIFO, &sp))
+	    fprintf(stderr, "can't set SCHED_FIFO: %s\n", strerror(errno));
+    }
+
+    hdr = snap_map(file, entries, 1, &len);
+    if (!hdr)
+	return EXIT_FAILURE;
+    ring = (struct snap_record *)(hdr + 1);
+
+    period = 1000000000ULL / rate;
+    hdr->period_ns = period;
+    hdr->mono_to_real_ns = ts_ns(CLOCK_REALTIME) - ts_ns(CLOCK_MONOTONIC);
+
+    signal(SIGINT, stop_sampler);
+    signal(SIGTERM, stop_sampler);
+
+    memset(&last, 0, sizeof(last));
+    memset(&cur, 0, sizeof(cur));
+    head = 0;
+    next = ts_ns(CLOCK_MONOTONIC);
+    end = seconds > 0 ? next + (uint64_t)seconds * 1000000000ULL : 0;
+
+    while (running) {
+	snap_take(regs, &cur);
+	now = ts_ns(CLOCK_MONOTONIC);
+	if (!changes_only || !head ||
+	    memcmp(&cur.sta, &last.sta, sizeof(cur) - offsetof(struct snap_record, sta))) {
+	    cur.ts_ns = now;
+	    ring[head % entries] = cur;
+	    /* publish the record before the head */
+	    __atomic_store_n(&hdr->head, ++head, __ATOMIC_RELEASE);
+	    last = cur;
+	}
+	if (end && now >= end)
+	    break;
+
+	next += period;
+	if (next <= now) {
+	    /* late - skip the ticks instead of catching up */
+	    hdr->missed += (now - next) / period + 1;
+	    next = now + period;
+	}
+	ns_to_timespec(next, &next_ts);
+	clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next_ts, NULL);
+    }
+
+    printf("%llu snapshots, %llu ticks missed\n", (unsigned long long)head,
+	   (unsigned long long)hdr->missed);
+    msync(hdr, len, MS_SYNC);
+    munmap(hdr, len);
+
+    return EXIT_SUCCESS;
+}
+
+static void snap_print_frame(const struct snap_record *rec, int64_t mono_to_real) {
+    uint64_t ts = rec->ts_ns + mono_to_real;
+    uint8_t fi = rec->win[0];
+    const uint8_t *data;
+    uint32_t id;
+    int i, dlc;
+
+    dlc = fi & 0x0f;
+    if (dlc > 8)
+	dlc = 8;
+    if (fi & CAN_MSG_EFF_FLAG) {
+	data = &rec->win[5];
+	id = (rec->win[1] << 21) | (rec->win[2] << 13) | (rec->win[3] << 5) | ((rec->win[4] >> 3) & 0x1f);
+    } else {
+	data = &rec->win[3];
+	id = (rec->win[1] << 3) | ((rec->win[2] >> 5) & 0x7);
+    }
+
+    printf("(%llu.%06llu) can0 ", (unsigned long long)(ts / 1000000000ULL),
+	   (unsigned long long)(ts % 1000000000ULL / 1000));
+    if (fi & CAN_MSG_EFF_FLAG)
+	printf("%08X#", id);
+    else
+	printf("%03X#", id);
+    if (fi & CAN_MSG_RTR_FLAG) {
+	putchar('R');
+    } else {
+	for (i = 0; i < dlc; i++)
+	    printf("%02X", data[i]);
+    }
+    putchar('\n');
+}
+
+static void snap_print_text(const struct snap_record *rec, uint64_t t0) {
+    uint64_t ts = rec->ts_ns - t0;
+    int i;
+
+    printf("%6llu.%09llu sta %08x int %02x tec %3u rec %3u rmcnt %2u rbufsa %2u  win",
+	   (unsigned long long)(ts / 1000000000ULL), (unsigned long long)(ts % 1000000000ULL),
+	   rec->sta, rec->isrc, rec->errc & 0xff, (rec->errc >> 16) & 0xff, rec->rmcnt, rec->rbufsa);
+    for (i = 0; i < CAN_RX_WIN_LEN; i++)
+	printf(" %02x", rec->win[i]);
+    putchar('\n');
+}
+
+static int snap_decode(const char *file, int candump) {
+    const struct snap_record *ring, *rec, *prev = NULL;
+    struct snap_header *hdr;
+    uint64_t head, i, first;
+    size_t len;
+
+    hdr = snap_map(file, 0, 0, &len);
+    if (!hdr)
+	return EXIT_FAILURE;
+    ring = (const struct snap_record *)(hdr + 1);
+
+    head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+    first = head > hdr->entries ? head - hdr->entries : 0;
+    if (!candump)
+	printf("# %llu snapshots (%llu lost by the ring), period %u ns, %llu ticks missed\n",
+	       (unsigned long long)head, (unsigned long long)first, hdr->period_ns,
+	       (unsigned long long)hdr->missed);
+
+    for (i = first; i < head; i++) {
+	rec = &ring[i % hdr->entries];
+	if (candump) {
+	    /* a new frame in front of the FIFO */
+	    if (rec->rmcnt && (!prev || !prev->rmcnt || prev->rbufsa != rec->rbufsa ||
+			       memcmp(prev->win, rec->win, CAN_RX_WIN_LEN)))
+		snap_print_frame(rec, hdr->mono_to_real_ns);
+	    prev = rec;
+	} else {
+	    snap_print_text(rec, ring[first % hdr->entries].ts_ns);
+	}
+    }
+
+    munmap(hdr, len);
+    return EXIT_SUCCESS;
+}
+
 int main(int argc, char **argv) {
-    int ret;
+    char *sample_file = NULL, *decode_file = NULL;
+    uint32_t entries = SNAP_ENTRIES, rate = SNAP_RATE;
+    int opt, ret, seconds = 0, changes_only = 0, candump = 0, cpu = -1, prio = 0;
+
+    while ((opt = getopt(argc, argv, "s:r:n:t:ua:P:d:ch?")) != -1) {
+	switch (opt) {
+	case 's':
+	    sample_file = optarg;
+	    break;
+	case 'r':
+	    rate = strtoul(optarg, (char **)NULL, 10);
+	    break;
+	case 'n':
+	    entries = strtoul(optarg, (char **)NULL, 10);
+	    break;
+	case 't':
+	    seconds = strtoul(optarg, (char **)NULL, 10);
+	    break;
+	case 'u':
+	    changes_only = 1;
+	    break;
+	case 'a':
+	    cpu = strtoul(optarg, (char **)NULL, 10);
+	    break;
+	case 'P':
+	    prio = strtoul(optarg, (char **)NULL, 10);
+	    break;
+	case 'd':
+	    decode_file = optarg;
+	    break;
+	case 'c':
+	    candump = 1;
+	    break;
+	case 'h':
+	case '?':
+	    print_usage(basename(argv[0]));
+	    exit(0);
+	default:
+	    fprintf(stderr, "Unknown option %c\n", opt);
+	    print_usage(basename(argv[0]));
+	    exit(1);
+	}
+    }
+
+    if (decode_file)
+	return snap_decode(decode_file, candump);
+
+    if (sample_file && (!rate || rate > 1000000000 || !entries)) {
+	fprintf(stderr, "invalid rate or ring size\n");
+	exit(1);
+    }
 
     ret = sunxi_can_open("/dev/mem");
     if (ret == EXIT_FAILURE)
 	return EXIT_FAILURE;
-    print_byte_rows(can_map + 0x40, 8);
+    if (sample_file)
+	ret = snap_sample(sample_file, entries, rate, seconds, changes_only, cpu, prio);
+    else
+	print_byte_rows(can_map + 0x40, 8);
     sunxi_can_close();
+
+    return sample_file ? ret : EXIT_SUCCESS;
 }